@@ -17,76 +17,100 @@
 #include <common-fun.h>
 #include "ppsi-sim.h"
 
-/* Call pp_state_machine for each instance. To be called periodically,
- * when no packets are incoming */
-static int run_all_state_machines(struct pp_globals *ppg)
+/*
+ * Run the state machine of a port, and return the ns to its deadline.
+ * That is in the clock of its node, which is close enough to ours.
+ */
+static int64_t run_state_machine(struct pp_instance *ppi, void *pkt, int plen)
+{
+	int64_t left;
+
+	pp_state_machine(ppi, pkt, plen);
+	left = ppi->next_deadline - ppi->t_ops->calc_timeout(ppi, 0);
+	return left < 0 ? 0 : left;
+}
+
+/* Call pp_state_machine for each port of each node. To be called
+ * periodically, when no packets are incoming */
+static int64_t run_all_state_machines(struct sim_world *w)
 {
 	int j;
-	int delay_ms = 0, delay_ms_j;
+	int64_t delay_ns = 0, delay_ns_j;
 
-	for (j = 0; j < ppg->nlinks; j++) {
-		struct pp_instance *ppi = INST(ppg, j);
-		sim_set_global_DS(ppi);
-		delay_ms_j = pp_state_machine(ppi, NULL, 0);
+	for (j = 0; j < w->parse_ppg->nlinks; j++) {
+		struct pp_instance *ppi = w->ports + j;
+		delay_ns_j = run_state_machine(ppi, NULL, 0);
 
-		/* delay_ms is the least delay_ms among all instances */
+		/* delay_ns is the least delay_ns among all instances */
 		if (j == 0)
-			delay_ms = delay_ms_j;
-		if (delay_ms_j < delay_ms)
-			delay_ms = delay_ms_j;
+			delay_ns = delay_ns_j;
+		if (delay_ns_j < delay_ns)
+			delay_ns = delay_ns_j;
 	}
 
-	return delay_ms;
+	return delay_ns;
 }
 
+/* Each node is a clock of its own, with its own best master */
+static void run_all_bmc(struct sim_world *w)
+{
+	struct pp_globals *ppg;
+	int i, j;
+
+	for (i = 0; i < w->n_nodes; i++) {
+		ppg = w->nodes[i];
+		if (!ppg->ebest_updated)
+			continue;
+		for (j = 0; j < ppg->nlinks; j++) {
+			int new_state;
+			struct pp_instance *ppi = INST(ppg ,j);
+			new_state = bmc(ppi);
+			if (new_state != ppi->state) {
+				ppi->state = new_state;
+				ppi->is_new_state = 1;
+			}
+		}
+		ppg->ebest_updated = 0;
+	}
+}
 
-void sim_main_loop(struct pp_globals *ppg)
+void sim_main_loop(struct sim_world *w)
 {
 	struct pp_instance *ppi;
-	struct sim_ppg_arch_data *data = SIM_PPG_ARCH(ppg);
+	struct sim_pending_pkt *pkt;
 	int64_t delay_ns, tmp_ns;
 	int j, i;
 
 	/* Initialize each link's state machine */
-	for (j = 0; j < ppg->nlinks; j++) {
-		ppi = INST(ppg, j);
+	for (j = 0; j < w->parse_ppg->nlinks; j++) {
+		ppi = w->ports + j;
 		ppi->is_new_state = 1;
 	}
 
-	delay_ns = run_all_state_machines(ppg) * 1000LL * 1000LL;
+	delay_ns = run_all_state_machines(w);
 
-	while (data->sim_iter_n <= data->sim_iter_max) {
+	while (w->sim_iter_n <= w->sim_iter_max) {
 		/*
 		 * If Ebest was changed in previous loop, run best
 		 * master clock before checking for new packets, which
 		 * would affect port state again
 		 */
-		if (ppg->ebest_updated) {
-			for (j = 0; j < ppg->nlinks; j++) {
-				int new_state;
-				struct pp_instance *ppi = INST(ppg ,j);
-				new_state = bmc(ppi);
-				if (new_state != ppi->state) {
-					ppi->state = new_state;
-					ppi->is_new_state = 1;
-				}
-			}
-			ppg->ebest_updated = 0;
-		}
+		run_all_bmc(w);
 
-		while (data->n_pending && data->pending->delay_ns <= delay_ns) {
-			ppi = INST(ppg, data->pending->which_ppi);
+		while ((pkt = sim_first_pending(w)) &&
+		       pkt->at_ns - w->now_ns <= delay_ns) {
+			ppi = w->ports + pkt->which_ppi;
 
-			sim_fast_forward_ns(ppg, data->pending->delay_ns);
-			delay_ns -= data->pending->delay_ns;
+			tmp_ns = pkt->at_ns - w->now_ns;
+			sim_fast_forward_ns(w, tmp_ns);
+			delay_ns -= tmp_ns;
 
 			i = __recv_and_count(ppi, ppi->rx_frame,
 						PP_MAX_FRAME_LENGTH - 4,
 						&ppi->last_rcv_time);
 
-			sim_set_global_DS(ppi);
-			tmp_ns = 1000LL * 1000LL * pp_state_machine(ppi,
-					ppi->rx_ptp, i - ppi->rx_offset);
+			tmp_ns = run_state_machine(ppi, ppi->rx_ptp,
+						   i - ppi->rx_offset);
 
 			if (tmp_ns < delay_ns)
 				delay_ns = tmp_ns;
@@ -95,8 +119,8 @@ void sim_main_loop(struct pp_globals *ppg)
 		 * machine is expired (so delay_ns == 0). If the timeout is not
 		 * expired we just fast forward till it's not expired, since we
 		 * know that there are no packets pending. */
-		sim_fast_forward_ns(ppg, delay_ns);
-		delay_ns = run_all_state_machines(ppg) * 1000LL * 1000LL;
+		sim_fast_forward_ns(w, delay_ns);
+		delay_ns = run_all_state_machines(w);
 	}
 	return;
 }
@@ -23,43 +23,180 @@ struct pp_sim_time_instance {
 /*
  * This structure holds the parameter representing the delays on the outgoing
  * link of every pp_instance. All the values are expressed in the *absolute*
- * timescale, which is represented by the master time.
+ * timescale, which is represented by the time of the first node.
  */
+/*
+ * The random part of the delay follows a model ("sim_pdv", see sim-pdv.c):
+ * by default it is uniform between 0 and jit_ns. It is never negative,
+ * so t_prop_ns is the minimum delay of the link.
+ */
+enum sim_pdv_type {
+	SIM_PDV_UNIFORM = 0,
+	SIM_PDV_GAUSS,		/* ns is the mean, shape the sigma in ns */
+	SIM_PDV_PARETO,		/* ns is the scale, shape is alpha */
+	SIM_PDV_LOGNORMAL,	/* ns is the median, shape is sigma */
+	SIM_PDV_TRACE,		/* recorded delays, replayed in a loop */
+};
+
+struct sim_trace {
+	struct sim_trace *next;		/* all of them, to free the world */
+	char *fname;			/* so each file is only read once */
+	int n;
+	int64_t ns[];
+};
+
+struct sim_pdv {
+	int type;
+	int64_t ns;
+	double shape;
+	struct sim_trace *trace;
+};
+
+/* Periodic congestion: the queue fills up for len_ns every period_ns */
+struct sim_burst {
+	int64_t period_ns, len_ns, extra_ns;
+};
+
+/*
+ * Gilbert loss model: a link is good or bad, and frames are lost while it
+ * is bad. Probabilities of changing state at each frame are scaled by 2^31.
+ */
+struct sim_loss {
+	uint32_t p_bad, p_good;
+};
+
 struct pp_sim_net_delay {
 	unsigned int t_prop_ns; // propagation delay on outgoing link
 	uint64_t jit_ns; // jitter in nsec on outgoing link
 	uint64_t last_outgoing_jit_ns;
+	struct sim_pdv pdv;
+	struct sim_burst burst;
+	struct sim_loss loss;
+	int trace_pos;
+	int bad;			/* state of the loss model */
+};
+
+/*
+ * Delays as configured, for a node (default for its ports) or a port.
+ * They are applied to links once all the topology is known: "in" is
+ * from the peer to this port, "out" from this port to the peer.
+ */
+enum { SIM_IN = 0, SIM_OUT };
+#define SIM_SET_PROP(dir)	(0x01 << (8 * (dir)))
+#define SIM_SET_JIT(dir)	(0x02 << (8 * (dir)))
+#define SIM_SET_PDV(dir)	(0x04 << (8 * (dir)))
+#define SIM_SET_BURST(dir)	(0x08 << (8 * (dir)))
+#define SIM_SET_LOSS(dir)	(0x10 << (8 * (dir)))
+
+struct sim_link_cfg {
+	int set;			/* SIM_SET_ flags */
+	unsigned int t_prop_ns[2];
+	uint64_t jit_ns[2];
+	struct sim_pdv pdv[2];
+	struct sim_burst burst[2];
+	struct sim_loss loss[2];
 };
 
 /*
  * This structure represets a pending packet. which_ppi is the destination ppi,
- * chtype is the channel and delay_ns is the time that should pass from when the
- * packet is sent until it will be received from the destination.
+ * as an index in the array of all ports (see sim_world),
+ * frame is a copy of what was sent and at_ns is when it will be received
+ * from the destination, in the timescale of the simulation (sim_world.now_ns).
  * Every time a packet is sent a structure like this is filled and stored in the
- * ppg->arch_data so that we always know which is the first packet that has to
- * be received and when.
+ * world so that we always know which is the first packet that has to
+ * be received and when. seq orders frames with the same at_ns: first sent,
+ * first received, so a Follow_Up never overtakes its Sync.
  */
+struct sim_frame {
+	struct sim_frame *next;		/* when unused */
+	int len;
+	unsigned char data[PP_MAX_FRAME_LENGTH];
+};
+
 struct sim_pending_pkt {
-	int64_t delay_ns;
+	int64_t at_ns;
+	uint64_t seq;
 	int which_ppi;
-	int chtype;
+	struct sim_frame *frame;
+};
+
+#define SIM_MAX_NODES	PP_MAX_LINKS
+#define SIM_PENDING_MIN	64	/* initial size of the queue, it then grows */
+
+/*
+ * What we measure in a simulation: the offset of the last node from the
+ * first one, at each Delay_Resp it gets. The run converged at conv_at_ns
+ * if the offset is within sim_conv_ns since then (-1: it is not). The
+ * rms and max offsets are measured over the second half of the run.
+ */
+struct sim_stats {
+	int64_t conv_at_ns;
+	int64_t max_ns;
+	int64_t n;
+	double sumsq;
 };
+
 /*
- * Structure holding an array of pending packets. 64 does not have a special
- * meaning. They could be less if you look inside the ptp specification, but
- * I put 64 just to be sure.
- * The aim of this structure is to store information on flying packets and when
+ * The simulated network. Each node (an ordinary clock, or a boundary clock
+ * with several ports) is a pp_globals, with its own clock and data sets,
+ * but all ports live in the same array, so the config parser can fill
+ * them in order. The first node is the reference for "real" offsets.
+ *
+ * The pending queue stores information on flying packets and when
  * the'll be received, because the standard state machine timeouts are not
  * enough for this. Infact the main loop need to know if there are some packets
  * arriving and when, otherwise it will not know how much fast forwarding is
  * needed. If you fast forward based on timeouts they will expire before any
  * packet has arrived and the state machine will do nothing.
+ * It is a binary heap (pending[0] is the next frame to be received), that
+ * grows as needed.
  */
-struct sim_ppg_arch_data {
-	int n_pending;
-	struct sim_pending_pkt pending[64];
+struct sim_world {
+	int64_t now_ns;			/* time elapsed in the simulation */
+	int n_pending, max_pending;
+	uint64_t pending_seq;
+	struct sim_pending_pkt *pending;
+	struct sim_frame *free_frames;
 	int64_t sim_iter_max;
 	int64_t sim_iter_n;
+	int64_t init_time_ns;		/* of the first node */
+	uint64_t seed, rand;		/* jitter and timeouts of this run */
+	struct sim_trace *traces;	/* delay traces read by the config */
+	struct sim_trace *shared_traces; /* read-only, owned by the runner */
+
+	/* Monte Carlo runs (sim-runner.c), and the results of each run */
+	int runs, threads;
+	int64_t conv_ns;
+	struct sim_stats stats;
+
+	struct pp_globals *parse_ppg;	/* all ports, for the config */
+	struct pp_instance *ports;
+	int n_nodes;
+	struct pp_globals *nodes[SIM_MAX_NODES];
+};
+
+/*
+ * Structure holding parameters and informations restricted to a single
+ * node, like timing informations. Infact in the simulator, even if all
+ * nodes are inside the same process, they act like every one of
+ * them had its own clock.
+ * Some more data we need in every node are Data Sets, runtime options,
+ * servo and TimeProperties: the pointers in the node's ppg refer to them.
+ * Even more stuff can be added if needed
+ */
+struct sim_ppg_arch_data {
+	struct sim_world *world;
+	char name[16];
+	int first_port;			/* in world->ports */
+	struct pp_sim_time_instance time;
+	int64_t init_ofm_ns;		/* from the first node, once parsed */
+	struct sim_link_cfg link;	/* default for the ports */
+	struct pp_servo servo;
+	struct pp_runtime_opts rt_opts;
+	DSDefault defaultDS;
+	DSCurrent currentDS;
+	DSParent parentDS;
+	DSTimeProperties timePropertiesDS;
 };
 
 static inline struct sim_ppg_arch_data *SIM_PPG_ARCH(struct pp_globals *ppg)
@@ -67,63 +204,77 @@ static inline struct sim_ppg_arch_data *SIM_PPG_ARCH(struct pp_globals *ppg)
 	return (struct sim_ppg_arch_data *)(ppg->arch_data);
 }
 
-/*
- * Structure holding parameters and informations restricted to just a single
- * instance, like timing informations. Infact in the simulator, even if both
- * master and slave are ppi inside the same ppg, they act like every one of
- * them had its own clock.
- * Some more data we need in every instance are Data Sets, runtime options,
- * servo and TimeProperties. We need them because, since we have two ppi
- * acting like two different machines, we have to use different copies of
- * these data for every one of them. So we just put the per-instance data
- * here and we will the pointers in ppg according to our needs every time
- * we will need to use them.
- * Even more stuff can be added if needed
- */
+static inline struct sim_world *SIM_WORLD(struct pp_globals *ppg)
+{
+	return SIM_PPG_ARCH(ppg)->world;
+}
+
+/* Structure holding parameters of a single port */
 struct sim_ppi_arch_data {
-	struct pp_sim_time_instance time;
 	struct pp_sim_net_delay n_delay;
-	/* servo */
-	struct pp_servo *servo;
-	/* Runtime options */
-	struct pp_runtime_opts *rt_opts;
-	/* Data sets */
-	DSDefault *defaultDS;
-	DSCurrent *currentDS;
-	DSParent *parentDS;
-	DSTimeProperties *timePropertiesDS;
-	/* other pp_instance, used in net ops */
-	struct pp_instance *other_ppi;
+	struct sim_link_cfg link;
+	char peer_name[16];		/* from config, resolved later */
+	/* the port at the other end of the link, used in net ops */
+	struct pp_instance *peer;
 };
-/* symbolic names to address master and slave in ppg->pp_instances */
-#define SIM_SLAVE	1
-#define SIM_MASTER	0
 
 static inline struct sim_ppi_arch_data *SIM_PPI_ARCH(struct pp_instance *ppi)
 {
 	return (struct sim_ppi_arch_data *)(ppi->arch_data);
 }
 
-static inline struct pp_instance *pp_sim_get_master(struct pp_globals *ppg)
+/* The clock of the node this port belongs to */
+static inline struct pp_sim_time_instance *SIM_TIME(struct pp_instance *ppi)
+{
+	return &SIM_PPG_ARCH(GLBS(ppi))->time;
+}
+
+/* Index in world->ports, used for pending frames */
+static inline int pp_sim_port_idx(struct pp_instance *ppi)
 {
-	return INST(ppg, SIM_MASTER);
+	return ppi - SIM_WORLD(GLBS(ppi))->ports;
 }
 
-static inline struct pp_instance *pp_sim_get_slave(struct pp_globals *ppg)
+/* Index of the node, 0 is the reference clock */
+static inline int pp_sim_node_idx(struct pp_globals *ppg)
 {
-	return INST(ppg, SIM_SLAVE);
+	struct sim_world *w = SIM_WORLD(ppg);
+	int i;
+
+	for (i = 0; i < w->n_nodes; i++)
+		if (w->nodes[i] == ppg)
+			return i;
+	return -1;
 }
 
-static inline int pp_sim_is_master(struct pp_instance *ppi)
+/* Random numbers for the simulated network, 31 bits (64-bit MMIX LCG) */
+static inline uint32_t sim_rand(struct sim_world *w)
 {
-	return ((ppi - ppi->glbs->pp_instances) == SIM_MASTER);
+	w->rand = w->rand * 6364136223846793005ULL + 1442695040888963407ULL;
+	return w->rand >> 33;
 }
 
-static inline int pp_sim_is_slave(struct pp_instance *ppi)
+/* The next frame to be received, or NULL */
+static inline struct sim_pending_pkt *sim_first_pending(struct sim_world *w)
 {
-	return ((ppi - ppi->glbs->pp_instances) == SIM_SLAVE);
+	return w->n_pending ? w->pending : NULL;
 }
 
-extern int sim_fast_forward_ns(struct pp_globals *ppg, int64_t ff_ns);
-extern int sim_set_global_DS(struct pp_instance *ppi);
-extern void sim_main_loop(struct pp_globals *ppg);
+/* sim-pdv.c */
+extern int64_t sim_link_jitter(struct sim_world *w,
+			       struct pp_sim_net_delay *d);
+extern int sim_link_lost(struct sim_world *w, struct pp_sim_net_delay *d);
+extern struct sim_trace *sim_read_trace(struct sim_world *w, char *fname);
+extern void sim_free_traces(struct sim_trace *t);
+
+extern int sim_fast_forward_ns(struct sim_world *w, int64_t ff_ns);
+extern struct pp_globals *sim_new_node(struct sim_world *w, char *name);
+extern struct sim_world *sim_new_world(int argc, char **argv,
+				       struct sim_trace *shared_traces);
+extern void sim_free_world(struct sim_world *w);
+extern void sim_set_seed(struct sim_world *w, uint64_t seed);
+extern void sim_stats_sample(struct sim_world *w, int64_t ofm_ns);
+extern int sim_run_many(struct sim_world *w, int argc, char **argv);
+extern __thread int sim_quiet;
+extern int sim_build_topology(struct sim_world *w);
+extern void sim_main_loop(struct sim_world *w);
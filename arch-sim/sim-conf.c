@@ -5,73 +5,120 @@
  * Released according to GNU LGPL, version 2.1 or any later
  */
 
+#include <stdio.h>
+
 #include <ppsi/ppsi.h>
 #include "ppsi-sim.h"
 
+/*
+ * Clock options act on the current node (the one of the last "sim_node"
+ * line, or the slave if there is none); the master of the default setup is
+ * supposed to be perfect.
+ */
 static int f_ppm_real(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 			union pp_cfg_arg *arg)
 {
-	struct pp_instance *ppi_slave;
-
-	/* master clock is supposed to be perfect. parameters about ppm are
-	 * modifiable only for slave ppi */
-	ppi_slave = pp_sim_get_slave(ppg);
-	SIM_PPI_ARCH(ppi_slave)->time.freq_ppb_real = arg->i * 1000;
+	SIM_PPG_ARCH(ppg)->time.freq_ppb_real = arg->i * 1000;
 	return 0;
 }
 
 static int f_ppm_servo(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 			union pp_cfg_arg *arg)
 {
-	struct pp_instance *ppi_slave;
-
-	/* master clock is supposed to be perfect. parameters about ppm are
-	 * modifiable only for slave ppi */
-	ppi_slave = pp_sim_get_slave(ppg);
-	SIM_PPI_ARCH(ppi_slave)->time.freq_ppb_servo = arg->i * 1000;
+	SIM_PPG_ARCH(ppg)->time.freq_ppb_servo = arg->i * 1000;
 	return 0;
 }
 
+/* The time of each node is set after parsing, from the first node's time */
 static int f_ofm(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 			union pp_cfg_arg *arg)
 {
-	struct pp_sim_time_instance *t_master, *t_slave;
-
-	t_master = &SIM_PPI_ARCH(pp_sim_get_master(ppg))->time;
-	t_slave = &SIM_PPI_ARCH(pp_sim_get_slave(ppg))->time;
-	t_slave->current_ns = t_master->current_ns + arg->ts.tv_nsec +
+	SIM_PPG_ARCH(ppg)->init_ofm_ns = arg->ts.tv_nsec +
 				arg->ts.tv_sec * (long long)PP_NSEC_PER_SEC;
-
 	return 0;
 }
 
 static int f_init_time(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 			union pp_cfg_arg *arg)
 {
-	struct pp_sim_time_instance *t_inst;
-
-	t_inst = &SIM_PPI_ARCH(pp_sim_get_master(ppg))->time;
-	t_inst->current_ns = arg->ts.tv_nsec +
+	SIM_WORLD(ppg)->init_time_ns = arg->ts.tv_nsec +
 				arg->ts.tv_sec * (long long)PP_NSEC_PER_SEC;
+	return 0;
+}
+
+static int f_node(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		  union pp_cfg_arg *arg)
+{
+	struct sim_ppg_arch_data *data = SIM_PPG_ARCH(ppg);
+	struct sim_world *w = data->world;
+
+	ppg->cfg.cur_ppi_n = -1;
+	/* The node we started with may still be empty: just name it */
+	if (ppg->nlinks == data->first_port) {
+		strncpy(data->name, arg->s, sizeof(data->name) - 1);
+		return 0;
+	}
+	if (!sim_new_node(w, arg->s)) {
+		pp_printf("config line %i: too many nodes\n", lineno);
+		return -1;
+	}
+	return 0;
+}
+
+static int f_peer(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		  union pp_cfg_arg *arg)
+{
+	struct pp_instance *ppi;
 
+	if (ppg->cfg.cur_ppi_n < 0) {
+		pp_printf("config line %i: no port for this config\n", lineno);
+		return -1;
+	}
+	ppi = INST(ppg, ppg->cfg.cur_ppi_n);
+	strncpy(SIM_PPI_ARCH(ppi)->peer_name, arg->s,
+		sizeof(SIM_PPI_ARCH(ppi)->peer_name) - 1);
 	return 0;
 }
 
+/*
+ * Link delays: "fwd" is toward us, "bckwd" is from us (in the default
+ * setup, from the master to the slave and back). Under a port they are for
+ * that port, otherwise they are the default of the current node.
+ */
+static struct sim_link_cfg *sim_cur_link(struct pp_globals *ppg)
+{
+	if (ppg->cfg.cur_ppi_n >= 0)
+		return &SIM_PPI_ARCH(INST(ppg, ppg->cfg.cur_ppi_n))->link;
+	return &SIM_PPG_ARCH(ppg)->link;
+}
+
+static void sim_set_prop(struct pp_globals *ppg, int dir, int val)
+{
+	struct sim_link_cfg *link = sim_cur_link(ppg);
+
+	link->t_prop_ns[dir] = val;
+	link->set |= SIM_SET_PROP(dir);
+}
+
+static void sim_set_jit(struct pp_globals *ppg, int dir, int val)
+{
+	struct sim_link_cfg *link = sim_cur_link(ppg);
+
+	link->jit_ns[dir] = val;
+	link->set |= SIM_SET_JIT(dir);
+}
+
 static int f_fwd_t_prop(struct pp_argline *l, int lineno,
 			struct pp_globals *ppg, union pp_cfg_arg *arg)
 {
-	struct sim_ppi_arch_data *data;
-	data = SIM_PPI_ARCH(pp_sim_get_master(ppg));
-	data->n_delay.t_prop_ns = arg->i;
+	sim_set_prop(ppg, SIM_IN, arg->i);
 	return 0;
 }
 
 static int f_bckwd_t_prop(struct pp_argline *l, int lineno,
 			  struct pp_globals *ppg, union pp_cfg_arg *arg)
 {
-	struct sim_ppi_arch_data *data;
-	data = SIM_PPI_ARCH(pp_sim_get_slave(ppg));
-	data->n_delay.t_prop_ns = arg->i;
+	sim_set_prop(ppg, SIM_OUT, arg->i);
 	return 0;
 }
 
@@ -86,9 +133,7 @@ static int f_t_prop(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 static int f_fwd_jit(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 			union pp_cfg_arg *arg)
 {
-	struct sim_ppi_arch_data *data;
-	data = SIM_PPI_ARCH(pp_sim_get_master(ppg));
-	data->n_delay.jit_ns = arg->i;
+	sim_set_jit(ppg, SIM_IN, arg->i);
 	return 0;
 }
 
@@ -96,9 +141,7 @@ static int f_fwd_jit(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 static int f_bckwd_jit(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 			union pp_cfg_arg *arg)
 {
-	struct sim_ppi_arch_data *data;
-	data = SIM_PPI_ARCH(pp_sim_get_slave(ppg));
-	data->n_delay.jit_ns = arg->i;
+	sim_set_jit(ppg, SIM_OUT, arg->i);
 	return 0;
 }
 
@@ -110,14 +153,219 @@ static int f_jit(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 	return 0;
 }
 
+/*
+ * Delay models and losses, with the same rules as delays. The argument is
+ * parsed here, as it is more than a number.
+ */
+#define SIM_DIR(dir)	(1 << (dir))
+#define SIM_BOTH	(SIM_DIR(SIM_IN) | SIM_DIR(SIM_OUT))
+
+static int sim_cfg_pdv(struct pp_globals *ppg, int lineno, char *s, int dirs)
+{
+	struct sim_link_cfg *link = sim_cur_link(ppg);
+	struct sim_pdv pdv = {};
+	char name[16], fname[256];
+	long long ns = 0;
+	int dir;
+
+	if (sscanf(s, "%15s", name) != 1)
+		goto err;
+	if (!strcmp(name, "uniform")) {
+		pdv.type = SIM_PDV_UNIFORM;
+	} else if (!strcmp(name, "trace")) {
+		if (sscanf(s, "%*s %255s", fname) != 1)
+			goto err;
+		pdv.type = SIM_PDV_TRACE;
+		pdv.trace = sim_read_trace(SIM_WORLD(ppg), fname);
+		if (!pdv.trace)
+			return -1;
+	} else {
+		if (!strcmp(name, "gauss"))
+			pdv.type = SIM_PDV_GAUSS;
+		else if (!strcmp(name, "pareto"))
+			pdv.type = SIM_PDV_PARETO;
+		else if (!strcmp(name, "lognormal"))
+			pdv.type = SIM_PDV_LOGNORMAL;
+		else
+			goto err;
+		if (sscanf(s, "%*s %lli %lf", &ns, &pdv.shape) != 2 || ns < 0)
+			goto err;
+		if (pdv.shape < 0 ||
+		    (pdv.type == SIM_PDV_PARETO && pdv.shape == 0))
+			goto err;
+		pdv.ns = ns;
+	}
+	for (dir = SIM_IN; dir <= SIM_OUT; dir++) {
+		if (!(dirs & SIM_DIR(dir)))
+			continue;
+		link->pdv[dir] = pdv;
+		link->set |= SIM_SET_PDV(dir);
+	}
+	return 0;
+err:
+	pp_printf("config line %i: wrong delay model \"%s\"\n", lineno, s);
+	return -1;
+}
+
+static int sim_cfg_burst(struct pp_globals *ppg, int lineno, char *s,
+			 int dirs)
+{
+	struct sim_link_cfg *link = sim_cur_link(ppg);
+	long long period, len, extra;
+	int dir;
+
+	if (sscanf(s, "%lli %lli %lli", &period, &len, &extra) != 3
+	    || len <= 0 || len > period || extra < 0) {
+		pp_printf("config line %i: wrong burst \"%s\"\n", lineno, s);
+		return -1;
+	}
+	for (dir = SIM_IN; dir <= SIM_OUT; dir++) {
+		if (!(dirs & SIM_DIR(dir)))
+			continue;
+		link->burst[dir].period_ns = period;
+		link->burst[dir].len_ns = len;
+		link->burst[dir].extra_ns = extra;
+		link->set |= SIM_SET_BURST(dir);
+	}
+	return 0;
+}
+
+/*
+ * Loss is a percentage and a mean length of bursts, in frames. Without
+ * the length, losses are independent of each other.
+ */
+static int sim_cfg_loss(struct pp_globals *ppg, int lineno, char *s,
+			int dirs)
+{
+	struct sim_link_cfg *link = sim_cur_link(ppg);
+	double loss, burst = 0, p_bad, p_good;
+	int dir, n;
+
+	n = sscanf(s, "%lf %lf", &loss, &burst);
+	if (n < 1 || loss < 0 || loss >= 100 || (n == 2 && burst < 1))
+		goto err;
+	loss /= 100;
+	if (n == 1) {
+		p_bad = loss;
+		p_good = 1 - loss;
+	} else {
+		p_good = 1 / burst;
+		p_bad = loss * p_good / (1 - loss);
+		if (p_bad > 1)
+			goto err;
+	}
+	for (dir = SIM_IN; dir <= SIM_OUT; dir++) {
+		if (!(dirs & SIM_DIR(dir)))
+			continue;
+		link->loss[dir].p_bad = p_bad * (1U << 31);
+		link->loss[dir].p_good = p_good * (1U << 31);
+		link->set |= SIM_SET_LOSS(dir);
+	}
+	return 0;
+err:
+	pp_printf("config line %i: wrong loss \"%s\"\n", lineno, s);
+	return -1;
+}
+
+static int f_pdv(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		 union pp_cfg_arg *arg)
+{
+	return sim_cfg_pdv(ppg, lineno, arg->s, SIM_BOTH);
+}
+
+static int f_fwd_pdv(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		     union pp_cfg_arg *arg)
+{
+	return sim_cfg_pdv(ppg, lineno, arg->s, SIM_DIR(SIM_IN));
+}
+
+static int f_bckwd_pdv(struct pp_argline *l, int lineno,
+		       struct pp_globals *ppg, union pp_cfg_arg *arg)
+{
+	return sim_cfg_pdv(ppg, lineno, arg->s, SIM_DIR(SIM_OUT));
+}
+
+static int f_burst(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		   union pp_cfg_arg *arg)
+{
+	return sim_cfg_burst(ppg, lineno, arg->s, SIM_BOTH);
+}
+
+static int f_fwd_burst(struct pp_argline *l, int lineno,
+		       struct pp_globals *ppg, union pp_cfg_arg *arg)
+{
+	return sim_cfg_burst(ppg, lineno, arg->s, SIM_DIR(SIM_IN));
+}
+
+static int f_bckwd_burst(struct pp_argline *l, int lineno,
+			 struct pp_globals *ppg, union pp_cfg_arg *arg)
+{
+	return sim_cfg_burst(ppg, lineno, arg->s, SIM_DIR(SIM_OUT));
+}
+
+static int f_loss(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		  union pp_cfg_arg *arg)
+{
+	return sim_cfg_loss(ppg, lineno, arg->s, SIM_BOTH);
+}
+
+static int f_fwd_loss(struct pp_argline *l, int lineno,
+		      struct pp_globals *ppg, union pp_cfg_arg *arg)
+{
+	return sim_cfg_loss(ppg, lineno, arg->s, SIM_DIR(SIM_IN));
+}
+
+static int f_bckwd_loss(struct pp_argline *l, int lineno,
+			struct pp_globals *ppg, union pp_cfg_arg *arg)
+{
+	return sim_cfg_loss(ppg, lineno, arg->s, SIM_DIR(SIM_OUT));
+}
+
 static int f_iter(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 			union pp_cfg_arg *arg)
 {
-	SIM_PPG_ARCH(ppg)->sim_iter_max = arg->i;
+	SIM_WORLD(ppg)->sim_iter_max = arg->i;
+	return 0;
+}
+
+static int f_seed(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		  union pp_cfg_arg *arg)
+{
+	SIM_WORLD(ppg)->seed = (unsigned)arg->i;
+	return 0;
+}
+
+/* Monte Carlo: how many runs (each with the next seed), and threads */
+static int f_runs(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		  union pp_cfg_arg *arg)
+{
+	if (arg->i < 0) {
+		pp_printf("config line %i: wrong number of runs\n", lineno);
+		return -1;
+	}
+	SIM_WORLD(ppg)->runs = arg->i;
+	return 0;
+}
+
+static int f_threads(struct pp_argline *l, int lineno,
+		     struct pp_globals *ppg, union pp_cfg_arg *arg)
+{
+	SIM_WORLD(ppg)->threads = arg->i;
+	return 0;
+}
+
+static int f_conv(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		  union pp_cfg_arg *arg)
+{
+	SIM_WORLD(ppg)->conv_ns = arg->i;
 	return 0;
 }
 
 struct pp_argline pp_arch_arglines[] = {
+	LEGACY_OPTION(f_trace_file,	"trace-file",		ARG_STR),
+	LEGACY_OPTION(f_log_queue,	"log-queue",		ARG_INT),
+	LEGACY_OPTION(f_node,		"sim_node",		ARG_STR),
+	LEGACY_OPTION(f_peer,		"sim_peer",		ARG_STR),
 	LEGACY_OPTION(f_ppm_real,	"sim_ppm_real",		ARG_INT),
 	LEGACY_OPTION(f_ppm_servo,	"sim_init_ppm_servo",	ARG_INT),
 	LEGACY_OPTION(f_ofm,		"sim_init_ofm",		ARG_TIME),
@@ -128,8 +376,130 @@ struct pp_argline pp_arch_arglines[] = {
 	LEGACY_OPTION(f_jit,		"sim_jit_ns",		ARG_INT),
 	LEGACY_OPTION(f_fwd_jit,	"sim_fwd_jit_ns",	ARG_INT),
 	LEGACY_OPTION(f_bckwd_jit,	"sim_bckwd_jit_ns",	ARG_INT),
+	LEGACY_OPTION(f_pdv,		"sim_pdv",		ARG_STR),
+	LEGACY_OPTION(f_fwd_pdv,	"sim_fwd_pdv",		ARG_STR),
+	LEGACY_OPTION(f_bckwd_pdv,	"sim_bckwd_pdv",	ARG_STR),
+	LEGACY_OPTION(f_burst,		"sim_burst",		ARG_STR),
+	LEGACY_OPTION(f_fwd_burst,	"sim_fwd_burst",	ARG_STR),
+	LEGACY_OPTION(f_bckwd_burst,	"sim_bckwd_burst",	ARG_STR),
+	LEGACY_OPTION(f_loss,		"sim_loss",		ARG_STR),
+	LEGACY_OPTION(f_fwd_loss,	"sim_fwd_loss",		ARG_STR),
+	LEGACY_OPTION(f_bckwd_loss,	"sim_bckwd_loss",	ARG_STR),
 	LEGACY_OPTION(f_iter,		"sim_iter_max",		ARG_TIME),
+	LEGACY_OPTION(f_seed,		"sim_seed",		ARG_INT),
+	LEGACY_OPTION(f_runs,		"sim_runs",		ARG_INT),
+	LEGACY_OPTION(f_threads,	"sim_threads",		ARG_INT),
+	LEGACY_OPTION(f_conv,		"sim_conv_ns",		ARG_INT),
 	{}
 };
 
+/* Find a port by name, among all nodes */
+static struct pp_instance *sim_find_port(struct sim_world *w, char *name)
+{
+	int i;
 
+	for (i = 0; i < w->parse_ppg->nlinks; i++)
+		if (!strcmp(w->ports[i].cfg.port_name, name))
+			return w->ports + i;
+	return NULL;
+}
+
+/* A port setting wins over its node, and our "out" over the peer's "in" */
+static void sim_link_delay(struct pp_instance *ppi)
+{
+	struct pp_instance *peer = SIM_PPI_ARCH(ppi)->peer;
+	struct sim_link_cfg *cfg[4];
+	struct pp_sim_net_delay *d = &SIM_PPI_ARCH(ppi)->n_delay;
+	int i, dir;
+
+	cfg[0] = &SIM_PPI_ARCH(ppi)->link;
+	cfg[1] = &SIM_PPI_ARCH(peer)->link;
+	cfg[2] = &SIM_PPG_ARCH(GLBS(ppi))->link;
+	cfg[3] = &SIM_PPG_ARCH(GLBS(peer))->link;
+	for (i = 3; i >= 0; i--) {
+		dir = (i & 1) ? SIM_IN : SIM_OUT;
+		if (cfg[i]->set & SIM_SET_PROP(dir))
+			d->t_prop_ns = cfg[i]->t_prop_ns[dir];
+		if (cfg[i]->set & SIM_SET_JIT(dir))
+			d->jit_ns = cfg[i]->jit_ns[dir];
+		if (cfg[i]->set & SIM_SET_PDV(dir))
+			d->pdv = cfg[i]->pdv[dir];
+		if (cfg[i]->set & SIM_SET_BURST(dir))
+			d->burst = cfg[i]->burst[dir];
+		if (cfg[i]->set & SIM_SET_LOSS(dir))
+			d->loss = cfg[i]->loss[dir];
+	}
+}
+
+/* Split ports among nodes, and connect them, once all config is parsed */
+int sim_build_topology(struct sim_world *w)
+{
+	struct pp_globals *ppg = w->parse_ppg, *node;
+	struct sim_ppg_arch_data *data;
+	struct pp_instance *ppi, *peer;
+	int i, j, end;
+
+	for (i = 0; i < w->n_nodes; i++) {
+		node = w->nodes[i];
+		data = SIM_PPG_ARCH(node);
+		/* Ports are contiguous, up to the next node's ones */
+		end = ppg->nlinks;
+		for (j = 0; j < w->n_nodes; j++) {
+			int first = SIM_PPG_ARCH(w->nodes[j])->first_port;
+
+			if (first > data->first_port && first < end)
+				end = first;
+		}
+		node->nlinks = node->max_links = end - data->first_port;
+		if (!node->nlinks) {
+			pp_printf("sim: node %s has no ports\n", data->name);
+			return -1;
+		}
+		data->time.current_ns = w->init_time_ns + data->init_ofm_ns;
+		for (j = 0; j < node->nlinks; j++)
+			INST(node, j)->glbs = node;
+	}
+
+	for (i = 0; i < ppg->nlinks; i++) {
+		ppi = w->ports + i;
+		ppi->iface_name = ppi->cfg.iface_name;
+		ppi->port_name = ppi->cfg.port_name;
+		ppi->mech = ppi->cfg.mech;
+		if (ppi->proto == PPSI_PROTO_RAW)
+			pp_printf("Warning: simulator doesn't support raw "
+					"ethernet. Using UDP\n");
+		ppi->ch[PP_NP_GEN].fd = -1;
+		ppi->ch[PP_NP_EVT].fd = -1;
+		ppi->t_ops = &DEFAULT_TIME_OPS;
+		ppi->n_ops = &DEFAULT_NET_OPS;
+
+		if (!SIM_PPI_ARCH(ppi)->peer_name[0])
+			continue;
+		peer = sim_find_port(w, SIM_PPI_ARCH(ppi)->peer_name);
+		if (!peer || peer == ppi || GLBS(peer) == GLBS(ppi)) {
+			pp_printf("sim: port %s: wrong peer \"%s\"\n",
+				  ppi->port_name, SIM_PPI_ARCH(ppi)->peer_name);
+			return -1;
+		}
+		if ((SIM_PPI_ARCH(ppi)->peer &&
+		     SIM_PPI_ARCH(ppi)->peer != peer) ||
+		    (SIM_PPI_ARCH(peer)->peer &&
+		     SIM_PPI_ARCH(peer)->peer != ppi)) {
+			pp_printf("sim: port %s: already connected\n",
+				  ppi->port_name);
+			return -1;
+		}
+		SIM_PPI_ARCH(ppi)->peer = peer;
+		SIM_PPI_ARCH(peer)->peer = ppi;
+	}
+
+	for (i = 0; i < ppg->nlinks; i++) {
+		ppi = w->ports + i;
+		if (!SIM_PPI_ARCH(ppi)->peer) {
+			pp_printf("sim: port %s has no peer\n", ppi->port_name);
+			return -1;
+		}
+		sim_link_delay(ppi);
+	}
+	return 0;
+}
@@ -6,8 +6,15 @@
  */
 #include <stdio.h>
 #include <ppsi/ppsi.h>
+#include "ppsi-sim.h"
+
+/* Monte Carlo runs are silent: only the summary is printed */
+__thread int sim_quiet;
 
 void pp_puts(const char *s)
 {
-	fputs(s, stdout);
+	if (sim_quiet)
+		return;
+	if (!pp_log_puts(s))
+		fputs(s, stdout);
 }
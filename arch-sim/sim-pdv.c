@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Packet delay variation and loss of simulated links. The random part of
+ * each delay follows the model of the link (uniform, Gaussian, Pareto,
+ * lognormal, or a recorded trace), plus periodic congestion; frames are
+ * lost in bursts according to a Gilbert model. All random numbers come
+ * from the seed of the world, so runs are still reproducible.
+ *
+ * This is host-only code, so we use floating point, unlike the protocol.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <ppsi/ppsi.h>
+#include "ppsi-sim.h"
+
+#define SIM_2PI		6.283185307179586
+
+/* Uniform in (0, 1): never 0, so we can take logs and negative powers */
+static double sim_rand_unit(struct sim_world *w)
+{
+	return (sim_rand(w) + 0.5) / (1U << 31);
+}
+
+/* Standard normal, with Box-Muller */
+static double sim_rand_normal(struct sim_world *w)
+{
+	double r = sqrt(-2.0 * log(sim_rand_unit(w)));
+
+	return r * cos(SIM_2PI * sim_rand_unit(w));
+}
+
+static int64_t sim_pdv_ns(struct sim_world *w, struct pp_sim_net_delay *d)
+{
+	struct sim_pdv *pdv = &d->pdv;
+	double x;
+
+	switch (pdv->type) {
+	case SIM_PDV_GAUSS:
+		x = pdv->ns + pdv->shape * sim_rand_normal(w);
+		break;
+	case SIM_PDV_PARETO: /* shifted to start at 0 (Lomax) */
+		x = pdv->ns * (pow(sim_rand_unit(w), -1.0 / pdv->shape) - 1);
+		break;
+	case SIM_PDV_LOGNORMAL:
+		x = pdv->ns * exp(pdv->shape * sim_rand_normal(w));
+		break;
+	case SIM_PDV_TRACE:
+		x = pdv->trace->ns[d->trace_pos];
+		if (++d->trace_pos == pdv->trace->n)
+			d->trace_pos = 0;
+		break;
+	default:
+		return (sim_rand(w) * d->jit_ns) >> 31;
+	}
+	if (x < 0)
+		return 0;
+	if (x > 1e15) /* a heavy tail may go very far: 11 days is enough */
+		return 1000LL * 1000 * 1000 * 1000 * 1000;
+	return x;
+}
+
+/* The queue fills up linearly during a burst, then it is drained */
+static int64_t sim_burst_ns(struct sim_world *w, struct sim_burst *b)
+{
+	int64_t t;
+
+	if (!b->period_ns)
+		return 0;
+	t = w->now_ns % b->period_ns;
+	if (t >= b->len_ns)
+		return 0;
+	return pp_muldiv(b->extra_ns, t, b->len_ns);
+}
+
+/* The part of the delay above t_prop_ns, for a frame sent now */
+int64_t sim_link_jitter(struct sim_world *w, struct pp_sim_net_delay *d)
+{
+	return sim_pdv_ns(w, d) + sim_burst_ns(w, &d->burst);
+}
+
+/* Returns 1 if the frame being sent is lost */
+int sim_link_lost(struct sim_world *w, struct pp_sim_net_delay *d)
+{
+	if (!d->loss.p_bad)
+		return 0;
+	if (d->bad)
+		d->bad = sim_rand(w) >= d->loss.p_good;
+	else
+		d->bad = sim_rand(w) < d->loss.p_bad;
+	return d->bad;
+}
+
+static struct sim_trace *sim_find_trace(struct sim_trace *t, char *fname)
+{
+	for (; t; t = t->next)
+		if (!strcmp(t->fname, fname))
+			return t;
+	return NULL;
+}
+
+void sim_free_traces(struct sim_trace *t)
+{
+	struct sim_trace *next;
+
+	for (; t; t = next) {
+		next = t->next;
+		free(t->fname);
+		free(t);
+	}
+}
+
+/*
+ * A trace is a text file with one delay (ns) per line; empty lines and
+ * lines starting with '#' are ignored. It is freed with the world, unless
+ * it is one of the shared ones: Monte Carlo runs read each file once.
+ */
+struct sim_trace *sim_read_trace(struct sim_world *w, char *fname)
+{
+	struct sim_trace *t, *nt;
+	char line[128], *s;
+	long long ns;
+	int size = 1024;
+	FILE *f;
+
+	t = sim_find_trace(w->shared_traces, fname);
+	if (!t)
+		t = sim_find_trace(w->traces, fname);
+	if (t)
+		return t;
+	f = fopen(fname, "r");
+	if (!f) {
+		pp_printf("sim: %s: %s\n", fname, strerror(errno));
+		return NULL;
+	}
+	t = malloc(sizeof(*t) + size * sizeof(t->ns[0]));
+	if (!t)
+		goto nomem;
+	t->n = 0;
+	t->fname = NULL;
+	while (fgets(line, sizeof(line), f)) {
+		for (s = line; *s == ' ' || *s == '\t'; s++)
+			;
+		if (*s == '\n' || *s == '\0' || *s == '#')
+			continue;
+		if (sscanf(s, "%lli", &ns) != 1 || ns < 0) {
+			pp_printf("sim: %s: wrong delay %s", fname, s);
+			goto err;
+		}
+		if (t->n == size) {
+			size *= 2;
+			nt = realloc(t, sizeof(*t) + size * sizeof(t->ns[0]));
+			if (!nt)
+				goto nomem;
+			t = nt;
+		}
+		t->ns[t->n++] = ns;
+	}
+	fclose(f);
+	if (!t->n) {
+		pp_printf("sim: %s: no delays\n", fname);
+		free(t);
+		return NULL;
+	}
+	t->fname = strdup(fname);
+	if (!t->fname) {
+		pp_printf("sim: %s: out of memory\n", fname);
+		free(t);
+		return NULL;
+	}
+	t->next = w->traces;
+	w->traces = t;
+	return t;
+
+nomem:
+	pp_printf("sim: %s: out of memory\n", fname);
+err:
+	free(t);
+	fclose(f);
+	return NULL;
+}
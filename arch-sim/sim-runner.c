@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Monte Carlo runs of the simulator ("sim_runs <n>"): the same network is
+ * simulated n times, with seeds sim_seed, sim_seed + 1 and so on, by a pool
+ * of threads. Each run is a world of its own, so its results only depend
+ * on its seed, not on the number of threads or how they are scheduled.
+ * At the end we print the distribution of convergence time and offsets.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <ppsi/ppsi.h>
+#include "ppsi-sim.h"
+
+struct sim_runner {
+	int argc;
+	char **argv;
+	uint64_t seed;
+	int runs;
+	int next;			/* next run to start, atomic */
+	struct sim_stats *stats;	/* one per run, n < 0 if failed */
+	struct sim_trace *traces;	/* read once, shared by all worlds */
+	pthread_mutex_t parse_lock;	/* the config parser is not reentrant */
+};
+
+/* Called at each Delay_Resp of the last node */
+void sim_stats_sample(struct sim_world *w, int64_t ofm_ns)
+{
+	struct sim_stats *s = &w->stats;
+	int64_t abs_ns = ofm_ns < 0 ? -ofm_ns : ofm_ns;
+
+	if (abs_ns > w->conv_ns)
+		s->conv_at_ns = -1;
+	else if (s->conv_at_ns < 0)
+		s->conv_at_ns = w->now_ns;
+
+	/* rms and max are for the steady state: the second half */
+	if (2 * w->sim_iter_n <= w->sim_iter_max)
+		return;
+	if (abs_ns > s->max_ns)
+		s->max_ns = abs_ns;
+	s->n++;
+	s->sumsq += (double)ofm_ns * ofm_ns;
+}
+
+/*
+ * Workers print nothing (sim_quiet), and pp_printf() has a buffer per
+ * thread in this arch; still, don't format diagnostics nobody reads.
+ */
+static void sim_silence(struct sim_world *w)
+{
+	struct pp_globals *node;
+	int i, j;
+
+	for (i = 0; i < w->n_nodes; i++) {
+		node = w->nodes[i];
+		node->d_flags = 0;
+		for (j = 0; j < node->nlinks; j++)
+			INST(node, j)->d_flags = 0;
+	}
+}
+
+static void *sim_worker(void *arg)
+{
+	struct sim_runner *r = arg;
+	struct sim_world *w;
+	int i;
+
+	sim_quiet = 1;
+	while ((i = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED))
+	       < r->runs) {
+		pthread_mutex_lock(&r->parse_lock);
+		w = sim_new_world(r->argc, r->argv, r->traces);
+		if (w)
+			sim_silence(w);
+		pthread_mutex_unlock(&r->parse_lock);
+		if (!w) {
+			r->stats[i].n = -1;
+			continue;
+		}
+		sim_set_seed(w, r->seed + i);
+		sim_main_loop(w);
+		r->stats[i] = w->stats;
+		sim_free_world(w);
+	}
+	return NULL;
+}
+
+static int sim_cmp64(const void *a, const void *b)
+{
+	int64_t x = *(int64_t *)a, y = *(int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int64_t sim_isqrt(uint64_t x)
+{
+	uint64_t r = 0, bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+	for (; bit; bit >>= 2) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+	}
+	return r;
+}
+
+/* Sort the values, and print percentiles (ns, divided by div) */
+static void sim_print_pct(char *name, int64_t *v, int n, int64_t div)
+{
+	static int pct[] = {50, 90, 99};
+	int i;
+
+	pp_printf("sim: %-20s", name);
+	if (!n) {
+		pp_printf(" -\n");
+		return;
+	}
+	qsort(v, n, sizeof(*v), sim_cmp64);
+	for (i = 0; i < ARRAY_SIZE(pct); i++)
+		pp_printf(" p%i %lli", pct[i],
+			  (long long)(v[pct[i] * (n - 1) / 100] / div));
+	pp_printf(" max %lli\n", (long long)(v[n - 1] / div));
+}
+
+static void sim_print_stats(struct sim_runner *r, int64_t conv_ns)
+{
+	int64_t *conv, *rms, *max;
+	double ms;
+	int i, nconv = 0, nok = 0;
+
+	if (r->runs <= 0)
+		return;
+	conv = calloc(r->runs, sizeof(*conv));
+	rms = calloc(r->runs, sizeof(*rms));
+	max = calloc(r->runs, sizeof(*max));
+	if (!conv || !rms || !max) {
+		pp_printf("sim: out of memory\n");
+		goto out;
+	}
+	for (i = 0; i < r->runs; i++) {
+		struct sim_stats *s = r->stats + i;
+
+		if (s->n < 0)
+			continue;
+		if (s->conv_at_ns >= 0)
+			conv[nconv++] = s->conv_at_ns;
+		if (!s->n)
+			continue;
+		ms = s->sumsq / s->n;
+		rms[nok] = sim_isqrt(ms < 1.8e19 ? (uint64_t)ms : -1ULL);
+		max[nok++] = s->max_ns;
+	}
+	pp_printf("sim: converged (|ofm| <= %lli ns): %i of %i runs\n",
+		  (long long)conv_ns, nconv, r->runs);
+	sim_print_pct("convergence (ms):", conv, nconv, 1000 * 1000);
+	sim_print_pct("rms offset (ns):", rms, nok, 1);
+	sim_print_pct("max offset (ns):", max, nok, 1);
+out:
+	free(conv);
+	free(rms);
+	free(max);
+}
+
+int sim_run_many(struct sim_world *w, int argc, char **argv)
+{
+	struct sim_runner r = {
+		.argc = argc,
+		.argv = argv,
+		.seed = w->seed,
+		.runs = w->runs,
+		.parse_lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct timespec t0, t1;
+	int64_t conv_ns = w->conv_ns;
+	pthread_t *th;
+	int i, n = w->threads, err, ret = -1;
+
+	if (w->parse_ppg->trace) {
+		pp_printf("sim: no trace-file with sim_runs\n");
+		return -1;
+	}
+	/* The first world read the traces: keep them for the others */
+	r.traces = w->traces;
+	w->traces = NULL;
+	sim_free_world(w);
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > r.runs)
+		n = r.runs;
+	if (n < 1)
+		n = 1;
+	r.stats = calloc(r.runs, sizeof(*r.stats));
+	th = calloc(n, sizeof(*th));
+	if (!r.stats || !th) {
+		pp_printf("sim: out of memory\n");
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		err = pthread_create(th + i, NULL, sim_worker, &r);
+		if (err) {
+			pp_printf("sim: pthread_create(): %s\n", strerror(err));
+			break;
+		}
+	}
+	n = i;
+	for (i = 0; i < n; i++)
+		pthread_join(th[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (!n)
+		goto out;
+
+	t1.tv_sec -= t0.tv_sec;
+	t1.tv_nsec -= t0.tv_nsec;
+	if (t1.tv_nsec < 0) {
+		t1.tv_sec--;
+		t1.tv_nsec += 1000 * 1000 * 1000;
+	}
+	pp_printf("sim: %i runs (seeds %llu to %llu), %i threads, "
+		  "%li.%03li s\n", r.runs, (unsigned long long)r.seed,
+		  (unsigned long long)(r.seed + r.runs - 1), n,
+		  (long)t1.tv_sec, t1.tv_nsec / 1000 / 1000);
+	for (i = 0; i < r.runs; i++)
+		if (r.stats[i].n < 0)
+			pp_printf("sim: run %i (seed %llu) failed\n", i,
+				  (unsigned long long)(r.seed + i));
+	sim_print_stats(&r, conv_ns);
+	ret = 0;
+out:
+	sim_free_traces(r.traces);
+	free(r.stats);
+	free(th);
+	return ret;
+}
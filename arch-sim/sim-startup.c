@@ -28,131 +28,235 @@ static struct pp_runtime_opts sim_master_rt_opts = {
 	.ttl =			PP_DEFAULT_TTL,
 };
 
+/* Make the config parser act on this node: global options go there */
+static void sim_parse_node(struct sim_world *w, struct pp_globals *node)
+{
+	struct pp_globals *ppg = w->parse_ppg;
+	struct sim_ppg_arch_data *data = SIM_PPG_ARCH(node);
+
+	ppg->arch_data = data;
+	ppg->rt_opts = &data->rt_opts;
+	ppg->servo = &data->servo;
+	ppg->defaultDS = &data->defaultDS;
+	ppg->currentDS = &data->currentDS;
+	ppg->parentDS = &data->parentDS;
+	ppg->timePropertiesDS = &data->timePropertiesDS;
+}
+
 /*
- * In arch-sim we use two pp_instaces in the same pp_globals to represent
- * two different machines. This means *completely differnt* machines, with
- * their own Data Sets. Given we can't put more all the different Data Sets
- * in the same ppg, we stored them in the ppi->arch_data of every istance.
- * This function is used to set the inner Data Sets pointer of the ppg to
- * point to the Data Sets related to the pp_instange passed as argument
+ * In arch-sim every node of the network is a pp_globals, with its own
+ * clock and Data Sets, like a different machine would have. The ports
+ * declared after a "sim_node" line belong to that node.
  */
-int sim_set_global_DS(struct pp_instance *ppi)
+struct pp_globals *sim_new_node(struct sim_world *w, char *name)
 {
-	struct sim_ppi_arch_data *data = SIM_PPI_ARCH(ppi);
+	struct pp_globals *node;
+	struct sim_ppg_arch_data *data;
 
-	ppi->glbs->defaultDS = data->defaultDS;
-	ppi->glbs->currentDS = data->currentDS;
-	ppi->glbs->parentDS = data->parentDS;
-	ppi->glbs->timePropertiesDS = data->timePropertiesDS;
-	ppi->glbs->servo = data->servo;
-	ppi->glbs->rt_opts = data->rt_opts;
-
-	return 0;
+	if (w->n_nodes >= SIM_MAX_NODES)
+		return NULL;
+	node = calloc(1, sizeof(*node));
+	data = calloc(1, sizeof(*data));
+	if (!node || !data) {
+		free(node);
+		free(data);
+		return NULL;
+	}
+	data->world = w;
+	strncpy(data->name, name, sizeof(data->name) - 1);
+	data->first_port = w->parse_ppg->nlinks;
+	data->rt_opts = __pp_default_rt_opts;
+	node->arch_data = data;
+	node->pp_instances = w->ports + data->first_port;
+	node->servo = &data->servo;
+	node->rt_opts = &data->rt_opts;
+	node->defaultDS = &data->defaultDS;
+	node->currentDS = &data->currentDS;
+	node->parentDS = &data->parentDS;
+	node->timePropertiesDS = &data->timePropertiesDS;
+	w->nodes[w->n_nodes++] = node;
+	sim_parse_node(w, node);
+	return node;
 }
 
-static int sim_ppi_init(struct pp_instance *ppi, int which_ppi)
+static int sim_ppi_init(struct pp_instance *ppi, struct pp_globals *ppg)
 {
-	struct sim_ppi_arch_data *data;
+	ppi->glbs = ppg;
+	ppi->vlans_array_len = CONFIG_VLAN_ARRAY_SIZE;
 	ppi->proto = PP_DEFAULT_PROTO;
-	ppi->__tx_buffer = malloc(PP_MAX_FRAME_LENGTH);
-	ppi->__rx_buffer = malloc(PP_MAX_FRAME_LENGTH);
 	ppi->arch_data = calloc(1, sizeof(struct sim_ppi_arch_data));
-	ppi->portDS = calloc(1, sizeof(*ppi->portDS));
-	if ((!ppi->arch_data) || (!ppi->portDS))
+	if (!ppi->arch_data)
 		return -1;
-	data = SIM_PPI_ARCH(ppi);
-	data->defaultDS = calloc(1, sizeof(*data->defaultDS));
-	data->currentDS = calloc(1, sizeof(*data->currentDS));
-	data->parentDS = calloc(1, sizeof(*data->parentDS));
-	data->timePropertiesDS = calloc(1,
-				sizeof(*data->timePropertiesDS));
-	data->servo = calloc(1, sizeof(*data->servo));
-	if ((!data->defaultDS) ||
-			(!data->currentDS) ||
-			(!data->parentDS) ||
-			(!data->timePropertiesDS) ||
-			(!data->servo))
-		return -1;
-	if (which_ppi == SIM_MASTER)
-		data->rt_opts = &sim_master_rt_opts;
-	else
-		data->rt_opts = &__pp_default_rt_opts;
-	data->other_ppi = INST(ppi->glbs, -(which_ppi - 1));
 	return 0;
 }
 
-int main(int argc, char **argv)
+/* With no "sim_node" lines, we simulate a master for the configured slave */
+static int sim_add_master(struct sim_world *w)
 {
-	struct pp_globals *ppg;
+	struct pp_globals *slave = w->nodes[0], *master;
 	struct pp_instance *ppi;
-	int i;
+	char conf[] = "port SIM_MASTER; iface MASTER; proto udp; role master;";
 
-	setbuf(stdout, NULL);
-	pp_printf("PPSi. Commit %s, built on " __DATE__ "\n", PPSI_VERSION);
+	master = sim_new_node(w, "SIM_MASTER");
+	if (!master)
+		return -1;
+	SIM_PPG_ARCH(master)->rt_opts = sim_master_rt_opts;
+	pp_config_string(w->parse_ppg, conf);
+	if (w->parse_ppg->nlinks == SIM_PPG_ARCH(slave)->first_port)
+		return -1;
+	ppi = w->parse_ppg->pp_instances + SIM_PPG_ARCH(master)->first_port;
+	strcpy(SIM_PPI_ARCH(ppi)->peer_name, w->ports[0].cfg.port_name);
 
-	ppg = calloc(1, sizeof(struct pp_globals));
-	ppg->max_links = 2; // master and slave, nothing else
-	ppg->arch_data = calloc(1, sizeof(struct sim_ppg_arch_data));
-	ppg->pp_instances = calloc(ppg->max_links, sizeof(struct pp_instance));
+	/* The master is the reference clock */
+	w->nodes[0] = master;
+	w->nodes[1] = slave;
+	return 0;
+}
 
-	if ((!ppg->arch_data) || (!ppg->pp_instances))
-		return -1;
+/* Everything random in a run derives from its seed ("sim_seed") */
+void sim_set_seed(struct sim_world *w, uint64_t seed)
+{
+	struct pp_sim_net_delay *d;
+	int i;
 
-	/* Alloc data stuctures inside the pp_instances */
-	for (i = 0; i < ppg->max_links; i++) {
-		ppi = INST(ppg, i);
-		ppi->glbs = ppg; // must be done before using sim_set_global_DS
-		ppi->vlans_array_len = CONFIG_VLAN_ARRAY_SIZE;
-		if (sim_ppi_init(ppi, i))
-			return -1;
+	w->seed = w->rand = seed;
+	for (i = 0; i < w->parse_ppg->nlinks; i++) {
+		d = &SIM_PPI_ARCH(w->ports + i)->n_delay;
+		w->ports[i].to_seed = sim_rand(w) | 1;
+		d->bad = 0;
+		/* Replay traces from a random point, so runs differ */
+		if (d->pdv.type == SIM_PDV_TRACE)
+			d->trace_pos = sim_rand(w) % d->pdv.trace->n;
 	}
+}
+
+void sim_free_world(struct sim_world *w)
+{
+	struct pp_instance *ppi;
+	struct sim_frame *f;
+	int i;
+
+	for (i = 0; i < w->parse_ppg->max_links; i++) {
+		ppi = w->ports + i;
+		free(ppi->arch_data);
+	}
+	for (i = 0; i < w->n_nodes; i++) {
+		free(w->nodes[i]->arch_data);
+		free(w->nodes[i]);
+	}
+	for (i = 0; i < w->n_pending; i++)
+		free(w->pending[i].frame);
+	while ((f = w->free_frames)) {
+		w->free_frames = f->next;
+		free(f);
+	}
+	sim_free_traces(w->traces);
+	free(w->pending);
+	pp_arena_free(w->parse_ppg);
+	free(w->parse_ppg);
+	free(w);
+}
+
+/*
+ * Build a whole network from the command line (which is not modified).
+ * Delay traces already in shared_traces are not read again.
+ */
+struct sim_world *sim_new_world(int argc, char **argv,
+				struct sim_trace *shared_traces)
+{
+	struct pp_globals *ppg, *node;
+	struct sim_world *w;
+	char conf[] = "port SIM_SLAVE; iface SLAVE; proto udp; role slave;";
+	char **args;
+	int i, err;
 
 	/*
-	 * Configure the master with standard configuration, only from default
-	 * string. The master is not configurable, but there's no need to do
-	 * it cause we are ok with a standard one. We just want to see the
-	 * behaviour of the slave.
-	 * NOTE: the master instance is initialized before parsing the command
-	 * line, so the diagnostics cannot be enabled here. We cannot put the
-	 * master config later because the initial time for the master is needed
-	 * to set the initial offset for the slave
+	 * The config is parsed in a pp_globals of its own, that holds all
+	 * ports; they are split among nodes later on
 	 */
-	sim_set_global_DS(pp_sim_get_master(ppg));
-	pp_config_string(ppg, strdup("port SIM_MASTER; iface MASTER;"
-					"proto udp; role master;"
-					"sim_iter_max 10000;"
-					"sim_init_master_time .9;"));
-
-	/* parse commandline for configuration options */
-	sim_set_global_DS(pp_sim_get_slave(ppg));
-	if (pp_parse_cmdline(ppg, argc, argv) != 0)
-		return -1;
-	/* If no item has been parsed, provide default file or string */
+	w = calloc(1, sizeof(*w));
+	ppg = calloc(1, sizeof(struct pp_globals));
+	if (!w || !ppg) {
+		free(w);
+		free(ppg);
+		return NULL;
+	}
+	ppg->max_links = PP_MAX_LINKS;
+	pp_arena_alloc(ppg); /* leaves pp_instances NULL on error */
+	w->parse_ppg = ppg;
+	w->ports = ppg->pp_instances;
+	w->shared_traces = shared_traces;
+	w->sim_iter_max = 10000;
+	w->init_time_ns = 900LL * 1000 * 1000;
+	w->seed = 1;
+	w->conv_ns = 1000;
+	w->stats.conv_at_ns = -1;
+
+	err = !ppg->pp_instances;
+	for (i = 0; !err && i < ppg->max_links; i++)
+		err = sim_ppi_init(INST(ppg, i), ppg);
+	/* Until "sim_node" is used, the config describes the slave */
+	if (err || !sim_new_node(w, "SIM_SLAVE"))
+		goto out;
+
+	/* parse commandline for configuration options: -C strings change */
+	args = calloc(argc + 1, sizeof(*args));
+	if (!args)
+		goto out;
+	for (i = 0; i < argc; i++)
+		args[i] = strdup(argv[i]);
+	err = pp_parse_cmdline(ppg, argc, args);
+	for (i = 0; i < argc; i++)
+		free(args[i]);
+	free(args);
+	if (err)
+		goto out;
+	/* If no port has been configured, provide default file or string */
 	if (ppg->cfg.cfg_items == 0)
 		pp_config_file(ppg, 0, PP_DEFAULT_CONFIGFILE);
-	if (ppg->cfg.cfg_items == 0)
-		pp_config_string(ppg, strdup("port SIM_SLAVE; iface SLAVE;"
-						"proto udp; role slave;"));
-
-	for (i = 0; i < ppg->nlinks; i++) {
-		ppi = INST(ppg, i);
-		sim_set_global_DS(ppi);
-		ppi->iface_name = ppi->cfg.iface_name;
-		ppi->port_name = ppi->cfg.port_name;
-		ppi->mech = ppi->cfg.mech;
-		if (ppi->proto == PPSI_PROTO_RAW)
-			pp_printf("Warning: simulator doesn't support raw "
-					"ethernet. Using UDP\n");
-		ppi->ch[PP_NP_GEN].fd = -1;
-		ppi->ch[PP_NP_EVT].fd = -1;
-		ppi->t_ops = &DEFAULT_TIME_OPS;
-		ppi->n_ops = &DEFAULT_NET_OPS;
-		if (pp_sim_is_master(ppi))
-			pp_init_globals(ppg, &sim_master_rt_opts);
-		else
-			pp_init_globals(ppg, &__pp_default_rt_opts);
+	if (ppg->nlinks == 0)
+		pp_config_string(ppg, conf);
+
+	if (w->n_nodes == 1 && sim_add_master(w) < 0) {
+		pp_printf("sim: no port for the slave\n");
+		goto out;
+	}
+	if (sim_build_topology(w) < 0)
+		goto out;
+	sim_set_seed(w, w->seed);
+
+	for (i = 0; i < w->n_nodes; i++) {
+		node = w->nodes[i];
+		node->trace = ppg->trace;
+		node->d_flags = ppg->d_flags;
+		node->rxdrop = ppg->rxdrop;
+		node->txdrop = ppg->txdrop;
+		pp_init_globals(node, &__pp_default_rt_opts);
 	}
+	return w;
 
-	sim_main_loop(ppg);
+out:
+	if (ppg->pp_instances)
+		sim_free_world(w);
+	else {
+		free(ppg);
+		free(w);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct sim_world *w;
+
+	setbuf(stdout, NULL);
+	pp_printf("PPSi. Commit %s, built on " __DATE__ "\n", PPSI_VERSION);
+
+	w = sim_new_world(argc, argv, NULL);
+	if (!w)
+		return -1;
+	if (w->runs)
+		return sim_run_many(w, argc, argv);
+	sim_main_loop(w);
 	return 0;
 }
@@ -6,123 +6,151 @@
  */
 
 /*
- * This is the main loop for unix stuff.
+ * This is the main loop for unix stuff. Each step is a function of its
+ * own, so an application can run them from its own event loop (libppsi).
  */
 #include <stdlib.h>
 #include <errno.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <netinet/if_ether.h>
 
 #include <ppsi/ppsi.h>
 #include <common-fun.h>
 #include "ppsi-unix.h"
 
-/* Call pp_state_machine for each instance. To be called periodically,
- * when no packets are incoming */
-static int run_all_state_machines(struct pp_globals *ppg)
+/* Tell the application, if any, that the state of a port changed */
+static void unix_check_state(struct pp_globals *ppg, struct pp_instance *ppi,
+			     int old_state)
 {
-	int j;
-	int delay_ms = 0, delay_ms_j;
+	struct unix_arch_data *arch_data = POSIX_ARCH(ppg);
 
-	for (j = 0; j < ppg->nlinks; j++) {
-		struct pp_instance *ppi = INST(ppg, j);
-		delay_ms_j = pp_state_machine(ppi, NULL, 0);
-
-		/* delay_ms is the least delay_ms among all instances */
-		if (j == 0)
-			delay_ms = delay_ms_j;
-		if (delay_ms_j < delay_ms)
-			delay_ms = delay_ms_j;
-	}
+	if (ppi->state != old_state && arch_data->state_hook)
+		arch_data->state_hook(ppi, old_state);
+}
 
-	return delay_ms;
+/* Call pp_state_machine for an instance, and schedule its next run */
+static void run_state_machine(struct pp_globals *ppg, struct pp_instance *ppi,
+			      void *pkt, int plen)
+{
+	int old_state = ppi->state;
+
+	pp_state_machine(ppi, pkt, plen);
+	pp_sched_set(&POSIX_ARCH(ppg)->sched, ppi, ppi->next_deadline);
+	unix_check_state(ppg, ppi, old_state);
 }
 
-void unix_main_loop(struct pp_globals *ppg)
+/* Initialize each link's state machine */
+void unix_run_start(struct pp_globals *ppg)
 {
 	struct pp_instance *ppi;
-	int delay_ms;
 	int j;
 
-	/* Initialize each link's state machine */
 	for (j = 0; j < ppg->nlinks; j++) {
-
 		ppi = INST(ppg, j);
-
-		/*
-		* The main loop here is based on select. While we are not
-		* doing anything else but the protocol, this allows extra stuff
-		* to fit.
-		*/
 		ppi->is_new_state = 1;
+		run_state_machine(ppg, ppi, NULL, 0);
 	}
+}
 
-	delay_ms = run_all_state_machines(ppg);
+/*
+ * If Ebest was changed in previous loop, run best master clock before
+ * checking for new packets, which would affect port state again
+ */
+void unix_run_bmc(struct pp_globals *ppg)
+{
+	struct pp_sched *sched = &POSIX_ARCH(ppg)->sched;
+	struct pp_instance *ppi;
+	int j, new_state, old_state;
 
-	while (1) {
-		int i;
-
-		/*
-		 * If Ebest was changed in previous loop, run best
-		 * master clock before checking for new packets, which
-		 * would affect port state again
-		 */
-		if (ppg->ebest_updated) {
-			for (j = 0; j < ppg->nlinks; j++) {
-				int new_state;
-				struct pp_instance *ppi = INST(ppg, j);
-				new_state = bmc(ppi);
-				if (new_state != ppi->state) {
-					ppi->state = new_state;
-					ppi->is_new_state = 1;
-				}
-			}
-			ppg->ebest_updated = 0;
+	if (!ppg->ebest_updated)
+		return;
+	for (j = 0; j < ppg->nlinks; j++) {
+		ppi = INST(ppg, j);
+		new_state = bmc(ppi);
+		if (new_state != ppi->state) {
+			old_state = ppi->state;
+			ppi->state = new_state;
+			ppi->is_new_state = 1;
+			pp_sched_set(sched, ppi,
+				     ppi->t_ops->calc_timeout(ppi, 0));
+			unix_check_state(ppg, ppi, old_state);
 		}
+	}
+	ppg->ebest_updated = 0;
+}
 
-		i = unix_net_ops.check_packet(ppg, delay_ms);
+/*
+ * Only the instances reported by check_packet have frames.
+ * Each recv may read a batch: pkt_present stays set until
+ * all of the frames already read have been processed.
+ */
+void unix_run_ready(struct pp_globals *ppg, struct pp_instance **ready, int n)
+{
+	struct pp_instance *ppi;
+	int j, len;
 
-		if (i < 0)
-			continue;
+	for (j = 0; j < n; j++) {
+		ppi = ready[j];
 
-		if (i == 0) {
-			delay_ms = run_all_state_machines(ppg);
-			continue;
-		}
+		while ((ppi->ch[PP_NP_GEN].pkt_present) ||
+		       (ppi->ch[PP_NP_EVT].pkt_present)) {
 
-		/* If delay_ms is -1, the above ops.check_packet will continue
-		 * consuming the previous timeout (see its implementation).
-		 * This ensures that every state machine is called at least once
-		 * every delay_ms */
-		delay_ms = -1;
-
-		for (j = 0; j < ppg->nlinks; j++) {
-			int tmp_d;
-			ppi = INST(ppg, j);
-
-			if ((ppi->ch[PP_NP_GEN].pkt_present) ||
-			    (ppi->ch[PP_NP_EVT].pkt_present)) {
-
-				i = __recv_and_count(ppi, ppi->rx_frame,
-						PP_MAX_FRAME_LENGTH - 4,
-						&ppi->last_rcv_time);
-
-				if (i == -2) {
-					continue; /* dropped or not for us */
-				}
-				if (i == -1) {
-					pp_diag(ppi, frames, 1,
-						"Receive Error %i: %s\n",
-						errno, strerror(errno));
-					continue;
-				}
-
-				tmp_d = pp_state_machine(ppi, ppi->rx_ptp,
-					i - ppi->rx_offset);
-
-				if ((delay_ms == -1) || (tmp_d < delay_ms))
-					delay_ms = tmp_d;
+			len = __recv_and_count(ppi, ppi->rx_frame,
+					PP_MAX_FRAME_LENGTH - 4,
+					&ppi->last_rcv_time);
+
+			if (len == -2) {
+				continue; /* dropped or not for us */
+			}
+			if (len == -1) {
+				pp_diag(ppi, frames, 1,
+					"Receive Error %i: %s\n",
+					errno, strerror(errno));
+				continue;
 			}
+			if (len == 0)
+				continue; /* nothing, flag is clear */
+
+			run_state_machine(ppg, ppi, ppi->rx_ptp,
+					  len - ppi->rx_offset);
 		}
 	}
 }
+
+/* Run the state machines whose deadline expired */
+void unix_run_expired(struct pp_globals *ppg)
+{
+	struct pp_sched *sched = &POSIX_ARCH(ppg)->sched;
+	struct pp_instance *ppi;
+
+	while ((ppi = pp_sched_expired(sched)))
+		run_state_machine(ppg, ppi, NULL, 0);
+}
+
+void unix_main_loop(struct pp_globals *ppg)
+{
+	struct pp_sched *sched = &POSIX_ARCH(ppg)->sched;
+	struct pp_instance *ready[PP_MAX_LINKS];
+	int i;
+
+	/*
+	 * The main loop here is based on epoll. While we are not
+	 * doing anything else but the protocol, this allows extra stuff
+	 * to fit.
+	 */
+	unix_run_start(ppg);
+
+	while (1) {
+		unix_run_bmc(ppg);
+
+		/* Sleep until a frame arrives or the earliest deadline */
+		i = unix_net_ops.check_packet(ppg, pp_sched_next(sched),
+					      ready);
+
+		if (i < 0)
+			continue;
+
+		unix_run_ready(ppg, ready, i);
+		unix_run_expired(ppg);
+	}
+}
@@ -8,10 +8,36 @@
 /*
  * These are the functions provided by the various unix files
  */
+#include <sys/socket.h>
+#include <sys/epoll.h>
 
+struct unix_rx_batch; /* private to time-unix/unix-socket.c */
 #define POSIX_ARCH(ppg) ((struct unix_arch_data *)(ppg->arch_data))
 struct unix_arch_data {
-	struct timeval tv;
+	int epfd;		/* all channels of all links */
+	int tfd;		/* timerfd in epfd, for the deadline */
+	uint64_t armed;		/* deadline tfd is armed for, in ns */
+	int nevents;		/* events of last round, to clear pkt_present */
+	struct epoll_event events[2 * PP_MAX_LINKS];
+	struct unix_rx_batch *batch[PP_MAX_LINKS][__NR_PP_NP];
+	struct pp_sched sched;	/* when to run each state machine */
+	/* libppsi: the application is told about state changes */
+	void (*state_hook)(struct pp_instance *ppi, int old_state);
 };
 
 extern void unix_main_loop(struct pp_globals *ppg);
+extern void unix_run_start(struct pp_globals *ppg);
+extern void unix_run_bmc(struct pp_globals *ppg);
+extern void unix_run_ready(struct pp_globals *ppg, struct pp_instance **ready,
+			   int n);
+extern void unix_run_expired(struct pp_globals *ppg);
+extern void unix_set_deadline(struct pp_globals *ppg, uint64_t deadline);
+
+/* unix-lib.c: the globals of the daemon, or of each libppsi instance */
+extern struct pp_globals *unix_open_globals(int argc, char **argv);
+extern void unix_close_globals(struct pp_globals *ppg);
+
+extern int unix_recv_batch(struct pp_instance *ppi, int chtype, void *pkt,
+			   int len, struct msghdr **msgp);
+/* time-unix/unix-filter.c: drop in the kernel what we would discard */
+extern int unix_attach_filter(struct pp_instance *ppi, int chtype);
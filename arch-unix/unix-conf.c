@@ -11,5 +11,9 @@
 struct pp_argline pp_arch_arglines[] = {
 	GLOB_OPTION_INT("rx-drop", ARG_INT, NULL, rxdrop),
 	GLOB_OPTION_INT("tx-drop", ARG_INT, NULL, txdrop),
+	LEGACY_OPTION(f_trace_file, "trace-file", ARG_STR),
+	LEGACY_OPTION(f_log_queue, "log-queue", ARG_INT),
+	INST_OPTION_INT("unicast-clients", ARG_INT, NULL, cfg.ucast_clients),
+	INST_OPTION_INT("unicast-duration", ARG_INT, NULL, cfg.ucast_duration),
 	{}
 };
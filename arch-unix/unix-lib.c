@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Setup of the unix globals, and PPSi as a library (see <ppsi/libppsi.h>).
+ * Each set of globals is allocated with its own data sets and run-time
+ * options, so an application can open several instances; the ppsi
+ * program uses the same code for its only one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timex.h>
+
+#include <ppsi/ppsi.h>
+#include <ppsi/libppsi.h>
+#include "ppsi-unix.h"
+
+struct ppsi {
+	struct pp_globals ppg;	/* first, so we can cast back */
+	DSDefault defaultDS;
+	DSCurrent currentDS;
+	DSParent parentDS;
+	DSTimeProperties timePropertiesDS;
+	struct pp_servo servo;
+	struct pp_runtime_opts rt_opts;
+	struct unix_arch_data arch_data;
+	struct ppsi_callbacks cb;
+};
+
+static inline struct ppsi *PPSI(struct pp_globals *ppg)
+{
+	return (struct ppsi *)ppg;
+}
+
+/* Frees what unix_open_globals allocated, after net exit of all ports */
+void unix_close_globals(struct pp_globals *ppg)
+{
+	struct unix_arch_data *arch_data = POSIX_ARCH(ppg);
+	int i;
+
+	for (i = 0; i < ppg->nlinks; i++)
+		free(INST(ppg, i)->ucast);
+	if (arch_data->epfd >= 0) {
+		close(arch_data->tfd);
+		close(arch_data->epfd);
+	}
+	pp_arena_free(ppg);
+	free(PPSI(ppg));
+}
+
+/* Parse the command line (which is not modified) and build the ports */
+struct pp_globals *unix_open_globals(int argc, char **argv)
+{
+	struct pp_globals *ppg;
+	struct pp_instance *ppi;
+	struct ppsi *p;
+	unsigned long seed;
+	struct timex t;
+	char **args;
+	int i, err;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		goto nomem;
+	ppg = &p->ppg;
+	ppg->defaultDS = &p->defaultDS;
+	ppg->currentDS = &p->currentDS;
+	ppg->parentDS = &p->parentDS;
+	ppg->timePropertiesDS = &p->timePropertiesDS;
+	ppg->servo = &p->servo;
+	p->rt_opts = __pp_default_rt_opts;
+	ppg->rt_opts = &p->rt_opts;
+	ppg->arch_data = &p->arch_data;
+	POSIX_ARCH(ppg)->epfd = -1; /* created by the first net init */
+
+	/* We are hosted, so we can allocate: all ports at once */
+	ppg->max_links = PP_MAX_LINKS;
+	if (pp_arena_alloc(ppg) < 0) {
+		free(p);
+		goto nomem;
+	}
+
+	/* Before the configuration is parsed, set defaults */
+	for (i = 0; i < ppg->max_links; i++) {
+		ppi = INST(ppg, i);
+		ppi->proto = PP_DEFAULT_PROTO;
+		ppi->role = PP_DEFAULT_ROLE;
+		ppi->mech = PP_E2E_MECH;
+	}
+
+	/* Set offset here, so config parsing can override it */
+	if (adjtimex(&t) >= 0)
+		p->timePropertiesDS.currentUtcOffset = t.tai;
+
+	/* -C strings are changed by the parser */
+	args = calloc(argc + 1, sizeof(*args));
+	err = !args;
+	for (i = 0; !err && i < argc; i++)
+		err = !(args[i] = strdup(argv[i]));
+	if (!err)
+		err = pp_parse_cmdline(ppg, argc, args);
+	for (i = 0; args && i < argc; i++)
+		free(args[i]);
+	free(args);
+	if (err)
+		goto out;
+
+	/* If no item has been parsed, provide a default file or string */
+	if (ppg->cfg.cfg_items == 0)
+		pp_config_file(ppg, 0, PP_DEFAULT_CONFIGFILE);
+	if (ppg->cfg.cfg_items == 0)
+		pp_config_string(ppg, strdup("link 0; iface eth0; proto udp"));
+
+	for (i = 0; i < ppg->nlinks; i++) {
+
+		ppi = INST(ppg, i);
+		ppi->ch[PP_NP_EVT].fd = -1;
+		ppi->ch[PP_NP_GEN].fd = -1;
+
+		ppi->glbs = ppg;
+		ppi->vlans_array_len = CONFIG_VLAN_ARRAY_SIZE,
+		ppi->iface_name = ppi->cfg.iface_name;
+		ppi->port_name = ppi->cfg.port_name;
+		ppi->mech = ppi->cfg.mech;
+
+		/* The following default names depend on TIME= at build time */
+		ppi->n_ops = &DEFAULT_NET_OPS;
+		ppi->t_ops = &DEFAULT_TIME_OPS;
+	}
+	if (pp_init_globals(ppg, ppg->rt_opts) < 0)
+		goto out;
+
+	seed = time(NULL);
+	if (getenv("PPSI_DROP_SEED"))
+		seed = atoi(getenv("PPSI_DROP_SEED"));
+	ppsi_drop_init(ppg, seed);
+	return ppg;
+
+nomem:
+	fprintf(stderr, "ppsi: out of memory\n");
+	return NULL;
+out:
+	unix_close_globals(ppg);
+	return NULL;
+}
+
+static void ppsi_state_hook(struct pp_instance *ppi, int old_state)
+{
+	struct ppsi *p = PPSI(GLBS(ppi));
+
+	p->cb.state(p->cb.arg, 1 + ppi->port_idx, old_state, ppi->state);
+}
+
+static void ppsi_offset_hook(struct pp_instance *ppi)
+{
+	struct ppsi *p = PPSI(GLBS(ppi));
+
+	p->cb.offset(p->cb.arg, 1 + ppi->port_idx,
+		     pp_time_to_ns(&DSCUR(ppi)->offsetFromMaster),
+		     pp_time_to_ns(&DSCUR(ppi)->meanPathDelay));
+}
+
+struct ppsi *ppsi_open(int argc, char **argv, const struct ppsi_callbacks *cb)
+{
+	struct pp_globals *ppg;
+	struct ppsi *p;
+
+	ppg = unix_open_globals(argc, argv);
+	if (!ppg)
+		return NULL;
+	p = PPSI(ppg);
+	if (cb)
+		p->cb = *cb;
+	if (p->cb.state)
+		POSIX_ARCH(ppg)->state_hook = ppsi_state_hook;
+	if (p->cb.offset)
+		ppg->offset_hook = ppsi_offset_hook;
+
+	/* This opens the sockets, and thus the epoll set */
+	unix_run_start(ppg);
+	unix_set_deadline(ppg, pp_sched_next(&POSIX_ARCH(ppg)->sched));
+	return p;
+}
+
+void ppsi_close(struct ppsi *p)
+{
+	struct pp_globals *ppg = &p->ppg;
+	struct pp_instance *ppi;
+	int i;
+
+	for (i = 0; i < ppg->nlinks; i++) {
+		ppi = INST(ppg, i);
+		ppi->n_ops->exit(ppi);
+	}
+	pp_close_globals(ppg);
+	unix_close_globals(ppg);
+}
+
+int ppsi_fd(struct ppsi *p)
+{
+	return p->arch_data.epfd;
+}
+
+uint64_t ppsi_next_deadline(struct ppsi *p)
+{
+	return pp_sched_next(&p->arch_data.sched);
+}
+
+/* Like one round of unix_main_loop, but check_packet doesn't wait */
+void ppsi_process(struct ppsi *p)
+{
+	struct pp_globals *ppg = &p->ppg;
+	struct pp_instance *ready[PP_MAX_LINKS];
+	int i;
+
+	unix_run_bmc(ppg);
+	i = unix_net_ops.check_packet(ppg, 0, ready);
+	if (i > 0)
+		unix_run_ready(ppg, ready, i);
+	unix_run_expired(ppg);
+	unix_run_bmc(ppg);
+	unix_set_deadline(ppg, pp_sched_next(&POSIX_ARCH(ppg)->sched));
+}
+
+int ppsi_nports(struct ppsi *p)
+{
+	return p->ppg.nlinks;
+}
+
+const char *ppsi_state_name(int state)
+{
+	struct pp_state_table_item *ip;
+
+	for (ip = pp_state_table; ip->state != PPS_END_OF_TABLE; ip++)
+		if (ip->state == state)
+			return ip->name;
+	return "unknown";
+}
@@ -54,7 +54,8 @@ static DSCurrent  currentDS;
 static DSParent   parentDS;
 static DSTimeProperties timePropertiesDS;
 static struct pp_servo servo;
-static struct wr_servo_state servo_state;
+static struct wr_data wr_data;
+static struct wrpc_arch_data wrpc_arch_data;
 
 static struct wr_dsport wr_dsport = {
 	.ops = &wrpc_wr_operations,
@@ -70,6 +71,7 @@ static int start_tics = 0;
 static struct pp_globals ppg_static; /* forward declaration */
 static unsigned char __tx_buffer[PP_MAX_FRAME_LENGTH];
 static unsigned char __rx_buffer[PP_MAX_FRAME_LENGTH];
+static struct pp_frgn_master frgn_master[PP_NR_FOREIGN_RECORDS];
 
 /* despite the name, ppi_static is not static: tests/measure_t24p.c uses it */
 struct pp_instance ppi_static = {
@@ -84,6 +86,7 @@ struct pp_instance ppi_static = {
 	.port_name		= "wr1",
 	.__tx_buffer		= __tx_buffer,
 	.__rx_buffer		= __rx_buffer,
+	.frgn_master		= frgn_master,
 };
 
 /* We now have a structure with all globals, and multiple ppi inside */
@@ -94,7 +97,8 @@ static struct pp_globals ppg_static = {
 	.currentDS		= &currentDS,
 	.parentDS		= &parentDS,
 	.timePropertiesDS	= &timePropertiesDS,
-	.global_ext_data	= &servo_state,
+	.global_ext_data	= &wr_data,
+	.arch_data		= &wrpc_arch_data,
 };
 
 int wrc_ptp_init()
@@ -241,7 +245,7 @@ int wrc_ptp_stop()
 	wrp->ops->enable_timing_output(ppi, 0);
 	/* Moving fiber: forget about this parent (FIXME: shouldn't be here) */
 	wrp->parentWrConfig = wrp->parentWrModeOn = 0;
-	memset(ppi->frgn_master, 0, sizeof(ppi->frgn_master));
+	memset(frgn_master, 0, sizeof(frgn_master));
 	ppi->frgn_rec_num = 0;          /* no known master */
 
 	ptp_enabled = 0;
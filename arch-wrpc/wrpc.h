@@ -31,6 +31,13 @@ int wrc_ptp_run(int start_stop_qry);
 int wrc_ptp_update(void);
 /* End of wrc-ptp.h */
 
+/* The arch_data of our only pp_globals */
+struct wrpc_arch_data {
+	uint32_t last_tics;	/* the tick counter is 32 bits of ms... */
+	uint64_t tics_high;	/* ...so calc_timeout extends it */
+};
+#define WRPC_ARCH(ppg) ((struct wrpc_arch_data *)(ppg)->arch_data)
+
 extern struct pp_network_operations wrpc_net_ops;
 extern struct pp_time_operations wrpc_time_ops;
 
@@ -9,6 +9,8 @@
  * These are the functions provided by the various wrs files
  */
 
+#include <sys/socket.h>
+#include <sys/epoll.h>
 #include <minipc.h>
 #include <libwr/shmem.h>
 #include <libwr/hal_shmem.h>
@@ -50,13 +52,24 @@ static inline struct hal_port_state *pp_wrs_lookup_port(char *name)
 #define WR_HW_CALIB_ERROR	-1
 #define WR_HW_CALIB_NOT_FOUND	-3
 
+struct unix_rx_batch; /* private to time-unix/unix-socket.c */
 #define POSIX_ARCH(ppg) ((struct unix_arch_data *)(ppg->arch_data))
 struct unix_arch_data {
-	struct timeval tv;
+	int epfd;		/* all channels of all links */
+	int tfd;		/* timerfd in epfd, for the deadline */
+	uint64_t armed;		/* deadline tfd is armed for, in ns */
+	int nevents;		/* events of last round, to clear pkt_present */
+	struct epoll_event events[2 * PP_MAX_LINKS];
+	struct unix_rx_batch *batch[PP_MAX_LINKS][__NR_PP_NP];
+	struct pp_sched sched;	/* when to run each state machine */
 };
 
 extern void wrs_main_loop(struct pp_globals *ppg);
 
+/* time-unix/unix-socket.c: read queued frames, the wrs parses them */
+extern int unix_recv_batch(struct pp_instance *ppi, int chtype, void *pkt,
+			   int len, struct msghdr **msgp);
+
 extern void wrs_init_ipcserver(struct minipc_ch *ppsi_ch);
 
 /* wrs-calibration.c */
@@ -11,7 +11,7 @@
  */
 #include <stdlib.h>
 #include <errno.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <netinet/if_ether.h>
 
 #include <ppsi/ppsi.h>
@@ -20,67 +20,71 @@
 #include <hal_exports.h>
 #include <common-fun.h>
 
-/* Call pp_state_machine for each instance. To be called periodically,
- * when no packets are incoming */
-static int run_all_state_machines(struct pp_globals *ppg)
+/* The link is only polled when the instance runs: don't sleep longer */
+static void wrs_sched_set(struct pp_globals *ppg, struct pp_instance *ppi,
+			  uint64_t wakeup)
 {
-	int j;
-	int delay_ms = 0, delay_ms_j;
+	uint64_t max = ppi->t_ops->calc_timeout(ppi,
+				PP_DEFAULT_NEXT_DELAY_MS * 1000LL * 1000LL);
 
-	for (j = 0; j < ppg->nlinks; j++) {
-		struct pp_instance *ppi = INST(ppg, j);
-		int old_lu = WR_DSPOR(ppi)->linkUP;
-		struct hal_port_state *p;
-
-		/* FIXME: we should save this pointer in the ppi itself */
-		p = pp_wrs_lookup_port(ppi->iface_name);
-		if (!p) {
-			fprintf(stderr, "ppsi: can't find %s in shmem\n",
-				ppi->iface_name);
-			continue;
-		}
+	/* NEVER is ~0, that is -1 in the signed difference below */
+	if (wakeup == PP_SCHED_NEVER || (int64_t)(wakeup - max) > 0)
+		wakeup = max;
+	pp_sched_set(&POSIX_ARCH(ppg)->sched, ppi, wakeup);
+}
 
-		WR_DSPOR(ppi)->linkUP =
-			(p->state != HAL_PORT_STATE_LINK_DOWN &&
-			 p->state != HAL_PORT_STATE_DISABLED);
+/*
+ * Call pp_state_machine for an instance, when its deadline expired, and
+ * schedule its next run. The link state is checked here too.
+ */
+static void run_state_machine(struct pp_globals *ppg, struct pp_instance *ppi)
+{
+	int old_lu = WR_DSPOR(ppi)->linkUP;
+	struct hal_port_state *p;
+
+	/* FIXME: we should save this pointer in the ppi itself */
+	p = pp_wrs_lookup_port(ppi->iface_name);
+	if (!p) {
+		fprintf(stderr, "ppsi: can't find %s in shmem\n",
+			ppi->iface_name);
+		wrs_sched_set(ppg, ppi, PP_SCHED_NEVER);
+		return;
+	}
 
-		if (old_lu != WR_DSPOR(ppi)->linkUP) {
+	WR_DSPOR(ppi)->linkUP =
+		(p->state != HAL_PORT_STATE_LINK_DOWN &&
+		 p->state != HAL_PORT_STATE_DISABLED);
 
-			pp_diag(ppi, fsm, 1, "iface %s went %s\n",
-				ppi->iface_name, WR_DSPOR(ppi)->linkUP ? "up":"down");
+	if (old_lu != WR_DSPOR(ppi)->linkUP) {
 
-			if (WR_DSPOR(ppi)->linkUP) {
-				ppi->state = PPS_INITIALIZING;
-			}
-			else {
-				ppi->n_ops->exit(ppi);
-				ppi->frgn_rec_num = 0;
-				ppi->frgn_rec_best = -1;
-				if (ppg->ebest_idx == ppi->port_idx)
-					wr_servo_reset(ppi);
-			}
-		}
+		pp_diag(ppi, fsm, 1, "iface %s went %s\n",
+			ppi->iface_name, WR_DSPOR(ppi)->linkUP ? "up":"down");
 
-		/* Do not call state machine if link is down */
-		if (WR_DSPOR(ppi)->linkUP)
-			delay_ms_j = pp_state_machine(ppi, NULL, 0);
-		else
-			delay_ms_j = PP_DEFAULT_NEXT_DELAY_MS;
-
-		/* delay_ms is the least delay_ms among all instances */
-		if (j == 0)
-			delay_ms = delay_ms_j;
-		if (delay_ms_j < delay_ms)
-			delay_ms = delay_ms_j;
+		if (WR_DSPOR(ppi)->linkUP) {
+			ppi->state = PPS_INITIALIZING;
+		}
+		else {
+			ppi->n_ops->exit(ppi);
+			ppi->frgn_rec_num = 0;
+			ppi->frgn_rec_best = -1;
+			if (ppg->ebest_idx == ppi->port_idx)
+				wr_servo_reset(ppi);
+		}
 	}
 
-	return delay_ms;
+	/* Do not call state machine if link is down */
+	if (WR_DSPOR(ppi)->linkUP) {
+		pp_state_machine(ppi, NULL, 0);
+		wrs_sched_set(ppg, ppi, ppi->next_deadline);
+	} else {
+		wrs_sched_set(ppg, ppi, PP_SCHED_NEVER);
+	}
 }
 
 void wrs_main_loop(struct pp_globals *ppg)
 {
-	struct pp_instance *ppi;
-	int delay_ms;
+	struct pp_sched *sched = &POSIX_ARCH(ppg)->sched;
+	struct pp_instance *ppi, *ready[PP_MAX_LINKS];
 	int j;
 
 	/* Initialize each link's state machine */
@@ -89,15 +93,14 @@ void wrs_main_loop(struct pp_globals *ppg)
 		ppi = INST(ppg, j);
 
 		/*
-		* The main loop here is based on select. While we are not
+		* The main loop here is based on epoll. While we are not
 		* doing anything else but the protocol, this allows extra stuff
 		* to fit.
 		*/
 		ppi->is_new_state = 1;
+		run_state_machine(ppg, ppi);
 	}
 
-	delay_ms = run_all_state_machines(ppg);
-
 	while (1) {
 		int i;
 
@@ -116,54 +119,56 @@ void wrs_main_loop(struct pp_globals *ppg)
 				if (new_state != ppi->state) {
 					ppi->state = new_state;
 					ppi->is_new_state = 1;
+					pp_sched_set(sched, ppi,
+						ppi->t_ops->calc_timeout(ppi, 0));
 				}
 			}
 			ppg->ebest_updated = 0;
 		}
 
-		i = wrs_net_ops.check_packet(ppg, delay_ms);
+		/* Sleep until a frame arrives or the earliest deadline */
+		i = wrs_net_ops.check_packet(ppg, pp_sched_next(sched),
+					     ready);
 
 		if (i < 0)
 			continue;
 
-		if (i == 0) {
-			delay_ms = run_all_state_machines(ppg);
-			continue;
-		}
-
-		/* If delay_ms is -1, the above ops.check_packet will continue
-		 * consuming the previous timeout (see its implementation).
-		 * This ensures that every state machine is called at least once
-		 * every delay_ms */
-		delay_ms = -1;
-
-		for (j = 0; j < ppg->nlinks; j++) {
-			int tmp_d;
-			ppi = INST(ppg, j);
+		/*
+		 * Only the instances reported by check_packet have frames.
+		 * Each recv may read a batch: pkt_present stays set until
+		 * all of the frames already read have been processed.
+		 */
+		for (j = 0; j < i; j++) {
+			int len;
+			ppi = ready[j];
 
-			if ((ppi->ch[PP_NP_GEN].pkt_present) ||
-			    (ppi->ch[PP_NP_EVT].pkt_present)) {
+			while ((ppi->ch[PP_NP_GEN].pkt_present) ||
+			       (ppi->ch[PP_NP_EVT].pkt_present)) {
 
-				i = __recv_and_count(ppi, ppi->rx_frame,
+				len = __recv_and_count(ppi, ppi->rx_frame,
 						PP_MAX_FRAME_LENGTH - 4,
 						&ppi->last_rcv_time);
 
-				if (i == -2) {
+				if (len == -2) {
 					continue; /* dropped or not for us */
 				}
-				if (i == -1) {
+				if (len == -1) {
 					pp_diag(ppi, frames, 1,
 						"Receive Error %i: %s\n",
 						errno, strerror(errno));
 					continue;
 				}
+				if (len == 0)
+					continue; /* nothing, flag is clear */
 
-				tmp_d = pp_state_machine(ppi, ppi->rx_ptp,
-					i - ppi->rx_offset);
-
-				if ((delay_ms == -1) || (tmp_d < delay_ms))
-					delay_ms = tmp_d;
+				pp_state_machine(ppi, ppi->rx_ptp,
+					len - ppi->rx_offset);
+				wrs_sched_set(ppg, ppi, ppi->next_deadline);
 			}
 		}
+
+		/* Then run the state machines whose deadline expired */
+		while ((ppi = pp_sched_expired(sched)))
+			run_state_machine(ppg, ppi);
 	}
 }
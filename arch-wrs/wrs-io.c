@@ -9,5 +9,6 @@
 
 void pp_puts(const char *s)
 {
-	fputs(s, stdout);
+	if (!pp_log_puts(s))
+		fputs(s, stdout);
 }
@@ -175,10 +175,9 @@ int main(int argc, char **argv)
 	ppg->rt_opts = &__pp_default_rt_opts;
 
 	ppg->max_links = PP_MAX_LINKS;
-	ppg->global_ext_data = alloc_fn(ppsi_head,
-					sizeof(struct wr_servo_state));
+	ppg->global_ext_data = alloc_fn(ppsi_head, sizeof(struct wr_data));
 	/* NOTE: arch_data is not in shmem */
-	ppg->arch_data = malloc( sizeof(struct unix_arch_data));
+	ppg->arch_data = calloc(1, sizeof(struct unix_arch_data));
 	ppg->pp_instances = alloc_fn(ppsi_head,
 				     ppg->max_links * sizeof(*ppi));
 
@@ -186,6 +185,7 @@ int main(int argc, char **argv)
 		fprintf(stderr, "ppsi: out of memory\n");
 		exit(1);
 	}
+	POSIX_ARCH(ppg)->epfd = -1; /* created by the first net init */
 
 	/* Set offset here, so config parsing can override it */
 	if (adjtimex(&t) >= 0) {
@@ -226,11 +226,15 @@ int main(int argc, char **argv)
 		ppi->iface_name = ppi->cfg.iface_name;
 		ppi->port_name = ppi->cfg.port_name;
 		ppi->mech = ppi->cfg.mech;
+		/* In shmem like the instance, for the monitoring tools */
+		ppi->frgn_master = alloc_fn(ppsi_head, PP_NR_FOREIGN_RECORDS *
+					    sizeof(*ppi->frgn_master));
 		ppi->portDS = calloc(1, sizeof(*ppi->portDS));
 		if (ppi->portDS)
 			ppi->portDS->ext_dsport =
 				calloc(1, sizeof(struct wr_dsport));
-		if (!ppi->portDS || !ppi->portDS->ext_dsport) {
+		if (!ppi->frgn_master || !ppi->portDS ||
+		    !ppi->portDS->ext_dsport) {
 			fprintf(stderr, "ppsi: out of memory\n");
 			exit(1);
 		}
@@ -22,15 +22,9 @@ static char *thing_name[] = {
 };
 
 
-void __pp_diag(struct pp_instance *ppi, enum pp_diag_things th,
-		      int level, char *fmt, ...)
+static void __pp_vdiag(char *name, enum pp_diag_things th,
+		       int level, char *fmt, va_list args)
 {
-	va_list args;
-	char *name = ppi ? ppi->port_name : "ppsi";
-
-	if (!__PP_DIAG_ALLOW(ppi, th, level))
-		return;
-
 #ifdef DIAG_PUTS
 	/*
 	 * We allow to divert diagnostic messages to a different
@@ -45,20 +39,41 @@ void __pp_diag(struct pp_instance *ppi, enum pp_diag_things th,
 		pp_sprintf(buf, "%s-%i-%s: ",
 			   thing_name[th], level, name);
 		DIAG_PUTS(buf);
-		va_start(args, fmt);
 		pp_vsprintf(buf, fmt, args);
-		va_end(args);
 		DIAG_PUTS(buf);
 	}
 #else
 	/* Use the normal output channel for diagnostics */
 	pp_printf("%s-%i-%s: ", thing_name[th], level, name);
-	va_start(args, fmt);
 	pp_vprintf(fmt, args);
-	va_end(args);
 #endif
 }
 
+void __pp_diag(struct pp_instance *ppi, enum pp_diag_things th,
+		      int level, char *fmt, ...)
+{
+	va_list args;
+
+	if (!__PP_DIAG_ALLOW(ppi, th, level))
+		return;
+	va_start(args, fmt);
+	__pp_vdiag(ppi ? ppi->port_name : "ppsi", th, level, fmt, args);
+	va_end(args);
+}
+
+/* Before ports exist (or outside of them) only the global flags apply */
+void __pp_global_diag(struct pp_globals *ppg, enum pp_diag_things th,
+		      int level, char *fmt, ...)
+{
+	va_list args;
+
+	if (!ppg || !__PP_DIAG_ALLOW_FLAGS(ppg->d_flags, th, level))
+		return;
+	va_start(args, fmt);
+	__pp_vdiag("ppsi", th, level, fmt, args);
+	va_end(args);
+}
+
 unsigned long pp_diag_parse(char *diaglevel)
 {
 	unsigned long res = 0;
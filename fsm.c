@@ -6,8 +6,6 @@
  */
 #include <ppsi/ppsi.h>
 
-unsigned long pp_global_d_flags; /* This is the only "global" file in ppsi */
-
 /*
  * This is somehow a duplicate of __pp_diag, but I still want
  * explicit timing in the fsm enter/stay/leave messages,
@@ -17,15 +15,16 @@ static void pp_fsm_printf(struct pp_instance *ppi, char *fmt, ...)
 {
 	va_list args;
 	struct pp_time t;
-	unsigned long oflags = pp_global_d_flags;
+	struct pp_globals *ppg = GLBS(ppi);
+	unsigned long oflags = ppg->d_flags;
 
 	if (!pp_diag_allow(ppi, fsm, 1))
 		return;
 
 	/* temporarily set NOTIMELOG, as we'll print the time ourselves */
-	pp_global_d_flags |= PP_FLAG_NOTIMELOG;
+	ppg->d_flags |= PP_FLAG_NOTIMELOG;
 	ppi->t_ops->get(ppi, &t);
-	pp_global_d_flags = oflags;
+	ppg->d_flags = oflags;
 
 	pp_printf("diag-fsm-1-%s: %09d.%03d: ", ppi->port_name,
 		  (int)t.secs, (int)((t.scaled_nsecs >> 16)) / 1000000);
@@ -48,18 +47,21 @@ static void pp_diag_fsm(struct pp_instance *ppi, char *name, int sequence,
 {
 	if (sequence == STATE_ENTER) {
 		/* enter with or without a packet len */
-		pp_fsm_printf(ppi, "ENTER %s, packet len %i\n",
-			  name, plen);
+		if (!pp_trace(ppi, FSM_ENTER, name, plen))
+			pp_fsm_printf(ppi, "ENTER %s, packet len %i\n",
+				      name, plen);
 		return;
 	}
 	if (sequence == STATE_LOOP) {
-		pp_fsm_printf(ppi, "%s: reenter in %i ms\n", name,
-				ppi->next_delay);
+		if (!pp_trace(ppi, FSM_LOOP, name, ppi->next_delay))
+			pp_fsm_printf(ppi, "%s: reenter in %i ms\n", name,
+				      ppi->next_delay);
 		return;
 	}
 	/* leave has one \n more, so different states are separate */
-	pp_fsm_printf(ppi, "LEAVE %s (next: %3i)\n\n",
-		      name, ppi->next_state);
+	if (!pp_trace(ppi, FSM_LEAVE, name, ppi->next_state))
+		pp_fsm_printf(ppi, "LEAVE %s (next: %3i)\n\n",
+			      name, ppi->next_state);
 }
 
 static struct pp_state_table_item *
@@ -194,7 +196,8 @@ static int fsm_unpack_verify_frame(struct pp_instance *ppi,
  * is that of the extension, otherwise the one in state-table-default.c
  */
 
-int pp_state_machine(struct pp_instance *ppi, uint8_t *packet, int plen)
+static int __pp_state_machine(struct pp_instance *ppi, uint8_t *packet,
+			      int plen)
 {
 	struct pp_state_table_item *ip;
 	int state, err = 0;
@@ -202,11 +205,14 @@ int pp_state_machine(struct pp_instance *ppi, uint8_t *packet, int plen)
 
 	if (plen > 0) {
 		msgtype = packet[0] & 0xf;
-		pp_diag(ppi, frames, 1,
-			"RECV %02d bytes at %9d.%09d (type %x, %s)\n", plen,
-			(int)ppi->last_rcv_time.secs,
-			(int)(ppi->last_rcv_time.scaled_nsecs >> 16),
-			msgtype, pp_msgtype_info[msgtype].name);
+		if (!pp_trace(ppi, FRAME_RECV, pp_msgtype_info[msgtype].name,
+			      plen, ppi->last_rcv_time.secs,
+			      ppi->last_rcv_time.scaled_nsecs >> 16, msgtype))
+			pp_diag(ppi, frames, 1,
+				"RECV %02d bytes at %9d.%09d (type %x, %s)\n",
+				plen, (int)ppi->last_rcv_time.secs,
+				(int)(ppi->last_rcv_time.scaled_nsecs >> 16),
+				msgtype, pp_msgtype_info[msgtype].name);
 	}
 
 	/*
@@ -269,3 +275,20 @@ int pp_state_machine(struct pp_instance *ppi, uint8_t *packet, int plen)
 	pp_diag_fsm(ppi, ip->name, STATE_LOOP, 0);
 	return ppi->next_delay;
 }
+
+/*
+ * Same, but also set ppi->next_deadline: states using pp_next_delay_*()
+ * already saved the exact deadline of their timeout, the others asked
+ * for a delay in ms.
+ */
+int pp_state_machine(struct pp_instance *ppi, uint8_t *packet, int plen)
+{
+	int delay_ms;
+
+	ppi->next_deadline = 0;
+	delay_ms = __pp_state_machine(ppi, packet, plen);
+	if (!delay_ms || !ppi->next_deadline)
+		ppi->next_deadline = ppi->t_ops->calc_timeout(ppi,
+					delay_ms * 1000LL * 1000LL);
+	return delay_ms;
+}
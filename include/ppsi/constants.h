@@ -61,6 +61,7 @@ enum pp_timeouts {
 
 #define PP_ALTERNATE_MASTER_FLAG	1
 #define PP_TWO_STEP_FLAG		2
+#define PP_UNICAST_FLAG			4
 #define PP_VERSION_PTP			2
 
 #define PP_HEADER_LENGTH		34
@@ -73,6 +74,13 @@ enum pp_timeouts {
 #define PP_PDELAY_RESP_LENGTH		54
 #define PP_PDELAY_R_FUP_LENGTH		54
 #define PP_MANAGEMENT_LENGTH		48
+#define PP_SIGNALING_LENGTH		44 /* before the TLVs */
+
+/* TLVs for unicast negotiation (16.1) */
+#define PP_TLV_REQUEST_UNICAST		0x0004
+#define PP_TLV_GRANT_UNICAST		0x0005
+#define PP_TLV_CANCEL_UNICAST		0x0006
+#define PP_TLV_ACK_CANCEL_UNICAST	0x0007
 
 #define PP_MINIMUM_LENGTH	44
 #define PP_MAX_FRAME_LENGTH	128 /* must fit extension and ethhdr */
@@ -7,7 +7,10 @@
 
 /*
  * The "new" diagnostics is based on flags: there are per-instance d_flags
- * and global d_flags.
+ * and global d_flags, in pp_globals. Without a pp_instance, pp_diag()
+ * prints nothing; code that only has the globals uses pp_global_diag().
+ * So there is no process-wide state, and several pp_globals can run
+ * in the same process.
  *
  * Basically, we may have just bits about what to print, but we might
  * want to add extra-verbose stuff for specific cases, like looking at
@@ -41,13 +44,12 @@ enum pp_diag_things {
  * mechanism).
  */
 
-extern unsigned long pp_global_d_flags; /* Supplement ppi-specific ones */
-
 #define PP_FLAG_NOTIMELOG      1 /* This is for a special case, I'm sorry */
 
 
 /* So, extract the level */
-#define __PP_FLAGS(ppi) ((ppi ? ppi->d_flags : 0) | pp_global_d_flags)
+#define __PP_FLAGS(ppi) ((ppi) ? (ppi)->d_flags | \
+			 ((ppi)->glbs ? (ppi)->glbs->d_flags : 0) : 0)
 
 #define __PP_DIAG_ALLOW(ppi, th, level) \
 		((__PP_FLAGS(ppi) >> (4 * (th)) & 0xf) >= level)
@@ -61,6 +63,9 @@ extern unsigned long pp_global_d_flags; /* Supplement ppi-specific ones */
 extern void __pp_diag(struct pp_instance *ppi, enum pp_diag_things th,
 		      int level, char *fmt, ...)
 	__attribute__((format(printf, 4, 5)));
+extern void __pp_global_diag(struct pp_globals *ppg, enum pp_diag_things th,
+			     int level, char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
 
 /* Now, *still* use PPSI_NO_DIAG as an escape route to kill all diag code */
 #ifdef PPSI_NO_DIAG
@@ -77,6 +82,14 @@ extern void __pp_diag(struct pp_instance *ppi, enum pp_diag_things th,
 	PP_HAS_DIAG; /* return 1 if done, 0 if not done */		\
 	})
 
+/* Same, for code that has the globals but no pp_instance */
+#define pp_global_diag(ppg_, th_, level_, ...)				\
+	({								\
+	if (PP_HAS_DIAG)						\
+		__pp_global_diag(ppg_, pp_dt_ ## th_, level_, __VA_ARGS__); \
+	PP_HAS_DIAG;							\
+	})
+
 #define pp_diag_allow(ppi_, th_, level_) \
 		(PP_HAS_DIAG && __PP_DIAG_ALLOW(ppi_,  pp_dt_ ## th_, level_))
 
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+#ifndef __PPSI_LIBPPSI_H__
+#define __PPSI_LIBPPSI_H__
+#include <stdint.h>
+
+/*
+ * PPSi as a library (libppsi.a, libppsi.so, unix arch only). Instead of
+ * running its own main loop, PPSi is driven by the event loop of the
+ * application: wait for ppsi_fd() to be readable (it also becomes readable
+ * at the deadline of the next timeout), then call ppsi_process(). Several
+ * instances may be open at the same time, each with its own ports; each
+ * must be used by one thread at a time. Diagnostics go to stdout, which is
+ * shared by the whole process.
+ *
+ *	p = ppsi_open(argc, argv, &cb);
+ *	while (1) {
+ *		poll ppsi_fd(p) and your own file descriptors;
+ *		if (ppsi_fd(p) is readable)
+ *			ppsi_process(p);
+ *	}
+ *	ppsi_close(p);
+ */
+
+struct ppsi;
+
+/* Ports are numbered from 1, in the order of the configuration */
+struct ppsi_callbacks {
+	void (*state)(void *arg, int port, int old_state, int new_state);
+	void (*offset)(void *arg, int port, int64_t ofm_ns, int64_t mpd_ns);
+	void *arg;
+};
+
+/* Same arguments as the ppsi program (argv[0] is ignored); NULL on error */
+extern struct ppsi *ppsi_open(int argc, char **argv,
+			      const struct ppsi_callbacks *cb);
+extern void ppsi_close(struct ppsi *p);
+
+/* An epoll file descriptor, readable when ppsi_process() has work to do */
+extern int ppsi_fd(struct ppsi *p);
+
+/* Next timeout, in CLOCK_MONOTONIC ns (~0ULL: none), for timer-based loops */
+extern uint64_t ppsi_next_deadline(struct ppsi *p);
+
+/* Never blocks: receive what is there, and run expired timeouts */
+extern void ppsi_process(struct ppsi *p);
+
+extern int ppsi_nports(struct ppsi *p);
+extern const char *ppsi_state_name(int state);
+
+#endif /* __PPSI_LIBPPSI_H__ */
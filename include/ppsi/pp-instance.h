@@ -25,6 +25,7 @@ struct pp_runtime_opts {
 	int prio1;
 	int prio2;
 	int domain_number;
+	int one_step;		/* Sync carries its own stamp, no Follow Up */
 	void *arch_opts;
 };
 
@@ -87,11 +88,36 @@ struct pp_avg_fltr {
 	int64_t s_exp;
 };
 
+#define PP_SERVO_LR_WINDOW	16	/* samples, for linear regression */
+#define PP_SERVO_FLT_MAX	32	/* samples, for "servo-window" */
+
 struct pp_servo {
 	struct pp_time m_to_s_dly;
 	struct pp_time s_to_m_dly;
 	long long obs_drift;
 	struct pp_avg_fltr mpd_fltr;
+
+	/* The delays of the last samples, see pp_servo_filter() */
+	int ndelays, delay_head;
+	int64_t delays[PP_SERVO_FLT_MAX];	/* m_to_s + s_to_m, ns */
+
+	/* Adaptive Delay_Req rate, see pp_servo_dreq_resp() */
+	int64_t mpd_var;	/* ns^2: raw mpd around the filtered one */
+	int64_t last_m_to_s;	/* ns */
+	int dreq_good;		/* stable samples at the current rate */
+
+	/* The other controllers: see servo-linreg.c and servo-kalman.c */
+	struct pp_servo_lr {
+		int n, head;
+		int64_t freq;
+		int64_t x[PP_SERVO_LR_WINDOW], y[PP_SERVO_LR_WINDOW];
+	} lr;
+	struct pp_servo_kf {
+		int started;
+		int64_t freq, theta, gamma;	/* ppb, ns, ppb */
+		int64_t p00, p01, p11;		/* covariance, Q8 */
+		int64_t last;			/* t2 of previous sample */
+	} kf;
 };
 
 enum { /* The two sockets. They are called "net path" for historical reasons */
@@ -109,14 +135,24 @@ struct pp_instance_cfg {
 	char iface_name[16];
 	int ext;   /* 0: none, 1: whiterabbit. 2: HA */
 	int mech;   /* 0: E2E, 1: P2P */
+	int servo;  /* 0: PI, 1: linreg, 2: Kalman, 3: sync-only */
+	int servo_window, servo_percentile;
+	int ucast_clients, ucast_duration; /* unicast master, if not 0 */
+	int hybrid; /* Delay_Req and Delay_Resp are unicast */
+	int dreq_backoff; /* max log2 steps above logMinDelayReqInterval */
 };
 
 /*
- * Structure for the individual ppsi link
+ * Structure for the individual ppsi link. What is used for each frame
+ * comes first; the foreign masters (only used by BMC) are stored elsewhere
+ * by the architecture, and configuration stuff is at the end.
  */
 struct pp_instance {
 	int state;
 	int next_state, next_delay, is_new_state; /* set by state processing */
+	uint64_t next_deadline;		/* next_delay, in calc_timeout ns */
+	uint64_t sched_wakeup;		/* lib/sched.c, hosted archs only */
+	int sched_pos;
 	struct pp_state_table_item *current_state_item;
 	void *arch_data;		/* if arch needs it */
 	void *ext_data;			/* if protocol ext needs it */
@@ -147,27 +183,40 @@ struct pp_instance {
 	int tx_offset, rx_offset;		/* ptp payload vs send/recv */
 	unsigned char peer[6];	/* Our peer's MAC address */
 	uint16_t peer_vid;	/* Our peer's VID (for PROTO_VLAN) */
+	Integer32 peer_ip;	/* Our peer's IPv4 address (for PROTO_UDP) */
+	Integer32 tx_ucast;	/* If not 0, send there (for PROTO_UDP) */
+	Integer8 tx_ucast_log;	/* and logMessageInterval of that frame */
+	const unsigned char *tx_mac; /* If not NULL, send there (raw Ethernet) */
+	Integer32 parent_ip;	/* Where Sync comes from (for hybrid mode) */
+	unsigned char parent_mac[6];
 
 	/* Times, for the various offset computations */
 	struct pp_time t1, t2, t3, t4, t5, t6;		/* *the* stamps */
 	uint64_t syncCF;				/* transp. clocks */
 	struct pp_time last_rcv_time, last_snt_time;	/* two temporaries */
 
-	/* Page 85: each port shall maintain an implementation-specific
-	 * foreignMasterDS data set for the purposes of qualifying Announce
-	 * messages */
-	UInteger16 frgn_rec_num;
-	Integer16  frgn_rec_best;
-	struct pp_frgn_master frgn_master[PP_NR_FOREIGN_RECORDS];
-
 	DSPort *portDS;				/* page 72 */
+	struct pp_ucast *ucast;			/* unicast master, if any */
 
-	unsigned long timeouts[__PP_TO_ARRAY_SIZE];
+	uint64_t timeouts[__PP_TO_ARRAY_SIZE];
+	int to_values[__PP_TO_ARRAY_SIZE]; /* log2 intervals, or ms */
+	int dreq_backoff;	/* Delay_Req interval is 2^this times longer */
+	uint32_t to_seed;	/* randomized timeouts, 0: from clockIdentity */
 	UInteger16 recv_sync_sequence_id;
 
 	UInteger16 sent_seq[__PP_NR_MESSAGES_TYPES]; /* last sent this type */
 	MsgHeader received_ptp_header;
 
+	unsigned long ptp_tx_count;
+	unsigned long ptp_rx_count;
+
+	/* Page 85: each port shall maintain an implementation-specific
+	 * foreignMasterDS data set for the purposes of qualifying Announce
+	 * messages */
+	UInteger16 frgn_rec_num;
+	Integer16  frgn_rec_best;
+	struct pp_frgn_master *frgn_master;	/* PP_NR_FOREIGN_RECORDS */
+
 	char *iface_name; /* for direct actions on hardware */
 	char *port_name; /* for diagnostics, mainly */
 	int port_idx;
@@ -175,15 +224,13 @@ struct pp_instance {
 	int vlans[CONFIG_VLAN_ARRAY_SIZE];
 	int nvlans; /* according to configuration */
 	struct pp_instance_cfg cfg;
-
-	unsigned long ptp_tx_count;
-	unsigned long ptp_rx_count;
-};
+} __attribute__((aligned(CONFIG_CACHE_LINE)));
 /* The following things used to be bit fields. Other flags are now enums */
 #define PPI_FLAG_FROM_CURRENT_PARENT	0x01
 #define PPI_FLAG_WAITING_FOR_F_UP	0x02
 #define PPI_FLAG_WAITING_FOR_RF_UP	0x04
 #define PPI_FLAGS_WAITING		0x06 /* both of the above */
+#define PPI_FLAG_PARENT_ADDR		0x08 /* parent_ip/mac are valid */
 
 struct pp_globals_cfg {
 	int cfg_items;			/* Remember how many we parsed */
@@ -195,6 +242,7 @@ struct pp_globals_cfg {
  */
 struct pp_globals {
 	struct pp_instance *pp_instances;
+	void *arena;			/* lib/arena.c: what is to be freed */
 
 	struct pp_servo *servo;
 
@@ -216,6 +264,11 @@ struct pp_globals {
 	struct pp_globals_cfg cfg;
 
 	int rxdrop, txdrop;		/* fault injection, per thousand */
+	unsigned long rxrand, txrand;	/* and its random state */
+	unsigned long d_flags;		/* diagnostics, for all ports */
+	struct pp_trace_ring *trace;	/* binary trace, if configured */
+	/* libppsi: called at each new offsetFromMaster */
+	void (*offset_hook)(struct pp_instance *ppi);
 
 	void *arch_data;		/* if arch needs it */
 	void *global_ext_data;		/* if protocol ext needs it */
@@ -20,5 +20,9 @@ static inline void clear_time(struct pp_time *t)
 {
 	memset(t, 0, sizeof(*t));
 }
+static inline int64_t pp_time_to_ns(const struct pp_time *t)
+{
+	return t->secs * 1000 * 1000 * 1000 + (t->scaled_nsecs >> 16);
+}
 
 #endif /* __PPSI_PP_TIME_H__ */
@@ -16,6 +16,7 @@
 #include <ppsi/ieee1588_types.h>
 #include <ppsi/constants.h>
 #include <ppsi/jiffies.h>
+#include <ppsi/trace.h>
 
 #include <ppsi/pp-instance.h>
 #include <ppsi/diag-macros.h>
@@ -171,9 +172,25 @@ struct pp_ext_hooks {
 extern struct pp_ext_hooks pp_hooks; /* The one for the extension we build */
 
 
+/*
+ * Copies of a message for send_batch (one per vlan): the arch builds
+ * the header in front of each ptp payload, and returns each tx stamp.
+ */
+struct pp_tx_copy {
+	void *ptp;		/* payload of this copy */
+	int len;		/* payload length */
+	int vid;		/* vlan of this copy */
+	struct pp_time t;	/* set by send_batch */
+};
+
 /*
  * Network methods are encapsulated in a structure, so each arch only needs
  * to provide that structure. This simplifies management overall.
+ * check_packet waits up to the deadline (calc_timeout time base, or
+ * PP_SCHED_NEVER) and returns the number of instances stored in "ready",
+ * which have frames.
+ * send_batch is optional: it sends copies in order, and returns the index
+ * of the first one not sent (so n if all of them were sent).
  */
 struct pp_network_operations {
 	int (*init)(struct pp_instance *ppi);
@@ -181,7 +198,10 @@ struct pp_network_operations {
 	int (*recv)(struct pp_instance *ppi, void *pkt, int len,
 		    struct pp_time *t);
 	int (*send)(struct pp_instance *ppi, void *pkt, int len, int msgtype);
-	int (*check_packet)(struct pp_globals *ppg, int delay_ms);
+	int (*check_packet)(struct pp_globals *ppg, uint64_t deadline,
+			    struct pp_instance **ready);
+	int (*send_batch)(struct pp_instance *ppi, struct pp_tx_copy *c,
+			  int n, int msgtype);
 };
 
 /* This is the struct pp_network_operations to be provided by time- dir */
@@ -205,7 +225,8 @@ struct pp_time_operations {
 	int (*adjust_offset)(struct pp_instance *ppi, long offset_ns);
 	int (*adjust_freq)(struct pp_instance *ppi, long freq_ppb);
 	int (*init_servo)(struct pp_instance *ppi);
-	unsigned long (*calc_timeout)(struct pp_instance *ppi, int millisec);
+	/* monotonic time in ns, nsec from now: the base for timeouts */
+	uint64_t (*calc_timeout)(struct pp_instance *ppi, int64_t nsec);
 };
 
 /* This is the struct pp_time_operations to be provided by time- dir */
@@ -225,7 +246,8 @@ extern struct pp_time_operations unix_time_ops;
 /*
  * Timeouts.
  *
- * A timeout, is just a number that must be compared with the current counter.
+ * A timeout, is just a number that must be compared with the current counter
+ * (64-bit nanoseconds, so it never wraps and allows sub-ms intervals).
  * So we don't need struct operations, as it is one function only,
  * which is folded into the "pp_time_operations" above.
  */
@@ -235,10 +257,42 @@ extern void pp_timeout_set(struct pp_instance *ppi, int index);
 extern void pp_timeout_setall(struct pp_instance *ppi);
 extern int pp_timeout(struct pp_instance *ppi, int index)
 	__attribute__((warn_unused_result));
+extern int pp_next_delay(struct pp_instance *ppi, uint64_t when);
 extern int pp_next_delay_1(struct pp_instance *ppi, int i1);
 extern int pp_next_delay_2(struct pp_instance *ppi, int i1, int i2);
 extern int pp_next_delay_3(struct pp_instance *ppi, int i1, int i2, int i3);
 
+/* lib/sched.c: hosted main loops run each instance at its own deadline */
+struct pp_sched {
+	int n;
+	struct pp_instance *heap[PP_MAX_LINKS];
+};
+#define PP_SCHED_NEVER	(~0ULL)
+extern void pp_sched_set(struct pp_sched *s, struct pp_instance *ppi,
+			 uint64_t wakeup);
+extern uint64_t pp_sched_next(struct pp_sched *s);
+extern struct pp_instance *pp_sched_expired(struct pp_sched *s);
+
+/* lib/arena.c: instances, DSPort, buffers and foreign masters together */
+extern int pp_arena_alloc(struct pp_globals *ppg);
+extern void pp_arena_free(struct pp_globals *ppg);
+
+/*
+ * lib/trace.c: binary trace (see ppsi/trace.h). If a trace file is
+ * configured, pp_trace() stores the event and returns 1, so the caller
+ * can skip the equivalent pp_diag(). Otherwise it costs one test.
+ */
+extern int __pp_trace(struct pp_instance *ppi, int id, const char *name,
+		      const int64_t *args, int nargs);
+
+#define pp_trace(ppi_, id_, name_, ...)					\
+	({								\
+	int64_t __args[] = {__VA_ARGS__};				\
+	(CONFIG_TRACE_SHIFT && GLBS(ppi_)->trace) ?			\
+		__pp_trace(ppi_, PP_TR_ ## id_, name_, __args,		\
+			   ARRAY_SIZE(__args)) : 0;			\
+	})
+
 /* The channel for an instance must be created and possibly destroyed. */
 extern int pp_init_globals(struct pp_globals *ppg, struct pp_runtime_opts *opts);
 extern int pp_close_globals(struct pp_globals *ppg);
@@ -337,6 +391,13 @@ extern int pp_config_string(struct pp_globals *ppg, char *s);
 extern int pp_config_file(struct pp_globals *ppg, int force, char *fname);
 extern int f_simple_int(struct pp_argline *l, int lineno,
 			struct pp_globals *ppg, union pp_cfg_arg *arg);
+extern int f_trace_file(struct pp_argline *l, int lineno,
+			struct pp_globals *ppg, union pp_cfg_arg *arg);
+extern int f_log_queue(struct pp_argline *l, int lineno,
+		       struct pp_globals *ppg, union pp_cfg_arg *arg);
+
+/* lib/async-log.c: hosted pp_puts() hands text to a writer thread */
+extern int pp_log_puts(const char *s);
 
 #define PPSI_PROTO_RAW		0
 #define PPSI_PROTO_UDP		1
@@ -349,8 +410,23 @@ extern int f_simple_int(struct pp_argline *l, int lineno,
 #define PPSI_EXT_NONE		0
 #define PPSI_EXT_WR		1
 
+#define PPSI_SERVO_PI		0
+#define PPSI_SERVO_LINREG	1
+#define PPSI_SERVO_KALMAN	2
+#define PPSI_SERVO_SYNC_ONLY	3
+
+
+/* Servo: the controller is chosen for each port ("servo" in config) */
+struct pp_servo_ops {
+	/* freq is the current frequency (ppb), if the arch can tell */
+	void (*init)(struct pp_instance *ppi, int freq);
+	/* Return the frequency to set (ppb), after a new offset at time t */
+	int (*sample)(struct pp_instance *ppi, struct pp_time *ofm,
+		      struct pp_time *t);
+};
+extern struct pp_servo_ops pp_servo_pi, pp_servo_linreg, pp_servo_kalman;
+extern struct pp_servo_ops pp_servo_sync_only;
 
-/* Servo */
 extern void pp_servo_init(struct pp_instance *ppi);
 extern void pp_servo_got_sync(struct pp_instance *ppi); /* got t1 and t2 */
 extern void pp_servo_got_resp(struct pp_instance *ppi); /* got all t1..t4 */
@@ -385,18 +461,28 @@ extern void msg_unpack_pdelay_req(void *buf, MsgPDelayReq * pdelay_req);
 extern void *msg_copy_header(MsgHeader *dest, MsgHeader *src); /* REMOVE ME!! */
 extern int msg_issue_announce(struct pp_instance *ppi);
 extern int msg_issue_sync_followup(struct pp_instance *ppi);
+extern int msg_issue_announce_vlans(struct pp_instance *ppi);
+extern int msg_issue_sync_followup_vlans(struct pp_instance *ppi);
 extern int msg_issue_request(struct pp_instance *ppi);
 extern int msg_issue_delay_resp(struct pp_instance *ppi,
 				struct pp_time *time);
 extern int msg_issue_pdelay_resp_followup(struct pp_instance *ppi,
 					  struct pp_time *time);
 extern int msg_issue_pdelay_resp(struct pp_instance *ppi, struct pp_time *time);
+extern void msg_set_one_step_stamp(void *buf, int msgtype, struct pp_time *t);
+
+/* proto-standard/unicast.c: unicast negotiation, master side */
+extern int pp_ucast_init(struct pp_instance *ppi);
+extern int pp_ucast_master(struct pp_instance *ppi, uint8_t *pkt, int plen,
+			   int msgtype);
+extern int pp_ucast_next_delay(struct pp_instance *ppi);
 
 /* Functions for time math */
 extern void normalize_pp_time(struct pp_time *t);
 extern void pp_time_add(struct pp_time *t1, struct pp_time *t2);
 extern void pp_time_sub(struct pp_time *t1, struct pp_time *t2);
 extern void pp_time_div2(struct pp_time *t);
+extern int64_t pp_muldiv(int64_t n, uint32_t m, int64_t d);
 
 /*
  * The state machine itself is an array of these structures.
@@ -423,7 +509,7 @@ extern int pp_state_machine(struct pp_instance *ppi, uint8_t *packet, int plen);
 
 /* Frame-drop support -- rx before tx, alphabetically */
 extern void ppsi_drop_init(struct pp_globals *ppg, unsigned long seed);
-extern int ppsi_drop_rx(void);
-extern int ppsi_drop_tx(void);
+extern int ppsi_drop_rx(struct pp_globals *ppg);
+extern int ppsi_drop_tx(struct pp_globals *ppg);
 
 #endif /* __PPSI_PPSI_H__ */
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+#ifndef __PPSI_TRACE_H__
+#define __PPSI_TRACE_H__
+#include <stdint.h>
+
+/*
+ * Binary trace of hot-path events. Instead of formatting diagnostic
+ * lines while we timestamp frames, fixed-size records are stored in a
+ * ring, that lives in a shared file (see "trace-file" in ppsi.conf).
+ * tools/ppsi-trace reads the ring and prints the usual diag lines.
+ *
+ * This header is shared with the tools, so it only depends on stdint.h.
+ */
+#define PP_TRACE_MAGIC		0x50505452	/* "PPTR" */
+#define PP_TRACE_VERSION	1
+#define PP_TRACE_NARGS		6
+#define PP_TRACE_NAMELEN	16	/* a name uses 2 args */
+#define PP_TRACE_NPORTS		64	/* PP_MAX_LINKS */
+
+/*
+ * The events: id, diag thing and level, and the format for the reader.
+ * Arguments are all int64_t. A name (up to 16 chars, e.g. the state)
+ * fills the first two and is printed at "%s"; the other conversions
+ * consume the remaining args in order, "%T" prints nanoseconds as s.ns
+ */
+#define PP_TRACE_EVENTS(E)						\
+	E(FSM_ENTER,	fsm,	1, "ENTER %s, packet len %lli\n")	\
+	E(FSM_LOOP,	fsm,	1, "%s: reenter in %lli ms\n")		\
+	E(FSM_LEAVE,	fsm,	1, "LEAVE %s (next: %3lli)\n\n")	\
+	E(FRAME_SENT,	frames,	1, "SENT %02lli bytes at %lli.%09lli (%s)\n") \
+	E(FRAME_RECV,	frames,	1,					\
+	  "RECV %02lli bytes at %9lli.%09lli (type %llx, %s)\n")	\
+	E(SERVO_MPD,	servo,	1, "meanPathDelay: %T\n")		\
+	E(SERVO_OFM,	servo,	1, "Offset from master:     %T\n")
+
+enum pp_trace_id {
+#define PP_TRACE_ENUM(id, th, level, fmt) PP_TR_ ## id,
+	PP_TRACE_EVENTS(PP_TRACE_ENUM)
+#undef PP_TRACE_ENUM
+	__PP_TR_NR
+};
+
+/* One cache line each. seq is 0 while the writer fills the record */
+struct pp_trace_rec {
+	uint64_t ns;		/* calc_timeout() time: monotonic */
+	uint32_t seq;		/* low bits of (index + 1) */
+	uint16_t id;
+	uint8_t port;		/* index in pp_instances */
+	uint8_t nargs;
+	int64_t arg[PP_TRACE_NARGS];
+} __attribute__((aligned(64)));
+
+/*
+ * The ring, as seen in the file. There is a single writer: the reader
+ * takes head (acquire), then copies records checking seq before and after.
+ */
+struct pp_trace_ring {
+	uint32_t magic;		/* written last, when the rest is valid */
+	uint32_t version;
+	uint32_t recsize;	/* sizeof(struct pp_trace_rec) */
+	uint32_t nrec;		/* a power of two */
+	uint64_t head;		/* records ever written */
+	char port_name[PP_TRACE_NPORTS][PP_TRACE_NAMELEN];
+	struct pp_trace_rec rec[];
+};
+
+#endif /* __PPSI_TRACE_H__ */
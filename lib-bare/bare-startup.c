@@ -33,6 +33,7 @@ static struct pp_servo servo;
 static struct pp_globals ppg_static; /* forward declaration */
 static unsigned char __tx_buffer[PP_MAX_FRAME_LENGTH];
 static unsigned char __rx_buffer[PP_MAX_FRAME_LENGTH];
+static struct pp_frgn_master frgn_master[PP_NR_FOREIGN_RECORDS];
 
 static struct pp_instance ppi_static = {
 	.glbs			= &ppg_static,
@@ -46,6 +47,7 @@ static struct pp_instance ppi_static = {
 	.mech			= CONFIG_HAS_P2P ? PP_P2P_MECH : PP_E2E_MECH,
 	.__tx_buffer		= __tx_buffer,
 	.__rx_buffer		= __rx_buffer,
+	.frgn_master		= frgn_master,
 };
 
 /* We now have a structure with all globals, and multiple ppi inside */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Port memory for hosted archs, in one allocation per pp_globals. The
+ * instances come first, then the hot block of each port (DSPort and the
+ * two frame buffers), each piece starting on a cache line, so a burst
+ * of frames on many ports touches few lines. The foreign master records,
+ * that only BMC looks at, are all together at the end.
+ */
+#include <stdlib.h>
+#include <ppsi/ppsi.h>
+
+#define PP_LINE(x) (((x) + CONFIG_CACHE_LINE - 1) & ~(CONFIG_CACHE_LINE - 1))
+
+/* Allocates ppg->max_links instances, that are freed by pp_arena_free */
+int pp_arena_alloc(struct pp_globals *ppg)
+{
+	struct pp_instance *ppi;
+	size_t hot, cold, size;
+	void *arena;
+	char *p;
+	int i;
+
+	hot = PP_LINE(sizeof(DSPort)) + 2 * PP_LINE(PP_MAX_FRAME_LENGTH);
+	cold = PP_NR_FOREIGN_RECORDS * sizeof(struct pp_frgn_master);
+	size = ppg->max_links * (sizeof(*ppi) + hot + cold);
+
+	/* Not posix_memalign(): calloc() clears it, without our own memset() */
+	arena = calloc(1, size + CONFIG_CACHE_LINE - 1);
+	if (!arena)
+		return -1;
+	ppg->arena = arena;
+	ppg->pp_instances = (void *)PP_LINE((unsigned long)arena);
+	p = (char *)(ppg->pp_instances + ppg->max_links);
+	for (i = 0; i < ppg->max_links; i++, p += hot) {
+		ppi = INST(ppg, i);
+		ppi->portDS = (void *)p;
+		ppi->__tx_buffer = p + PP_LINE(sizeof(DSPort));
+		ppi->__rx_buffer = p + PP_LINE(sizeof(DSPort))
+			+ PP_LINE(PP_MAX_FRAME_LENGTH);
+	}
+	for (i = 0; i < ppg->max_links; i++) {
+		ppi = INST(ppg, i);
+		ppi->frgn_master = (void *)p;
+		p += PP_NR_FOREIGN_RECORDS * sizeof(struct pp_frgn_master);
+	}
+	return 0;
+}
+
+void pp_arena_free(struct pp_globals *ppg)
+{
+	free(ppg->arena);
+	ppg->arena = NULL;
+	ppg->pp_instances = NULL;
+}
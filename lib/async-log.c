@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Asynchronous log output, for hosted architectures ("log-queue" item).
+ * pp_puts() only copies the text to a queue of lines, and a writer thread
+ * sends them to stdout, so a slow reader of our output (a pipe to syslog,
+ * a serial console) never stalls the state machines.
+ *
+ * Single producer (the protocol thread), single consumer (the writer).
+ * When the queue is full, the producer drops the oldest line: both sides
+ * move "tail" with compare-and-swap, and the consumer discards its copy
+ * of a line if the producer dropped it (and maybe rewrote it) meanwhile.
+ */
+#include <ppsi/ppsi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define PP_LOG_LINE	248
+
+struct pp_log_line {
+	int len;
+	char s[PP_LOG_LINE];
+};
+
+struct pp_log_queue {
+	unsigned nlines;
+	uint64_t head;			/* written by the producer */
+	uint64_t tail;			/* both sides, with CAS */
+	uint64_t dropped;		/* lines, never reset */
+	int stop;
+	pthread_t writer;
+	struct pp_log_line cur;		/* being built, producer only */
+	struct pp_log_line *lines;
+};
+
+/* Like stdout, this is a process-wide resource */
+static struct pp_log_queue *logq;
+
+static void pp_log_push(struct pp_log_queue *q)
+{
+	uint64_t head = q->head;
+	uint64_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+	while (head - tail >= q->nlines) {
+		if (__atomic_compare_exchange_n(&q->tail, &tail, tail + 1, 0,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+			__atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	q->lines[head % q->nlines] = q->cur;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	q->cur.len = 0;
+}
+
+/* Returns 1 if the string has been queued, 0 if logging is synchronous */
+int pp_log_puts(const char *s)
+{
+	struct pp_log_queue *q = logq;
+
+	if (!q)
+		return 0;
+	/* A queued line is a whole line, or a full buffer */
+	for (; *s; s++) {
+		q->cur.s[q->cur.len++] = *s;
+		if (*s == '\n' || q->cur.len == PP_LOG_LINE)
+			pp_log_push(q);
+	}
+	return 1;
+}
+
+static void *pp_log_writer(void *arg)
+{
+	struct pp_log_queue *q = arg;
+	struct pp_log_line l;
+	uint64_t head, tail, dropped, reported = 0;
+
+	while (1) {
+		tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (tail == head) {
+			dropped = __atomic_load_n(&q->dropped,
+						  __ATOMIC_RELAXED);
+			if (dropped != reported) {
+				fprintf(stdout, "ppsi: dropped %lli log lines"
+					" (%lli total)\n",
+					(long long)(dropped - reported),
+					(long long)dropped);
+				reported = dropped;
+			}
+			if (__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE))
+				return NULL;
+			/* No wakeup from the producer: it must not block */
+			usleep(10 * 1000);
+			continue;
+		}
+		l = q->lines[tail % q->nlines];
+		if (!__atomic_compare_exchange_n(&q->tail, &tail, tail + 1, 0,
+						 __ATOMIC_ACQ_REL,
+						 __ATOMIC_ACQUIRE))
+			continue; /* dropped by the producer while we copied */
+		fwrite(l.s, 1, l.len, stdout);
+	}
+}
+
+/* At exit, flush what is queued (and the partial line) synchronously */
+static void pp_log_exit(void)
+{
+	struct pp_log_queue *q = logq;
+
+	__atomic_store_n(&q->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(q->writer, NULL);
+	logq = NULL;
+	fwrite(q->cur.s, 1, q->cur.len, stdout);
+}
+
+/* Global config item: "log-queue <lines>" (0, the default, is synchronous) */
+int f_log_queue(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		union pp_cfg_arg *arg)
+{
+	struct pp_log_queue *q;
+	int err;
+
+	if (arg->i < 0) {
+		pp_printf("config line %i: wrong queue length %i\n", lineno,
+			  arg->i);
+		return -1;
+	}
+	if (logq || !arg->i)
+		return 0; /* can't change it at run time, nor stop it */
+	q = calloc(1, sizeof(*q));
+	if (q)
+		q->lines = calloc(arg->i, sizeof(*q->lines));
+	if (!q || !q->lines) {
+		pp_printf("config line %i: out of memory\n", lineno);
+		free(q);
+		return -1;
+	}
+	q->nlines = arg->i;
+	err = pthread_create(&q->writer, NULL, pp_log_writer, q);
+	if (err) {
+		pp_printf("config line %i: pthread_create(): %s\n", lineno,
+			  strerror(err));
+		free(q->lines);
+		free(q);
+		return -1;
+	}
+	logq = q;
+	atexit(pp_log_exit);
+	return 0;
+}
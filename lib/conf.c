@@ -99,7 +99,7 @@ static int f_diag(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 	if (ppg->cfg.cur_ppi_n >= 0)
 		CUR_PPI(ppg)->d_flags = level;
 	else
-		pp_global_d_flags = level;
+		ppg->d_flags = level;
 	return 0;
 }
 
@@ -157,9 +157,9 @@ static int f_vlan(struct pp_argline *l, int lineno, struct pp_globals *ppg,
 	ppi->nvlans = n + 1; /* item "n" has been assigend too, 0-based */
 
 	for (i = 0; i < ppi->nvlans; i++)
-		pp_diag(NULL, config, 2, "  parsed vlan %4i for %s (%s)\n",
+		pp_diag(ppi, config, 2, "  parsed vlan %4i for %s (%s)\n",
 			ppi->vlans[i], ppi->cfg.port_name, ppi->cfg.iface_name);
-	pp_diag(NULL, config, 2, "role %i\n", ppi->role);
+	pp_diag(ppi, config, 2, "role %i\n", ppi->role);
 	if (ppi->role != PPSI_ROLE_MASTER && ppi->nvlans > 1) {
 		pp_printf("config line %i: too many vlans (%i) for slave "
 			  "or auto role\n", lineno, ppi->nvlans);
@@ -199,6 +199,22 @@ static int f_announce_intvl(struct pp_argline *l, int lineno,
 	return 0;
 }
 
+static int f_dreq_backoff(struct pp_argline *l, int lineno,
+			  struct pp_globals *ppg, union pp_cfg_arg *arg)
+{
+	int i = arg->i;
+
+	CHECK_PPI(1);
+	/* More would overflow the randomized timeout (see timeout.c) */
+	if (i < 0 || i > 6) {
+		i = i < 0 ? 0 : 6;
+		pp_printf("config line %i: delay-req-backoff out of range: %i, "
+			  "forced to %i\n", lineno, arg->i, i);
+	}
+	CUR_PPI(ppg)->cfg.dreq_backoff = i;
+	return 0;
+}
+
 /* These are the tables for the parser */
 static struct pp_argname arg_proto[] = {
 	{"raw", PPSI_PROTO_RAW},
@@ -217,6 +233,13 @@ static struct pp_argname arg_ext[] = {
 	{"whiterabbit", PPSI_EXT_WR},
 	{},
 };
+static struct pp_argname arg_servo[] = {
+	{"pi", PPSI_SERVO_PI},
+	{"linreg", PPSI_SERVO_LINREG},
+	{"kalman", PPSI_SERVO_KALMAN},
+	{"sync-only", PPSI_SERVO_SYNC_ONLY},
+	{},
+};
 static struct pp_argname arg_mech[] = {
 	{"request-response", PP_E2E_MECH},
 	{"delay", PP_E2E_MECH},
@@ -237,6 +260,12 @@ static struct pp_argline pp_global_arglines[] = {
 	INST_OPTION_INT("role", ARG_NAMES, arg_role, role),
 	INST_OPTION_INT("extension", ARG_NAMES, arg_ext, cfg.ext),
 	INST_OPTION_INT("mechanism", ARG_NAMES, arg_mech, cfg.mech),
+	INST_OPTION_INT("servo", ARG_NAMES, arg_servo, cfg.servo),
+	INST_OPTION_INT("servo-window", ARG_INT, NULL, cfg.servo_window),
+	INST_OPTION_INT("servo-percentile", ARG_INT, NULL,
+			cfg.servo_percentile),
+	INST_OPTION_INT("hybrid", ARG_INT, NULL, cfg.hybrid),
+	LEGACY_OPTION(f_dreq_backoff, "delay-req-backoff", ARG_INT),
 	LEGACY_OPTION(f_vlan, "vlan", ARG_STR),
 	LEGACY_OPTION(f_diag, "diagnostic", ARG_STR),
 	RT_OPTION_INT("clock-class", ARG_INT, NULL, clock_quality.clockClass),
@@ -248,6 +277,7 @@ static struct pp_argline pp_global_arglines[] = {
 	RT_OPTION_INT("domain-number", ARG_INT, NULL, domain_number),
 	LEGACY_OPTION(f_announce_intvl, "announce-interval", ARG_INT),
 	RT_OPTION_INT("sync-interval", ARG_INT, NULL, sync_intvl),
+	RT_OPTION_INT("one-step", ARG_INT, NULL, one_step),
 	RT_OPTION_INT("priority1", ARG_INT, NULL, prio1),
 	RT_OPTION_INT("priority2", ARG_INT, NULL, prio2),
 	{}
@@ -356,7 +386,7 @@ static int pp_config_line(struct pp_globals *ppg, char *line, int lineno)
 	struct pp_argname *n;
 	char *word;
 
-	pp_diag(NULL, config, 2, "parsing line %i: \"%s\"\n", lineno, line);
+	pp_global_diag(ppg, config, 2, "parsing line %i: \"%s\"\n", lineno, line);
 	word = first_word(line, &line);
 	/* now line points to the next word, with no leading blanks */
 
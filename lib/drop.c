@@ -6,14 +6,7 @@
  */
 #include <ppsi/ppsi.h>
 
-/* Always rx before tx (alphabetic) */
-struct ppsi_drop {
-	unsigned long rxrand, txrand;
-	int rxrate, txrate;
-};
-
-static struct ppsi_drop d;
-
+/* The state is in the globals, so each ppsi instance has its own */
 static inline unsigned long drop_this(unsigned long *p, int rate)
 {
 	/* hash the value, according to the TYPE_0 rule of glibc */
@@ -24,24 +17,22 @@ static inline unsigned long drop_this(unsigned long *p, int rate)
 
 void ppsi_drop_init(struct pp_globals *ppg, unsigned long seed)
 {
-	/* lazily, avoid passing globals every time */
-	d.rxrand = seed;
-	d.txrand = seed + 1;
-	d.rxrate = ppg->rxdrop;
-	d.txrate = ppg->txdrop;
+	/* Always rx before tx (alphabetic) */
+	ppg->rxrand = seed;
+	ppg->txrand = seed + 1;
 }
 
-int ppsi_drop_rx(void)
+int ppsi_drop_rx(struct pp_globals *ppg)
 {
-	if (d.rxrate)
-		return drop_this(&d.rxrand, d.rxrate);
+	if (ppg->rxdrop)
+		return drop_this(&ppg->rxrand, ppg->rxdrop);
 	return 0;
 }
 
-int ppsi_drop_tx(void)
+int ppsi_drop_tx(struct pp_globals *ppg)
 {
-	if (d.txrate)
-		return drop_this(&d.txrand, d.txrate);
+	if (ppg->txdrop)
+		return drop_this(&ppg->txrand, ppg->txdrop);
 	return 0;
 }
 
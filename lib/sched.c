@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Deadline scheduler for hosted main loops. Each state machine sets
+ * the deadline of its next run (ppi->next_deadline, which already folds
+ * the timeouts that matter in its state), so the heap is keyed by instance:
+ * the main loop sleeps until the earliest deadline and runs only the
+ * instances that expired, instead of all of them at every wakeup.
+ */
+#include <ppsi/ppsi.h>
+
+/* PP_SCHED_NEVER is ~0: the signed difference would make it the earliest */
+static inline int sched_before(struct pp_instance *a, struct pp_instance *b)
+{
+	if (a->sched_wakeup == PP_SCHED_NEVER)
+		return 0;
+	if (b->sched_wakeup == PP_SCHED_NEVER)
+		return 1;
+	return (int64_t)(a->sched_wakeup - b->sched_wakeup) < 0;
+}
+
+/* sched_pos is 1-based, so 0 (the calloc default) means "not queued" */
+static void sched_put(struct pp_sched *s, int pos, struct pp_instance *ppi)
+{
+	s->heap[pos] = ppi;
+	ppi->sched_pos = pos + 1;
+}
+
+static void sched_up(struct pp_sched *s, int pos)
+{
+	struct pp_instance *ppi = s->heap[pos];
+	int parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (!sched_before(ppi, s->heap[parent]))
+			break;
+		sched_put(s, pos, s->heap[parent]);
+		pos = parent;
+	}
+	sched_put(s, pos, ppi);
+}
+
+static void sched_down(struct pp_sched *s, int pos)
+{
+	struct pp_instance *ppi = s->heap[pos];
+	int child;
+
+	while ((child = 2 * pos + 1) < s->n) {
+		if (child + 1 < s->n &&
+		    sched_before(s->heap[child + 1], s->heap[child]))
+			child++;
+		if (!sched_before(s->heap[child], ppi))
+			break;
+		sched_put(s, pos, s->heap[child]);
+		pos = child;
+	}
+	sched_put(s, pos, ppi);
+}
+
+/* (Re)schedule an instance, at a calc_timeout() time */
+void pp_sched_set(struct pp_sched *s, struct pp_instance *ppi, uint64_t wakeup)
+{
+	int pos = ppi->sched_pos - 1;
+
+	ppi->sched_wakeup = wakeup;
+	if (pos < 0) {
+		pos = s->n++;
+		s->heap[pos] = ppi;
+	}
+	sched_up(s, pos);
+	sched_down(s, ppi->sched_pos - 1);
+}
+
+/* The earliest deadline, for check_packet */
+uint64_t pp_sched_next(struct pp_sched *s)
+{
+	return s->n ? s->heap[0]->sched_wakeup : PP_SCHED_NEVER;
+}
+
+/* Remove and return one expired instance, NULL if none is left */
+struct pp_instance *pp_sched_expired(struct pp_sched *s)
+{
+	struct pp_instance *ppi;
+	uint64_t now;
+
+	if (!s->n)
+		return NULL;
+	ppi = s->heap[0];
+	if (ppi->sched_wakeup == PP_SCHED_NEVER)
+		return NULL; /* and so are all the others */
+	now = ppi->t_ops->calc_timeout(ppi, 0);
+	if ((int64_t)(now - ppi->sched_wakeup) < 0)
+		return NULL;
+	ppi->sched_pos = 0;
+	if (--s->n) {
+		s->heap[0] = s->heap[s->n];
+		sched_down(s, 0);
+	}
+	return ppi;
+}
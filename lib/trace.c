@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Binary trace ring, in a shared file so tools/ppsi-trace can read it
+ * while we run. This file is only built in hosted environments.
+ */
+#include <ppsi/ppsi.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+/* Global config item: "trace-file <name>" */
+int f_trace_file(struct pp_argline *l, int lineno, struct pp_globals *ppg,
+		 union pp_cfg_arg *arg)
+{
+	struct pp_trace_ring *ring;
+	uint32_t nrec = 1 << CONFIG_TRACE_SHIFT;
+	size_t size = sizeof(*ring) + nrec * sizeof(ring->rec[0]);
+	int fd;
+
+	if (!CONFIG_TRACE_SHIFT) {
+		pp_printf("config line %i: trace ring not built in\n", lineno);
+		return -1;
+	}
+	if (ppg->trace) {
+		pp_printf("config line %i: trace file already set\n", lineno);
+		return -1;
+	}
+	fd = open(arg->s, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		pp_printf("config line %i: %s: %s\n", lineno, arg->s,
+			  strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED) {
+		pp_printf("config line %i: mmap(%s): %s\n", lineno, arg->s,
+			  strerror(errno));
+		return -1;
+	}
+	/* ftruncate zeroed it all: port names are filled at first use */
+	ring->version = PP_TRACE_VERSION;
+	ring->recsize = sizeof(ring->rec[0]);
+	ring->nrec = nrec;
+	__atomic_store_n(&ring->magic, PP_TRACE_MAGIC, __ATOMIC_RELEASE);
+	ppg->trace = ring;
+	return 0;
+}
+
+/* Single writer, no locks: the reader validates each record with seq */
+int __pp_trace(struct pp_instance *ppi, int id, const char *name,
+	       const int64_t *args, int nargs)
+{
+	struct pp_globals *ppg = GLBS(ppi);
+	struct pp_trace_ring *ring = ppg->trace;
+	uint64_t head = ring->head;
+	struct pp_trace_rec *r = ring->rec + (head & (ring->nrec - 1));
+	int port = ppi - ppg->pp_instances;
+	int i = 0;
+
+	if (!ring->port_name[port][0])
+		strncpy(ring->port_name[port], ppi->port_name,
+			PP_TRACE_NAMELEN - 1);
+
+	__atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	r->ns = ppi->t_ops->calc_timeout(ppi, 0);
+	r->id = id;
+	r->port = port;
+	if (name) {
+		strncpy((char *)r->arg, name, PP_TRACE_NAMELEN);
+		i = PP_TRACE_NAMELEN / sizeof(r->arg[0]);
+	}
+	while (nargs-- && i < PP_TRACE_NARGS)
+		r->arg[i++] = *args++;
+	r->nargs = i;
+	/* 0 means "being written", so a wrapped seq skips one record */
+	__atomic_store_n(&r->seq, (uint32_t)(head + 1), __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
@@ -7,7 +7,12 @@
 #include <stdarg.h>
 #include <pp-printf.h>
 
+/* Hosted archs with threads may ask for one buffer per thread */
+#ifdef CONFIG_PRINT_BUF_PER_THREAD
+static __thread char print_buf[CONFIG_PRINT_BUFSIZE];
+#else
 static char print_buf[CONFIG_PRINT_BUFSIZE];
+#endif
 
 int pp_vprintf(const char *fmt, va_list args)
 {
@@ -27,7 +27,7 @@ static int wr_open(struct pp_globals *ppg, struct pp_runtime_opts *rt_opts)
 {
 	int i;
 
-	pp_diag(NULL, ext, 2, "hook: %s\n", __func__);
+	pp_global_diag(ppg, ext, 2, "hook: %s\n", __func__);
 	/* If current arch (e.g. wrpc) is not using the 'pp_links style'
 	 * configuration, just assume there is one ppi instance,
 	 * already configured properly by the arch's main loop */
@@ -39,8 +39,8 @@ static int wr_open(struct pp_globals *ppg, struct pp_runtime_opts *rt_opts)
 	for (i = 0; i < ppg->nlinks; i++) {
 		struct pp_instance *ppi = INST(ppg, i);
 
-		/* FIXME check if correct: assign to each instance the same
-		 * wr_data. May I move it to pp_globals? */
+		/* wr_data is the one servo exported to shmem; what each
+		 * port keeps across iterations is in its wr_dsport */
 		INST(ppg, i)->ext_data = ppg->global_ext_data;
 
 		if (ppi->cfg.ext == PPSI_EXT_WR) {
@@ -253,7 +253,6 @@ static void wr_unpack_announce(void *buf, MsgAnnounce *ann)
 {
 	int msg_len = htons(*(UInteger16 *) (buf + 2));
 
-	pp_diag(NULL, ext, 2, "hook: %s\n", __func__);
 	if (msg_len > PP_ANNOUNCE_LENGTH)
 		msg_unpack_announce_wr_tlv(buf, ann);
 }
@@ -11,8 +11,12 @@
 
 /* Please increment WRS_PPSI_SHMEM_VERSION if you change any exported data
  * structure */
-#define WRS_PPSI_SHMEM_VERSION 20 /* Replace cField, t4_cf and t6_cf with
-				     syncCF */
+#define WRS_PPSI_SHMEM_VERSION 21 /* pp_instance: unicast and parent
+				     addresses, timeouts as uint64_t,
+				     dreq_backoff, frgn_master by pointer,
+				     cache-line aligned; pp_servo: delay
+				     window, linreg and Kalman state;
+				     wr_dsport: servo counters */
 
 /* Don't include the Following when this file is included in assembler. */
 #ifndef __ASSEMBLY__
@@ -53,6 +57,10 @@ struct wr_dsport {
 	FixedDelta otherNodeDeltaRx;
 	Boolean doRestart;
 	Boolean linkUP;
+
+	/* Private to the servo, across iterations */
+	int got_sync;
+	int delay_errcount, offset_errcount;
 };
 
 /* This uppercase name matches "DSPOR(ppi)" used by standard protocol */
@@ -112,8 +112,6 @@ static void ts_hardwarize(struct pp_time *time, int clock_period_ps,
 
 /* end my own timestamp arithmetic functions */
 
-static int got_sync = 0;
-
 void wr_servo_reset(struct pp_instance *ppi)
 {
 	/* values from servo_state to be preserved */
@@ -185,7 +183,7 @@ int wr_servo_init(struct pp_instance *ppi)
 	s->update_count = 0;
 	s->tracking_enabled = tracking_enabled;
 
-	got_sync = 0;
+	WR_DSPOR(ppi)->got_sync = 0;
 
 	/* shmem unlock */
 	wrs_shm_write(ppsi_head, WRS_SHM_WRITE_END);
@@ -200,7 +198,7 @@ int wr_servo_got_sync(struct pp_instance *ppi, struct pp_time *t1,
 
 	s->t1 = *t1;
 	s->t2 = *t2;
-	got_sync = 1;
+	WR_DSPOR(ppi)->got_sync = 1;
 	return 0;
 }
 
@@ -228,20 +226,20 @@ int wr_servo_got_delay(struct pp_instance *ppi)
 
 int wr_p2p_delay(struct pp_instance *ppi, struct wr_servo_state *s)
 {
+	int *errcount = &WR_DSPOR(ppi)->delay_errcount;
 	uint64_t big_delta_fix;
-	static int errcount;
 
 	if (is_incorrect(&s->t3) || is_incorrect(&s->t4)
 	    || is_incorrect(&s->t5) || is_incorrect(&s->t6)) {
-		errcount++;
-		if (errcount > 5)	/* a 2-3 in a row are expected */
+		(*errcount)++;
+		if (*errcount > 5)	/* a 2-3 in a row are expected */
 			pp_error("%s: TimestampsIncorrect: %d %d %d %d\n",
 				 __func__, !is_incorrect(&s->t3),
 				 !is_incorrect(&s->t4), !is_incorrect(&s->t5),
 				 !is_incorrect(&s->t6));
 		return 0;
 	}
-	errcount = 0;
+	*errcount = 0;
 
 	s->update_count++;
 
@@ -280,19 +278,19 @@ int wr_p2p_delay(struct pp_instance *ppi, struct wr_servo_state *s)
 int wr_p2p_offset(struct pp_instance *ppi,
 		  struct wr_servo_state *s, struct pp_time *ts_offset)
 {
-	static int errcount;
+	int *errcount = &WR_DSPOR(ppi)->offset_errcount;
 	struct pp_time time_ms;
 
 	if (is_incorrect(&s->t1) || is_incorrect(&s->t2)) {
-		errcount++;
-		if (errcount > 5)	/* a 2-3 in a row are expected */
+		(*errcount)++;
+		if (*errcount > 5)	/* a 2-3 in a row are expected */
 			pp_error("%s: TimestampsIncorrect: %d %d \n",
 				 __func__, !is_incorrect(&s->t1),
 				 !is_incorrect(&s->t2));
 		return 0;
 	}
-	errcount = 0;
-	got_sync = 0;
+	*errcount = 0;
+	WR_DSPOR(ppi)->got_sync = 0;
 
 	s->update_count++;
 
@@ -316,12 +314,12 @@ int wr_e2e_offset(struct pp_instance *ppi,
 	struct wr_dsport *wrp = WR_DSPOR(ppi);
 	uint64_t big_delta_fix;
 	uint64_t delay_ms_fix;
-	static int errcount;
+	int *errcount = &WR_DSPOR(ppi)->offset_errcount;
 
 	if (is_incorrect(&s->t1) || is_incorrect(&s->t2)
 	    || is_incorrect(&s->t3) || is_incorrect(&s->t4)) {
-		errcount++;
-		if (errcount > 5) /* a 2-3 in a row are expected */
+		(*errcount)++;
+		if (*errcount > 5) /* a 2-3 in a row are expected */
 			pp_error("%s: TimestampsIncorrect: %d %d %d %d\n",
 				 __func__, !is_incorrect(&s->t1),
 				 !is_incorrect(&s->t2), !is_incorrect(&s->t3),
@@ -332,12 +330,12 @@ int wr_e2e_offset(struct pp_instance *ppi,
 	if (wrp->ops->servo_hook) /* FIXME: check this, missing in p2p */
 		wrp->ops->servo_hook(s, WR_SERVO_ENTER);
 
-	errcount = 0;
+	*errcount = 0;
 
 	s->update_count++;
 	ppi->t_ops->get(ppi, &s->update_time); /* FIXME: missing in p2p */
 
-	got_sync = 0;
+	WR_DSPOR(ppi)->got_sync = 0;
 
 	{ /* avoid modifying stamps in place */
 		struct pp_time mtime, stime;
@@ -403,7 +401,7 @@ int wr_servo_update(struct pp_instance *ppi)
 	int32_t  ts_offset_picos;
 	int locking_poll_ret;
 
-	if (!got_sync)
+	if (!WR_DSPOR(ppi)->got_sync)
 		return 0;
 
 	/* shmem lock */
@@ -457,6 +455,8 @@ int wr_servo_update(struct pp_instance *ppi)
 
 	switch (s->state) {
 	case WR_SYNC_TAI:
+		pp_diag(ppi, time, 1, "Adjust: %lli s\n",
+			(long long)ts_offset.secs);
 		wrp->ops->adjust_counters(ts_offset.secs, 0);
 		s->flags |= WR_FLAG_WAIT_HW;
 		/*
@@ -468,6 +468,8 @@ int wr_servo_update(struct pp_instance *ppi)
 		break;
 
 	case WR_SYNC_NSEC:
+		pp_diag(ppi, time, 1, "Adjust: %i ticks\n",
+			(int)ts_offset_ticks);
 		wrp->ops->adjust_counters(0, ts_offset_ticks);
 		s->flags |= WR_FLAG_WAIT_HW;
 		s->state = WR_SYNC_PHASE;
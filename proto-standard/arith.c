@@ -56,3 +56,25 @@ void pp_time_div2(struct pp_time *t)
 		t->scaled_nsecs += sign * SNS_PER_S / 2;
 	t->secs >>= 1;
 }
+
+/*
+ * n * m / d, for d > 0, with no 64-bit division (see normalize above).
+ * The quotient must fit after multiplying by m; we may drop low bits of d.
+ */
+int64_t pp_muldiv(int64_t n, uint32_t m, int64_t d)
+{
+	int sign = n < 0 ? -1 : 1;
+	uint64_t q = n * sign, r;
+	uint64_t ud = d;
+
+	if (d <= 0)
+		return 0;
+	while (ud >> 32) {
+		ud >>= 1;
+		q >>= 1;
+	}
+	r = __div64_32(&q, ud);
+	r *= m;
+	__div64_32(&r, ud);
+	return sign * (int64_t)(q * m + r);
+}
@@ -107,6 +107,13 @@ int st_com_slave_handle_sync(struct pp_instance *ppi, unsigned char *buf,
 	if (!(ppi->flags & PPI_FLAG_FROM_CURRENT_PARENT))
 		return 0;
 
+	/* Hybrid mode: our Delay_Req goes where Sync comes from */
+	if (ppi->cfg.hybrid) {
+		ppi->parent_ip = ppi->peer_ip;
+		memcpy(ppi->parent_mac, ppi->peer, sizeof(ppi->parent_mac));
+		ppi->flags |= PPI_FLAG_PARENT_ADDR;
+	}
+
 	/* t2 may be overriden by follow-up, save it immediately */
 	ppi->t2 = ppi->last_rcv_time;
 	msg_unpack_sync(buf, &sync);
@@ -278,7 +285,7 @@ int st_com_slave_handle_followup(struct pp_instance *ppi, unsigned char *buf,
 
 /*
  * Called by master, listenting, passive.
- * FIXME: this must be implemented to support one-step masters
+ * One-step masters stamp their Sync in n_ops->send: nothing to do here.
  */
 int st_com_master_handle_sync(struct pp_instance *ppi, unsigned char *buf,
 			      int len)
@@ -291,6 +298,11 @@ int __send_and_log(struct pp_instance *ppi, int msglen, int chtype)
 {
 	int msgtype = ((char *)ppi->tx_ptp)[0] & 0xf;
 
+	/* Unicast (see pp_tx_unicast): flag it, with the chosen interval */
+	if (ppi->tx_ucast || ppi->tx_mac) {
+		((UInteger8 *)ppi->tx_ptp)[6] |= PP_UNICAST_FLAG;
+		((Integer8 *)ppi->tx_ptp)[33] = ppi->tx_ucast_log;
+	}
 	if (ppi->n_ops->send(ppi, ppi->tx_frame, msglen + ppi->tx_offset,
 			     msgtype) < msglen) {
 		pp_diag(ppi, frames, 1, "%s(%d) Message can't be sent\n",
@@ -298,10 +310,13 @@ int __send_and_log(struct pp_instance *ppi, int msglen, int chtype)
 		return PP_SEND_ERROR;
 	}
 	/* FIXME: diagnosticst should be looped back in the send method */
-	pp_diag(ppi, frames, 1, "SENT %02d bytes at %d.%09d (%s)\n", msglen,
-		(int)(ppi->last_snt_time.secs),
-		(int)(ppi->last_snt_time.scaled_nsecs >> 16),
-		pp_msgtype_info[msgtype].name);
+	if (!pp_trace(ppi, FRAME_SENT, pp_msgtype_info[msgtype].name, msglen,
+		      ppi->last_snt_time.secs,
+		      ppi->last_snt_time.scaled_nsecs >> 16))
+		pp_diag(ppi, frames, 1, "SENT %02d bytes at %d.%09d (%s)\n",
+			msglen, (int)(ppi->last_snt_time.secs),
+			(int)(ppi->last_snt_time.scaled_nsecs >> 16),
+			pp_msgtype_info[msgtype].name);
 	if (chtype == PP_NP_EVT && is_incorrect(&ppi->last_snt_time))
 		return PP_SEND_NO_STAMP;
 
@@ -310,3 +325,41 @@ int __send_and_log(struct pp_instance *ppi, int msglen, int chtype)
 
 	return 0;
 }
+
+/* Same as above, for the copies of a message sent with n_ops->send_batch */
+int __send_batch_and_log(struct pp_instance *ppi, struct pp_tx_copy *c, int n,
+			 int chtype)
+{
+	int msgtype = ((char *)c[0].ptp)[0] & 0xf;
+	int i, sent;
+
+	/* The first copy not sent: all the ones before it were */
+	sent = ppi->n_ops->send_batch(ppi, c, n, msgtype);
+	if (sent < 0)
+		sent = 0;
+	/* The copies that didn't leave get no stamp, so no Follow Up */
+	for (i = sent; i < n; i++)
+		mark_incorrect(&c[i].t);
+	if (sent < n)
+		pp_diag(ppi, frames, 1, "%s(%d) Message can't be sent (%i/%i)\n",
+			pp_msgtype_info[msgtype].name, msgtype, sent, n);
+	if (!sent)
+		return PP_SEND_ERROR;
+	for (i = 0; i < sent; i++) {
+		if (!pp_trace(ppi, FRAME_SENT, pp_msgtype_info[msgtype].name,
+			      c[i].len, c[i].t.secs, c[i].t.scaled_nsecs >> 16))
+			pp_diag(ppi, frames, 1, "SENT %02d bytes at %d.%09d "
+				"(%s, vlan %i)\n", c[i].len,
+				(int)(c[i].t.secs),
+				(int)(c[i].t.scaled_nsecs >> 16),
+				pp_msgtype_info[msgtype].name, c[i].vid);
+		ppi->ptp_tx_count++;
+	}
+	ppi->last_snt_time = c[sent - 1].t;
+	if (sent < n)
+		return PP_SEND_ERROR;
+	for (i = 0; i < n; i++)
+		if (chtype == PP_NP_EVT && is_incorrect(&c[i].t))
+			return PP_SEND_NO_STAMP;
+	return 0;
+}
@@ -39,6 +39,28 @@ int st_com_peer_handle_pres_followup(struct pp_instance *ppi,
 				     unsigned char *buf, int len);
 
 int __send_and_log(struct pp_instance *ppi, int msglen, int chtype);
+int __send_batch_and_log(struct pp_instance *ppi, struct pp_tx_copy *c, int n,
+			 int chtype);
+
+/*
+ * The next frames go to one address only: ip with UDP, mac otherwise.
+ * __send_and_log then sets the unicast flag and this logMessageInterval.
+ */
+static inline void pp_tx_unicast(struct pp_instance *ppi, Integer32 ip,
+				 const unsigned char *mac, int log)
+{
+	if (ppi->proto == PPSI_PROTO_UDP)
+		ppi->tx_ucast = ip;
+	else
+		ppi->tx_mac = mac;
+	ppi->tx_ucast_log = log;
+}
+
+static inline void pp_tx_multicast(struct pp_instance *ppi)
+{
+	ppi->tx_ucast = 0;
+	ppi->tx_mac = NULL;
+}
 
 /* Count successfully received PTP packets */
 static inline int __recv_and_count(struct pp_instance *ppi, void *pkt, int len,
@@ -7,6 +7,7 @@
  * Released according to the GNU LGPL, version 2.1 or any later version.
  */
 #include <ppsi/ppsi.h>
+#include "common-fun.h"
 
 /* Local functions that build to nothing when Kconfig selects 0/1 vlans */
 static int pp_vlan_issue_announce(struct pp_instance *ppi)
@@ -23,8 +24,11 @@ static int pp_vlan_issue_announce(struct pp_instance *ppi)
 
 	/*
 	 * If Kconfig selected 0/1 vlans, this code is not built.
-	 * If we have several vlans, we replace peer_vid and proceed;
+	 * If we have several vlans, send them all at once if possible,
+	 * otherwise we replace peer_vid and proceed;
 	 */
+	if (ppi->n_ops->send_batch)
+		return msg_issue_announce_vlans(ppi);
 	for (i = 0; i < ppi->nvlans; i++) {
 		ppi->peer_vid = ppi->vlans[i];
 		msg_issue_announce(ppi);
@@ -47,8 +51,11 @@ static int pp_vlan_issue_sync_followup(struct pp_instance *ppi)
 
 	/*
 	 * If Kconfig selected 0/1 vlans, this code is not built.
-	 * If we have several vlans, we replace peer_vid and proceed;
+	 * If we have several vlans, send them all at once if possible,
+	 * otherwise we replace peer_vid and proceed;
 	 */
+	if (ppi->n_ops->send_batch)
+		return msg_issue_sync_followup_vlans(ppi);
 	for (i = 0; i < ppi->nvlans; i++) {
 		ppi->peer_vid = ppi->vlans[i];
 		msg_issue_sync_followup(ppi);
@@ -99,7 +106,15 @@ int pp_lib_may_issue_request(struct pp_instance *ppi)
 		return 0;
 
 	pp_timeout_set(ppi, PP_TO_REQUEST);
+	/* The sync-only servo never asks for the path delay (nor Pdelay) */
+	if (ppi->cfg.servo == PPSI_SERVO_SYNC_ONLY)
+		return 0;
+	/* Hybrid mode: Delay_Req goes to our master only */
+	if (ppi->cfg.hybrid && ppi->mech == PP_E2E_MECH
+	    && (ppi->flags & PPI_FLAG_PARENT_ADDR))
+		pp_tx_unicast(ppi, ppi->parent_ip, ppi->parent_mac, 0x7f);
 	e = msg_issue_request(ppi); /* FIXME: what about multiple vlans? */
+	pp_tx_multicast(ppi);
 	ppi->t3 = ppi->last_snt_time;
 	if (e == PP_SEND_ERROR) {
 		pp_diag(ppi, frames, 1, "could not send request\n");
@@ -107,7 +107,7 @@ static int msg_pack_sync(struct pp_instance *ppi, struct pp_time *orig_tstamp)
 
 	ppi->sent_seq[PPM_SYNC]++;
 	/* Header */
-	flags8[0] = PP_TWO_STEP_FLAG; /* Table 20 */
+	flags8[0] = DSDEF(ppi)->twoStepFlag ? PP_TWO_STEP_FLAG : 0; /* Table 20 */
 	*(UInteger16 *) (buf + 30) = htons(ppi->sent_seq[PPM_SYNC]);
 
 	/* Sync message */
@@ -218,6 +218,29 @@ void msg_unpack_announce(void *buf, MsgAnnounce *ann)
 		pp_hooks.unpack_announce(buf, ann);
 }
 
+/* The stamp of a Follow Up (or one-step Sync), also to patch copies */
+static void msg_set_follow_up_stamp(void *buf, struct pp_time *prec_orig_tstamp)
+{
+	*(UInteger16 *)(buf + 34) = htons(prec_orig_tstamp->secs >> 32);
+	*(UInteger32 *)(buf + 36) = htonl(prec_orig_tstamp->secs);
+	*(UInteger32 *)(buf + 40) = htonl(prec_orig_tstamp->scaled_nsecs >> 16);
+	/* Fractional part in cField */
+	*(UInteger32 *)(buf + 12) =
+		htonl(prec_orig_tstamp->scaled_nsecs & 0xffff);
+}
+
+/*
+ * One-step Sync: n_ops->send calls this with the send stamp, right before
+ * the frame leaves, so the Sync carries it. Other frames are not touched.
+ */
+void msg_set_one_step_stamp(void *buf, int msgtype, struct pp_time *t)
+{
+	if (msgtype != PPM_SYNC
+	    || (*(UInteger8 *)(buf + 6) & PP_TWO_STEP_FLAG))
+		return;
+	msg_set_follow_up_stamp(buf, t);
+}
+
 /* Pack Follow Up message into out buffer of ppi*/
 static int msg_pack_follow_up(struct pp_instance *ppi,
 			       struct pp_time *prec_orig_tstamp)
@@ -229,12 +252,7 @@ static int msg_pack_follow_up(struct pp_instance *ppi,
 	*(UInteger16 *) (buf + 30) = htons(ppi->sent_seq[PPM_SYNC]);
 
 	/* Follow Up message */
-	*(UInteger16 *)(buf + 34) = htons(prec_orig_tstamp->secs >> 32);
-	*(UInteger32 *)(buf + 36) = htonl(prec_orig_tstamp->secs);
-	*(UInteger32 *)(buf + 40) = htonl(prec_orig_tstamp->scaled_nsecs >> 16);
-	/* Fractional part in cField */
-	*(UInteger32 *)(buf + 12) =
-		htonl(prec_orig_tstamp->scaled_nsecs & 0xffff);
+	msg_set_follow_up_stamp(buf, prec_orig_tstamp);
 	return len;
 }
 
@@ -485,13 +503,74 @@ int msg_issue_sync_followup(struct pp_instance *ppi)
 	ppi->t_ops->get(ppi, &now);
 	len = msg_pack_sync(ppi, &now);
 	e = __send_and_log(ppi, len, PP_NP_EVT);
-	if (e) return e;
+	if (e)
+		return e;
+	if (!DSDEF(ppi)->twoStepFlag)
+		return 0; /* one-step: the Sync got its stamp in n_ops->send */
 
 	/* Send followup on general channel with sent-stamp of sync */
 	len = msg_pack_follow_up(ppi, &ppi->last_snt_time);
 	return __send_and_log(ppi, len, PP_NP_GEN);
 }
 
+/*
+ * Same as the two above, but on all vlans at once (n_ops->send_batch).
+ * The copies share the sequenceId, and each Follow Up carries the
+ * stamp of the Sync sent on its own vlan.
+ */
+int msg_issue_announce_vlans(struct pp_instance *ppi)
+{
+	struct pp_tx_copy c[CONFIG_VLAN_ARRAY_SIZE];
+	int i, len;
+
+	if (CONFIG_VLAN_ARRAY_SIZE <= 1) /* not built, like the caller */
+		return msg_issue_announce(ppi);
+	len = msg_pack_announce(ppi);
+	for (i = 0; i < ppi->nvlans; i++) {
+		c[i].ptp = ppi->tx_ptp;
+		c[i].len = len;
+		c[i].vid = ppi->vlans[i];
+	}
+	return __send_batch_and_log(ppi, c, ppi->nvlans, PP_NP_GEN);
+}
+
+int msg_issue_sync_followup_vlans(struct pp_instance *ppi)
+{
+	struct pp_tx_copy c[CONFIG_VLAN_ARRAY_SIZE];
+	uint32_t fup[CONFIG_VLAN_ARRAY_SIZE][PP_FOLLOW_UP_LENGTH / 4];
+	struct pp_time now;
+	int i, n, e, len;
+
+	if (CONFIG_VLAN_ARRAY_SIZE <= 1) /* not built, like the caller */
+		return msg_issue_sync_followup(ppi);
+	ppi->t_ops->get(ppi, &now);
+	len = msg_pack_sync(ppi, &now);
+	for (i = 0; i < ppi->nvlans; i++) {
+		c[i].ptp = ppi->tx_ptp;
+		c[i].len = len;
+		c[i].vid = ppi->vlans[i];
+	}
+	e = __send_batch_and_log(ppi, c, ppi->nvlans, PP_NP_EVT);
+	if (!DSDEF(ppi)->twoStepFlag)
+		return e;
+
+	/* Each vlan is separate: a Follow Up for each Sync that has a stamp */
+	len = msg_pack_follow_up(ppi, &c[0].t);
+	for (i = n = 0; i < ppi->nvlans; i++) {
+		if (is_incorrect(&c[i].t))
+			continue;
+		memcpy(fup[n], ppi->tx_ptp, len);
+		msg_set_follow_up_stamp(fup[n], &c[i].t);
+		c[n].ptp = fup[n];
+		c[n].len = len;
+		c[n].vid = c[i].vid;
+		n++;
+	}
+	if (!n)
+		return e;
+	return __send_batch_and_log(ppi, c, n, PP_NP_GEN) ?: e;
+}
+
 /* Pack and send on general multicast ip address a FollowUp message */
 int msg_issue_pdelay_resp_followup(struct pp_instance *ppi, struct pp_time *t)
 {
@@ -42,8 +42,6 @@ int pp_init_globals(struct pp_globals *ppg, struct pp_runtime_opts *pp_rt_opts)
 	 */
 	int i;
 	struct DSDefault *def = ppg->defaultDS;
-	def->twoStepFlag = TRUE;
-
 	/* if ppg->nlinks == 0, let's assume that the 'pp_links style'
 	 * configuration was not used, so we have 1 port */
 	def->numberPorts = ppg->nlinks > 0 ? ppg->nlinks : 1;
@@ -53,6 +51,7 @@ int pp_init_globals(struct pp_globals *ppg, struct pp_runtime_opts *pp_rt_opts)
 		ppg->rt_opts = pp_rt_opts;
 
 	rt_opts = ppg->rt_opts;
+	def->twoStepFlag = !rt_opts->one_step;
 
 	memcpy(&def->clockQuality, &rt_opts->clock_quality,
 		   sizeof(ClockQuality));
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Kalman servo ("servo kalman" in config). The state is our offset from
+ * master (theta, ns) and our frequency error (gamma, ppb), the offsets
+ * we compute are noisy measures of theta. After each update we set the
+ * frequency to cancel gamma and remove theta over a few sync intervals.
+ *
+ * Like the rest of ppsi this is integer math; the covariance is in Q8.
+ */
+#include <ppsi/ppsi.h>
+
+#define KF_SHIFT	8
+#define KF_R		(1000LL * 1000)	/* measure noise, ns^2: 1us rms */
+#define KF_Q_THETA	100LL		/* process noise, ns^2 per second */
+#define KF_Q_GAMMA	1LL		/* process noise, ppb^2 per second */
+#define KF_P_GAMMA	(10LL * 1000 * 10 * 1000) /* initial: 10ppm rms */
+#define KF_SAMPLES	4		/* remove the offset in this many */
+#define KF_US_PER_S	(1000 * 1000)
+
+static void kf_init(struct pp_instance *ppi, int freq)
+{
+	struct pp_servo_kf *kf = &SRV(ppi)->kf;
+
+	kf->started = 0;
+	kf->freq = freq;
+	pp_diag(ppi, servo, 1, "Initialized: kalman, freq %i\n", freq);
+}
+
+static int kf_sample(struct pp_instance *ppi, struct pp_time *ofm,
+		     struct pp_time *t)
+{
+	struct pp_servo_kf *kf = &SRV(ppi)->kf;
+	int64_t x = pp_time_to_ns(t), z = pp_time_to_ns(ofm);
+	int64_t dt, us, k0, k1, innov, freq;
+
+	if (!kf->started) {
+		kf->started = 1;
+		kf->last = x;
+		kf->theta = z;
+		kf->gamma = 0;
+		kf->p00 = KF_R << KF_SHIFT;
+		kf->p01 = 0;
+		kf->p11 = KF_P_GAMMA << KF_SHIFT;
+		return kf->freq;
+	}
+	/* With more Delay_Req than Sync, we get the same t1/t2 again */
+	dt = x - kf->last;
+	if (dt <= 0)
+		return kf->freq;
+	kf->last = x;
+	/* In us: ms are too coarse at 128 Sync per second */
+	us = pp_muldiv(dt, 1, 1000);
+	if (us < 1)
+		us = 1;
+
+	/* Predict: theta moves by gamma, and we are less sure of it */
+	kf->theta += pp_muldiv(kf->gamma * us, 1, KF_US_PER_S);
+	kf->p00 += pp_muldiv(2 * kf->p01, us, KF_US_PER_S)
+		+ pp_muldiv(pp_muldiv(kf->p11, us, KF_US_PER_S), us,
+			    KF_US_PER_S)
+		+ pp_muldiv(KF_Q_THETA << KF_SHIFT, us, KF_US_PER_S);
+	kf->p01 += pp_muldiv(kf->p11, us, KF_US_PER_S);
+	kf->p11 += pp_muldiv(KF_Q_GAMMA << KF_SHIFT, us, KF_US_PER_S);
+
+	/* Update, with gains in Q16 */
+	k0 = pp_muldiv(kf->p00, 1 << 16, kf->p00 + (KF_R << KF_SHIFT));
+	k1 = pp_muldiv(kf->p01, 1 << 16, kf->p00 + (KF_R << KF_SHIFT));
+	innov = z - kf->theta;
+	kf->theta += (k0 * innov) >> 16;
+	kf->gamma += (k1 * innov) >> 16;
+	kf->p11 -= (k1 * kf->p01) >> 16;
+	kf->p01 -= (k0 * kf->p01) >> 16;
+	kf->p00 -= (k0 * kf->p00) >> 16;
+
+	/* Control: our frequency error then becomes what removes theta */
+	freq = kf->freq - kf->gamma
+		- pp_muldiv(kf->theta, PP_NSEC_PER_SEC, dt * KF_SAMPLES);
+	if (freq > PP_ADJ_FREQ_MAX)
+		freq = PP_ADJ_FREQ_MAX;
+	if (freq < -PP_ADJ_FREQ_MAX)
+		freq = -PP_ADJ_FREQ_MAX;
+	kf->gamma += freq - kf->freq;
+	kf->freq = freq;
+
+	pp_diag(ppi, servo, 2, "kalman: theta %lli, gamma %lli, freq %lli\n",
+		(long long)kf->theta, (long long)kf->gamma, (long long)freq);
+	return freq;
+}
+
+struct pp_servo_ops pp_servo_kalman = {
+	.init = kf_init,
+	.sample = kf_sample,
+};
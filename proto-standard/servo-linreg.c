@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Linear-regression servo ("servo linreg" in config). We fit a line to
+ * the last offsets from master, as a function of our own time (t2): the
+ * slope is our frequency error, so we cancel it, and then remove the
+ * offset of the line (now) over a few sync intervals.
+ *
+ * The samples in the window have been taken with older frequencies:
+ * whenever we change it, we move them as if we always ran at the new one.
+ *
+ * The sync-only servo uses the same fit, on t2 - t1 as there is no path
+ * delay, and only cancels the slope: the offset of the line is unknown.
+ */
+#include <ppsi/ppsi.h>
+
+#define LR_SHIFT	10	/* x is in units of 1024ns in the sums */
+#define LR_SAMPLES	4	/* remove the offset in this many samples */
+
+static void lr_init(struct pp_instance *ppi, int freq)
+{
+	struct pp_servo_lr *lr = &SRV(ppi)->lr;
+
+	lr->n = lr->head = 0;
+	lr->freq = freq;
+	pp_diag(ppi, servo, 1, "Initialized: linreg, freq %i\n", freq);
+}
+
+/* Fit and steer; "samples" is how fast the offset is removed, 0 for never */
+static int lr_fit(struct pp_instance *ppi, struct pp_time *ofm,
+		  struct pp_time *t, int samples)
+{
+	struct pp_servo_lr *lr = &SRV(ppi)->lr;
+	int64_t x = pp_time_to_ns(t), y = pp_time_to_ns(ofm);
+	int64_t sx = 0, sy = 0, sxx = 0, sxy = 0, u, v, mu, my;
+	int64_t slope, offset, span, freq, df;
+	int i, n, last, oldest;
+
+	/* With more Delay_Req than Sync, we get the same t1/t2 again */
+	last = (lr->head ? lr->head : PP_SERVO_LR_WINDOW) - 1;
+	if (lr->n && lr->x[last] == x)
+		return lr->freq;
+
+	lr->x[lr->head] = x;
+	lr->y[lr->head] = y;
+	if (++lr->head == PP_SERVO_LR_WINDOW)
+		lr->head = 0;
+	if (lr->n < PP_SERVO_LR_WINDOW)
+		lr->n++;
+	n = lr->n;
+	oldest = n < PP_SERVO_LR_WINDOW ? 0 : lr->head;
+	if (n < 2)
+		return lr->freq;
+
+	/* Use x relative to the last sample, so the sums fit 64 bits */
+	for (i = 0; i < n; i++) {
+		sx += (lr->x[i] - x) >> LR_SHIFT;
+		sy += lr->y[i];
+	}
+	mu = pp_muldiv(sx, 1, n);
+	my = pp_muldiv(sy, 1, n);
+	for (i = 0; i < n; i++) {
+		u = ((lr->x[i] - x) >> LR_SHIFT) - mu;
+		v = lr->y[i] - my;
+		sxx += u * u;
+		sxy += u * v;
+	}
+	span = x - lr->x[oldest];
+	if (!sxx || span <= 0)
+		return lr->freq;
+
+	/* Slope in ppb, and the offset of the line at the last sample */
+	slope = pp_muldiv(sxy, PP_NSEC_PER_SEC, sxx) >> LR_SHIFT;
+	offset = my - pp_muldiv(slope * mu, 1 << LR_SHIFT, PP_NSEC_PER_SEC);
+
+	freq = lr->freq - slope;
+	if (samples)
+		freq -= pp_muldiv(offset * (n - 1), PP_NSEC_PER_SEC,
+				  span * samples);
+	if (freq > PP_ADJ_FREQ_MAX)
+		freq = PP_ADJ_FREQ_MAX;
+	if (freq < -PP_ADJ_FREQ_MAX)
+		freq = -PP_ADJ_FREQ_MAX;
+
+	df = freq - lr->freq;
+	for (i = 0; i < n; i++)
+		lr->y[i] += pp_muldiv(df * (lr->x[i] - x), 1, PP_NSEC_PER_SEC);
+	lr->freq = freq;
+
+	pp_diag(ppi, servo, 2, "linreg: slope %lli, offset %lli, freq %lli\n",
+		(long long)slope, (long long)offset, (long long)freq);
+	return freq;
+}
+
+static int lr_sample(struct pp_instance *ppi, struct pp_time *ofm,
+		     struct pp_time *t)
+{
+	return lr_fit(ppi, ofm, t, LR_SAMPLES);
+}
+
+static int lr_sync_only_sample(struct pp_instance *ppi, struct pp_time *ofm,
+			       struct pp_time *t)
+{
+	return lr_fit(ppi, ofm, t, 0);
+}
+
+struct pp_servo_ops pp_servo_linreg = {
+	.init = lr_init,
+	.sample = lr_sample,
+};
+
+struct pp_servo_ops pp_servo_sync_only = {
+	.init = lr_init,
+	.sample = lr_sync_only_sample,
+};
@@ -13,15 +13,33 @@ static void pp_servo_mpd_fltr(struct pp_instance *, struct pp_avg_fltr *,
 static int pp_servo_offset_master(struct pp_instance *, struct pp_time *,
 				   struct pp_time *, struct pp_time *);
 static int64_t pp_servo_pi_controller(struct pp_instance *, struct pp_time *);
+static void pp_servo_dreq_rate(struct pp_instance *, int);
 
+static struct pp_servo_ops *servo_ops[] = {
+	[PPSI_SERVO_PI] = &pp_servo_pi,
+	[PPSI_SERVO_LINREG] = &pp_servo_linreg,
+	[PPSI_SERVO_KALMAN] = &pp_servo_kalman,
+	[PPSI_SERVO_SYNC_ONLY] = &pp_servo_sync_only,
+};
+
+static inline struct pp_servo_ops *SRV_OPS(struct pp_instance *ppi)
+{
+	return servo_ops[ppi->cfg.servo];
+}
 
 void pp_servo_init(struct pp_instance *ppi)
 {
-	int d;
+	int d = 0;
 
 	SRV(ppi)->mpd_fltr.s_exp = 0;	/* clears meanPathDelay filter */
+	SRV(ppi)->ndelays = 0;		/* and the window of delays */
+	SRV(ppi)->mpd_var = 0;		/* and what we know of its noise */
+	SRV(ppi)->dreq_good = 0;
+	if (ppi->dreq_backoff)
+		pp_servo_dreq_rate(ppi, 0);
 	ppi->frgn_rec_num = 0;		/* no known master */
 	DSPAR(ppi)->parentPortIdentity.portNumber = 0; /* invalid */
+	ppi->flags &= ~PPI_FLAG_PARENT_ADDR; /* and so is its address */
 
 	if (ppi->t_ops->init_servo) {
 		/* The system may pre-set us to keep current frequency */
@@ -30,23 +48,219 @@ void pp_servo_init(struct pp_instance *ppi)
 			pp_diag(ppi, servo, 1, "error in t_ops->servo_init");
 			d = 0;
 		}
-		SRV(ppi)->obs_drift = -d << 10; /* note "-" */
 	} else {
 		/* level clock */
 		if (pp_can_adjust(ppi))
 			ppi->t_ops->adjust(ppi, 0, 0);
-		SRV(ppi)->obs_drift = 0;
 	}
+	SRV_OPS(ppi)->init(ppi, d);
+}
 
+static void pp_servo_pi_init(struct pp_instance *ppi, int freq)
+{
+	SRV(ppi)->obs_drift = -freq << 10; /* note "-" */
 	pp_diag(ppi, servo, 1, "Initialized: obs_drift %lli\n",
 		SRV(ppi)->obs_drift);
 }
 
-/* internal helper, returning static storage to be used immediately */
-static char *fmt_ppt(struct pp_time *t)
+static int pp_servo_pi_sample(struct pp_instance *ppi, struct pp_time *ofm,
+			      struct pp_time *t)
+{
+	/* PI controller returns a scaled_nsecs adjustment, so shift back */
+	int adj32 = (int)(pp_servo_pi_controller(ppi, ofm) >> 16);
+
+	pp_diag(ppi, servo, 2, "Observed drift: %9i\n",
+		(int)SRV(ppi)->obs_drift >> 10);
+	return -adj32;
+}
+
+struct pp_servo_ops pp_servo_pi = {
+	.init = pp_servo_pi_init,
+	.sample = pp_servo_pi_sample,
+};
+
+/*
+ * With "servo-window <n>", the controller only gets "lucky" samples: those
+ * whose delay is not above "servo-percentile" of the last n delays. The
+ * default, 0, only accepts the minimum: the least queueing in the path.
+ * s_to_m is the slave to master delay of this very exchange, or NULL if
+ * there is none (a Sync alone, or P2P): then the mean path delay is used.
+ * Returns 0 if the sample must be discarded.
+ */
+static int pp_servo_filter(struct pp_instance *ppi, struct pp_time *ofm,
+			   struct pp_time *s_to_m)
+{
+	struct pp_servo *s = SRV(ppi);
+	int n = ppi->cfg.servo_window, pct = ppi->cfg.servo_percentile;
+	int64_t delay, tmp, sorted[PP_SERVO_FLT_MAX];
+	int i, j;
+
+	if (n <= 1)
+		return 1;
+	if (n > PP_SERVO_FLT_MAX)
+		n = PP_SERVO_FLT_MAX;
+	if (pct < 0 || pct > 100)
+		pct = pct < 0 ? 0 : 100;
+	delay = pp_time_to_ns(s_to_m ? s_to_m : &DSCUR(ppi)->meanPathDelay);
+	delay += pp_time_to_ns(&s->m_to_s_dly);
+	if (s->delay_head >= n)
+		s->delay_head = 0;
+	s->delays[s->delay_head++] = delay;
+	if (s->ndelays < n)
+		s->ndelays++;
+
+	/* A window is a few samples: insertion sort is enough */
+	n = s->ndelays;
+	for (i = 0; i < n; i++) {
+		sorted[i] = s->delays[i];
+		for (j = i; j > 0 && sorted[j - 1] > sorted[j]; j--) {
+			tmp = sorted[j - 1];
+			sorted[j - 1] = sorted[j];
+			sorted[j] = tmp;
+		}
+	}
+	if (delay > sorted[pct * (n - 1) / 100]) {
+		pp_diag(ppi, servo, 2, "Discard sample: delay %lli, %i%% of "
+			"%i is %lli\n", (long long)delay, pct, n,
+			(long long)sorted[pct * (n - 1) / 100]);
+		return 0;
+	}
+
+	/* The filtered mpd is biased, but this sample's own delay is not */
+	if (s_to_m) {
+		*ofm = s->m_to_s_dly;
+		pp_time_sub(ofm, s_to_m);
+		pp_time_div2(ofm);
+	}
+	return 1;
+}
+
+/* Feed the controller, and apply its output to the clock */
+static void pp_servo_adjust(struct pp_instance *ppi, struct pp_time *ofm,
+			    struct pp_time *s_to_m)
+{
+	struct pp_time lucky = *ofm;
+	int adj;
+
+	if (!pp_servo_filter(ppi, &lucky, s_to_m))
+		return;
+	adj = SRV_OPS(ppi)->sample(ppi, &lucky, &ppi->t2);
+
+	/* apply controller output as a clock tick rate adjustment, if
+	 * provided by arch, or as a raw offset otherwise */
+	if (pp_can_adjust(ppi)) {
+		if (ppi->t_ops->adjust_freq)
+			ppi->t_ops->adjust_freq(ppi, adj);
+		else
+			ppi->t_ops->adjust_offset(ppi, adj);
+	}
+}
+
+/*
+ * Adaptive Delay_Req rate ("delay-req-backoff <n>" in config). Once the
+ * path delay is stable, the interval is doubled, up to n times, over the
+ * one the master asks for. We go back to the master's rate as soon as a
+ * path delay, or a Sync, is far from what the noise so far allows.
+ * So the controller is not slowed down as well, it runs at each Sync,
+ * with the filtered path delay, and Delay_Resp only updates the latter.
+ */
+#define PP_DREQ_GOOD	16		/* stable samples before backing off */
+#define PP_DREQ_FLOOR	(100 * 100)	/* ns^2: less noise is no news */
+#define PP_DREQ_CLAMP	(1000 * 1000)	/* ns: so the square fits */
+
+static void pp_servo_dreq_rate(struct pp_instance *ppi, int backoff)
+{
+	int logval = DSPOR(ppi)->logMinDelayReqInterval + backoff;
+
+	pp_diag(ppi, servo, 1, "Delay_Req interval 2^%i\n", logval);
+	ppi->dreq_backoff = backoff;
+	ppi->to_values[PP_TO_REQUEST] = logval;
+	SRV(ppi)->dreq_good = 0;
+}
+
+/* Is the deviation d (ns) more than k2 times the variance we know? */
+static int pp_servo_dreq_news(struct pp_servo *s, int64_t d, int k2)
+{
+	int64_t var = s->mpd_var;
+
+	if (d < -PP_DREQ_CLAMP || d > PP_DREQ_CLAMP)
+		d = PP_DREQ_CLAMP;
+	if (var < PP_DREQ_FLOOR)
+		var = PP_DREQ_FLOOR;
+	return d * d > k2 * var;
+}
+
+/* After each Delay_Resp: raw and filtered mean path delay, in ns */
+static void pp_servo_dreq_resp(struct pp_instance *ppi, int64_t raw,
+			       int64_t flt)
+{
+	struct pp_servo *s = SRV(ppi);
+	int64_t d = raw - flt;
+	int news;
+
+	if (d < -PP_DREQ_CLAMP || d > PP_DREQ_CLAMP)
+		d = PP_DREQ_CLAMP;
+	news = pp_servo_dreq_news(s, d, 16); /* 4 sigma */
+	s->mpd_var += (d * d - s->mpd_var) / 16;
+	if (news) {
+		s->dreq_good = 0;
+		if (ppi->dreq_backoff) {
+			pp_servo_dreq_rate(ppi, 0);
+			pp_timeout_set(ppi, PP_TO_REQUEST); /* a long one */
+		}
+		return;
+	}
+	if (++s->dreq_good >= PP_DREQ_GOOD
+	    && ppi->dreq_backoff < ppi->cfg.dreq_backoff)
+		pp_servo_dreq_rate(ppi, ppi->dreq_backoff + 1);
+}
+
+/* After each Sync: t2 - t1 is twice as noisy as the mean path delay */
+static void pp_servo_dreq_sync(struct pp_instance *ppi)
+{
+	struct pp_servo *s = SRV(ppi);
+	struct pp_time *mpd = &DSCUR(ppi)->meanPathDelay;
+	struct pp_time *ofm = &DSCUR(ppi)->offsetFromMaster;
+	int64_t m_to_s = pp_time_to_ns(&s->m_to_s_dly);
+	int64_t d = m_to_s - s->last_m_to_s;
+
+	s->last_m_to_s = m_to_s;
+	if (ppi->dreq_backoff && pp_servo_dreq_news(s, d, 4 * 16)) {
+		pp_diag(ppi, servo, 1, "Master to slave changed by %lli\n",
+			(long long)d);
+		pp_servo_dreq_rate(ppi, 0);
+		pp_timeout_set(ppi, PP_TO_REQUEST); /* a long one is pending */
+	}
+	if (!s->mpd_fltr.s_exp)
+		return; /* no Delay_Resp yet */
+	if (pp_servo_offset_master(ppi, mpd, ofm, &s->m_to_s_dly))
+		return;
+	pp_servo_adjust(ppi, ofm, NULL); /* s_to_m_dly is an old one */
+}
+
+/*
+ * Sync-only servo: with no Delay_Req there is no path delay, so the
+ * offset includes it. Only its changes matter, to steer the frequency.
+ */
+static void pp_servo_sync_only_adjust(struct pp_instance *ppi)
 {
-	static char s[24];
+	struct pp_time *mpd = &DSCUR(ppi)->meanPathDelay;
+	struct pp_time *ofm = &DSCUR(ppi)->offsetFromMaster;
+	int adj;
+
+	/* Still, step the clock if we are seconds away */
+	if (pp_servo_offset_master(ppi, mpd, ofm, &SRV(ppi)->m_to_s_dly))
+		return;
+	adj = SRV_OPS(ppi)->sample(ppi, ofm, &ppi->t2);
+	if (pp_can_adjust(ppi) && ppi->t_ops->adjust_freq)
+		ppi->t_ops->adjust_freq(ppi, adj);
+}
 
+/* internal helper, formatting in the caller's buffer (no static state) */
+#define FMT_PPT_LEN 24
+
+static char *fmt_ppt(char *s, struct pp_time *t)
+{
 	pp_sprintf(s, "%s%d.%09d",
 		   (t->secs < 0 || (t->secs == 0 && t->scaled_nsecs < 0))
 		   ? "-" : " ",
@@ -66,6 +280,11 @@ void pp_servo_got_sync(struct pp_instance *ppi)
 	 */
 	*m_to_s_dly = ppi->t2;
 	pp_time_sub(m_to_s_dly, &ppi->t1);
+
+	if (ppi->cfg.servo == PPSI_SERVO_SYNC_ONLY)
+		pp_servo_sync_only_adjust(ppi);
+	else if (ppi->cfg.dreq_backoff)
+		pp_servo_dreq_sync(ppi);
 }
 
 /* Called by slave and uncalib when we have t1 and t2 */
@@ -74,10 +293,16 @@ void pp_servo_got_psync(struct pp_instance *ppi)
 	struct pp_time *m_to_s_dly = &SRV(ppi)->m_to_s_dly;
 	struct pp_time *mpd = &DSCUR(ppi)->meanPathDelay;
 	struct pp_time *ofm = &DSCUR(ppi)->offsetFromMaster;
-	int adj32;
+	char s[FMT_PPT_LEN];
+
+	/* No Pdelay for sync-only: the Sync is all it needs, as in E2E */
+	if (ppi->cfg.servo == PPSI_SERVO_SYNC_ONLY) {
+		pp_servo_got_sync(ppi);
+		return;
+	}
 
-	pp_diag(ppi, servo, 2, "T1: %s\n", fmt_ppt(&ppi->t1));
-	pp_diag(ppi, servo, 2, "T2: %s\n", fmt_ppt(&ppi->t2));
+	pp_diag(ppi, servo, 2, "T1: %s\n", fmt_ppt(s, &ppi->t1));
+	pp_diag(ppi, servo, 2, "T2: %s\n", fmt_ppt(s, &ppi->t2));
 
 	/*
 	 * calc 'master_to_slave_delay'; no correction field
@@ -90,20 +315,7 @@ void pp_servo_got_psync(struct pp_instance *ppi)
 	if (pp_servo_offset_master(ppi, mpd, ofm, m_to_s_dly))
 		return;
 
-	/* PI controller returns a scaled_nsecs adjustment, so shift back */
-	adj32 = (int)(pp_servo_pi_controller(ppi, ofm) >> 16);
-
-	/* apply controller output as a clock tick rate adjustment, if
-	 * provided by arch, or as a raw offset otherwise */
-	if (pp_can_adjust(ppi)) {
-		if (ppi->t_ops->adjust_freq)
-			ppi->t_ops->adjust_freq(ppi, -adj32);
-		else
-			ppi->t_ops->adjust_offset(ppi, -adj32);
-	}
-
-	pp_diag(ppi, servo, 2, "Observed drift: %9i\n",
-		(int)SRV(ppi)->obs_drift >> 10);
+	pp_servo_adjust(ppi, ofm, NULL); /* s_to_m_dly is the peer's */
 }
 
 /* called by slave states when delay_resp is received (all t1..t4 are valid) */
@@ -114,8 +326,8 @@ void pp_servo_got_resp(struct pp_instance *ppi)
 	struct pp_time *mpd = &DSCUR(ppi)->meanPathDelay;
 	struct pp_time *ofm = &DSCUR(ppi)->offsetFromMaster;
 	struct pp_avg_fltr *mpd_fltr = &SRV(ppi)->mpd_fltr;
-	int adj32;
-
+	char s[FMT_PPT_LEN];
+	int64_t raw;
 
 	/* We sometimes enter here before we got sync/f-up */
 	if (ppi->t1.secs == 0 && ppi->t1.scaled_nsecs == 0) {
@@ -129,43 +341,36 @@ void pp_servo_got_resp(struct pp_instance *ppi)
 	*s_to_m_dly = ppi->t4;
 	pp_time_sub(s_to_m_dly, &ppi->t3);
 
-	pp_diag(ppi, servo, 2, "T1: %s\n", fmt_ppt(&ppi->t1));
-	pp_diag(ppi, servo, 2, "T2: %s\n", fmt_ppt(&ppi->t2));
-	pp_diag(ppi, servo, 2, "T3: %s\n", fmt_ppt(&ppi->t3));
-	pp_diag(ppi, servo, 2, "T4: %s\n", fmt_ppt(&ppi->t4));
-	pp_diag(ppi, servo, 1, "Master to slave: %s\n", fmt_ppt(m_to_s_dly));
-	pp_diag(ppi, servo, 1, "Slave to master: %s\n", fmt_ppt(s_to_m_dly));
+	pp_diag(ppi, servo, 2, "T1: %s\n", fmt_ppt(s, &ppi->t1));
+	pp_diag(ppi, servo, 2, "T2: %s\n", fmt_ppt(s, &ppi->t2));
+	pp_diag(ppi, servo, 2, "T3: %s\n", fmt_ppt(s, &ppi->t3));
+	pp_diag(ppi, servo, 2, "T4: %s\n", fmt_ppt(s, &ppi->t4));
+	pp_diag(ppi, servo, 1, "Master to slave: %s\n", fmt_ppt(s, m_to_s_dly));
+	pp_diag(ppi, servo, 1, "Slave to master: %s\n", fmt_ppt(s, s_to_m_dly));
 
 	/* Calc mean path delay, used later to calc "offset from master" */
 	*mpd = SRV(ppi)->m_to_s_dly;
 	pp_time_add(mpd, &SRV(ppi)->s_to_m_dly);
 	pp_time_div2(mpd);
-	pp_diag(ppi, servo, 1, "meanPathDelay: %s\n", fmt_ppt(mpd));
+	if (!pp_trace(ppi, SERVO_MPD, NULL, pp_time_to_ns(mpd)))
+		pp_diag(ppi, servo, 1, "meanPathDelay: %s\n", fmt_ppt(s, mpd));
 
 	if (mpd->secs) /* Hmm.... we called this "bad event" */
 		return;
 
 	/* mean path delay filtering */
+	raw = pp_time_to_ns(mpd);
 	pp_servo_mpd_fltr(ppi, mpd_fltr, mpd);
+	if (ppi->cfg.dreq_backoff) {
+		pp_servo_dreq_resp(ppi, raw, pp_time_to_ns(mpd));
+		return; /* the next Sync uses it */
+	}
 
 	/* update 'offsetFromMaster' and possibly jump in time */
 	if (pp_servo_offset_master(ppi, mpd, ofm, m_to_s_dly))
 		return;
 
-	/* PI controller */
-	adj32 = (int)(pp_servo_pi_controller(ppi, ofm) >> 16);
-
-	/* apply controller output as a clock tick rate adjustment, if
-	 * provided by arch, or as a raw offset otherwise */
-	if (pp_can_adjust(ppi)) {
-		if (ppi->t_ops->adjust_freq)
-			ppi->t_ops->adjust_freq(ppi, -adj32);
-		else
-			ppi->t_ops->adjust_offset(ppi, -adj32);
-	}
-
-	pp_diag(ppi, servo, 2, "Observed drift: %9i\n",
-		(int)SRV(ppi)->obs_drift >> 10);
+	pp_servo_adjust(ppi, ofm, s_to_m_dly);
 }
 
 /* called by slave states when delay_resp is received (all t1..t4 are valid) */
@@ -175,6 +380,7 @@ void pp_servo_got_presp(struct pp_instance *ppi)
 	struct pp_time *s_to_m_dly = &SRV(ppi)->s_to_m_dly;
 	struct pp_time *mpd = &DSCUR(ppi)->meanPathDelay;
 	struct pp_avg_fltr *mpd_fltr = &SRV(ppi)->mpd_fltr;
+	char s[FMT_PPT_LEN];
 
 	/*
 	 * calc 'slave_to_master_delay', removing the correction field
@@ -186,18 +392,19 @@ void pp_servo_got_presp(struct pp_instance *ppi)
 	*m_to_s_dly = ppi->t4;
 	pp_time_sub(m_to_s_dly, &ppi->t3);
 
-	pp_diag(ppi, servo, 2, "T3: %s\n", fmt_ppt(&ppi->t3));
-	pp_diag(ppi, servo, 2, "T4: %s\n", fmt_ppt(&ppi->t4));
-	pp_diag(ppi, servo, 2, "T5: %s\n", fmt_ppt(&ppi->t5));
-	pp_diag(ppi, servo, 2, "T6: %s\n", fmt_ppt(&ppi->t6));
-	pp_diag(ppi, servo, 1, "Master to slave: %s\n", fmt_ppt(m_to_s_dly));
-	pp_diag(ppi, servo, 1, "Slave to master: %s\n", fmt_ppt(s_to_m_dly));
+	pp_diag(ppi, servo, 2, "T3: %s\n", fmt_ppt(s, &ppi->t3));
+	pp_diag(ppi, servo, 2, "T4: %s\n", fmt_ppt(s, &ppi->t4));
+	pp_diag(ppi, servo, 2, "T5: %s\n", fmt_ppt(s, &ppi->t5));
+	pp_diag(ppi, servo, 2, "T6: %s\n", fmt_ppt(s, &ppi->t6));
+	pp_diag(ppi, servo, 1, "Master to slave: %s\n", fmt_ppt(s, m_to_s_dly));
+	pp_diag(ppi, servo, 1, "Slave to master: %s\n", fmt_ppt(s, s_to_m_dly));
 
 	/* Calc mean path delay, used later to calc "offset from master" */
 	*mpd = SRV(ppi)->m_to_s_dly;
 	pp_time_add(mpd, &SRV(ppi)->s_to_m_dly);
 	pp_time_div2(mpd);
-	pp_diag(ppi, servo, 1, "meanPathDelay: %s\n", fmt_ppt(mpd));
+	if (!pp_trace(ppi, SERVO_MPD, NULL, pp_time_to_ns(mpd)))
+		pp_diag(ppi, servo, 1, "meanPathDelay: %s\n", fmt_ppt(s, mpd));
 
 	if (mpd->secs) /* Hmm.... we called this "bad event" */
 		return;
@@ -270,9 +477,15 @@ int pp_servo_offset_master(struct pp_instance *ppi, struct pp_time *mpd,
 			    struct pp_time *ofm, struct pp_time *m_to_s_dly)
 {
 	struct pp_time time_tmp;
+	char s[FMT_PPT_LEN];
+
 	*ofm = *m_to_s_dly;
 	pp_time_sub(ofm, mpd);
-	pp_diag(ppi, servo, 1, "Offset from master:     %s\n", fmt_ppt(ofm));
+	if (!pp_trace(ppi, SERVO_OFM, NULL, pp_time_to_ns(ofm)))
+		pp_diag(ppi, servo, 1, "Offset from master:     %s\n",
+			fmt_ppt(s, ofm));
+	if (GLBS(ppi)->offset_hook)
+		GLBS(ppi)->offset_hook(ppi);
 
 	if (!ofm->secs)
 		return 0; /* proceeed with adjust */
@@ -79,6 +79,10 @@ int pp_initializing(struct pp_instance *ppi, unsigned char *pkt, int plen)
 	port->versionNumber = PP_VERSION_PTP;
 	pp_timeout_init(ppi);
 
+	if (CONFIG_HAS_UNICAST && ppi->cfg.ucast_clients
+	    && pp_ucast_init(ppi) < 0)
+		goto failure;
+
 	if (pp_hooks.init)
 		ret = pp_hooks.init(ppi, pkt, plen);
 	if (ret) {
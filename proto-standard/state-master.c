@@ -29,8 +29,16 @@ static pp_action *actions[] = {
 static int master_handle_delay_request(struct pp_instance *ppi,
 				       unsigned char *pkt, int plen)
 {
-	if (ppi->state == PPS_MASTER) /* not pre-master */
-		msg_issue_delay_resp(ppi, &ppi->last_rcv_time);
+	MsgHeader *hdr = &ppi->received_ptp_header;
+
+	if (ppi->state != PPS_MASTER) /* not pre-master */
+		return 0;
+	/* Hybrid mode, or a unicast request: only the requester gets it */
+	if (ppi->cfg.hybrid || (hdr->flagField[0] & PP_UNICAST_FLAG))
+		pp_tx_unicast(ppi, ppi->peer_ip, ppi->peer,
+			      DSPOR(ppi)->logMinDelayReqInterval);
+	msg_issue_delay_resp(ppi, &ppi->last_rcv_time);
+	pp_tx_multicast(ppi);
 	return 0;
 }
 
@@ -79,6 +87,8 @@ int pp_master(struct pp_instance *ppi, uint8_t *pkt, int plen)
 		e = PP_SEND_ERROR; /* well, "error" in general */
 		goto out;
 	}
+	if (CONFIG_HAS_UNICAST && ppi->ucast && !pre)
+		msgtype = pp_ucast_master(ppi, pkt, plen, msgtype);
 
 	/*
 	 * The management of messages is now table-driven
@@ -111,6 +121,8 @@ out:
 	/* we also use TO_QUALIFICATION, but avoid counting it here */
 	ppi->next_delay = pp_next_delay_3(ppi,
 		PP_TO_ANN_SEND, PP_TO_SYNC_SEND, PP_TO_REQUEST);
+	if (CONFIG_HAS_UNICAST && ppi->ucast)
+		ppi->next_delay = pp_ucast_next_delay(ppi);
 	return e;
 }
 
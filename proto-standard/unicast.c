@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * Unicast negotiation, master side (16.1, and G.8265.1 for the rates).
+ * Slaves ask with Signaling for Sync, Announce and Delay_Resp, each at
+ * its own logInterMessagePeriod and for a limited duration; we grant or
+ * deny with a Signaling reply. Clients are found by IPv4 address in an
+ * open-addressing hash, and everything that has a deadline (the next
+ * Sync or Announce, the end of a Delay_Resp grant) is an entry in a
+ * binary heap, so a state machine run only looks at what is due.
+ */
+#include <stdlib.h>
+#include <ppsi/ppsi.h>
+#include "common-fun.h"
+
+enum { PP_UC_SYNC, PP_UC_ANN, PP_UC_DRESP, PP_UC_N };
+
+static const uint8_t uc_msgtype[PP_UC_N] = {
+	[PP_UC_SYNC] = PPM_SYNC,
+	[PP_UC_ANN] = PPM_ANNOUNCE,
+	[PP_UC_DRESP] = PPM_DELAY_RESP,
+};
+
+#define PP_UC_MIN_LOG		-7	/* 128 frames per second */
+#define PP_UC_MAX_LOG		7
+#define PP_UC_DURATION		300	/* default max duration (s) */
+#define PP_UC_MAX_TLVS		4	/* in a reply, to fit tx_ptp */
+#define PP_UC_REQ_LEN		6	/* body of REQUEST and GRANT */
+#define PP_UC_RENEWAL		1	/* renewalInvited, GRANT flags */
+
+struct pp_uc_client {
+	uint64_t when[PP_UC_N];		/* expiry of each grant, 0: none */
+	int hpos[PP_UC_N];		/* position in the heap, -1: none */
+	uint32_t addr;			/* network order, 0: free slot */
+	PortIdentity id;		/* for targetPortIdentity */
+	UInteger16 seq[PP_UC_N];	/* sequenceId we last sent */
+	Integer8 log[PP_UC_N];
+};
+
+/* A heap entry: client index and grant type are packed in one word */
+struct pp_uc_event {
+	uint64_t when;
+	uint32_t what;
+};
+#define UC_EV(c, t)	(((c) << 2) | (t))
+
+struct pp_ucast {
+	int max, nfree, nev;
+	int hbits;			/* hash size is 1 << hbits */
+	uint32_t max_s;			/* longest grant we give */
+	uint32_t seed;
+	struct pp_uc_client *c;
+	struct pp_uc_event *ev;		/* PP_UC_N * max entries */
+	int *free;			/* stack of free client indexes */
+	int *hash;			/* client index + 1, 0: empty */
+};
+
+static uint64_t uc_period(int log)
+{
+	return log >= 0 ? 1000000000ULL << log : 1000000000ULL >> -log;
+}
+
+static unsigned uc_hash(struct pp_ucast *u, uint32_t addr)
+{
+	return (addr * 0x9e3779b1) >> (32 - u->hbits);
+}
+
+static int uc_find(struct pp_ucast *u, uint32_t addr)
+{
+	unsigned mask = (1 << u->hbits) - 1, h = uc_hash(u, addr);
+	int i;
+
+	for (; (i = u->hash[h]); h = (h + 1) & mask)
+		if (u->c[i - 1].addr == addr)
+			return i - 1;
+	return -1;
+}
+
+static int uc_new(struct pp_ucast *u, uint32_t addr)
+{
+	unsigned mask = (1 << u->hbits) - 1, h = uc_hash(u, addr);
+	struct pp_uc_client *c;
+	int i, t;
+
+	if (!u->nfree)
+		return -1;
+	i = u->free[--u->nfree];
+	c = u->c + i;
+	c->addr = addr;
+	for (t = 0; t < PP_UC_N; t++) {
+		c->when[t] = 0;
+		c->hpos[t] = -1;
+		c->seq[t] = 0;
+	}
+	while (u->hash[h])
+		h = (h + 1) & mask;
+	u->hash[h] = i + 1;
+	return i;
+}
+
+/* Remove from the hash, shifting back the entries after it (no tombstone) */
+static void uc_del(struct pp_ucast *u, int i)
+{
+	unsigned mask = (1 << u->hbits) - 1, h, j, k;
+
+	h = uc_hash(u, u->c[i].addr);
+	while (u->hash[h] != i + 1)
+		h = (h + 1) & mask;
+	for (j = h; u->hash[j = (j + 1) & mask]; ) {
+		k = uc_hash(u, u->c[u->hash[j] - 1].addr);
+		/* j can move to h if its home k is not in (h, j] */
+		if (((j - k) & mask) >= ((j - h) & mask)) {
+			u->hash[h] = u->hash[j];
+			h = j;
+		}
+	}
+	u->hash[h] = 0;
+	u->c[i].addr = 0;
+	u->free[u->nfree++] = i;
+}
+
+/* Heap helpers: hpos in the client tracks each entry */
+static void uc_place(struct pp_ucast *u, int pos, struct pp_uc_event *e)
+{
+	u->ev[pos] = *e;
+	u->c[e->what >> 2].hpos[e->what & 3] = pos;
+}
+
+static int uc_before(struct pp_uc_event *a, struct pp_uc_event *b)
+{
+	return (int64_t)(a->when - b->when) < 0;
+}
+
+static void uc_sift(struct pp_ucast *u, int pos)
+{
+	struct pp_uc_event e = u->ev[pos];
+	int child;
+
+	while (pos && uc_before(&e, u->ev + (pos - 1) / 2)) {
+		uc_place(u, pos, u->ev + (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+	while ((child = 2 * pos + 1) < u->nev) {
+		if (child + 1 < u->nev && uc_before(u->ev + child + 1,
+						    u->ev + child))
+			child++;
+		if (!uc_before(u->ev + child, &e))
+			break;
+		uc_place(u, pos, u->ev + child);
+		pos = child;
+	}
+	uc_place(u, pos, &e);
+}
+
+static void uc_schedule(struct pp_ucast *u, int i, int t, uint64_t when)
+{
+	struct pp_uc_event e = {when, UC_EV(i, t)};
+	int pos = u->c[i].hpos[t];
+
+	if (pos < 0)
+		pos = u->nev++;
+	u->ev[pos] = e;
+	uc_sift(u, pos);
+}
+
+/* Drop a grant, and the client when it has none left */
+static void uc_revoke(struct pp_ucast *u, int i, int t)
+{
+	struct pp_uc_client *c = u->c + i;
+	int pos = c->hpos[t];
+
+	if (pos >= 0) {
+		c->hpos[t] = -1;
+		if (pos != --u->nev) {
+			u->ev[pos] = u->ev[u->nev];
+			uc_sift(u, pos);
+		}
+	}
+	c->when[t] = 0;
+	for (t = 0; t < PP_UC_N; t++)
+		if (c->when[t])
+			return;
+	uc_del(u, i);
+}
+
+int pp_ucast_init(struct pp_instance *ppi)
+{
+	struct pp_ucast *u;
+	int i, max = ppi->cfg.ucast_clients, hbits = 1;
+	size_t size;
+
+	if (ppi->ucast)
+		return 0; /* initializing again, after a fault */
+	if (ppi->proto != PPSI_PROTO_UDP) {
+		pp_diag(ppi, ext, 1, "unicast needs proto udp: not used\n");
+		return 0;
+	}
+	while ((1 << hbits) < 2 * max) /* load factor not above 1/2 */
+		hbits++;
+	size = sizeof(*u) + max * (sizeof(*u->c) + PP_UC_N * sizeof(*u->ev)
+				   + sizeof(int)) + (sizeof(int) << hbits);
+	u = calloc(1, size);
+	if (!u)
+		return -1;
+	u->c = (void *)(u + 1);
+	u->ev = (void *)(u->c + max);
+	u->free = (void *)(u->ev + PP_UC_N * max);
+	u->hash = u->free + max;
+	u->max = max;
+	u->hbits = hbits;
+	for (i = 0; i < max; i++)
+		u->free[u->nfree++] = max - 1 - i;
+	u->max_s = ppi->cfg.ucast_duration ?: PP_UC_DURATION;
+	u->seed = *(uint32_t *)&DSDEF(ppi)->clockIdentity;
+	ppi->ucast = u;
+	pp_diag(ppi, ext, 1, "unicast master: up to %i clients\n", max);
+	return 0;
+}
+
+/* Same as msg_issue_*, but to this client, with its own sequence */
+static int uc_send(struct pp_instance *ppi, struct pp_uc_client *c, int t)
+{
+	int msgtype = uc_msgtype[t], e;
+	UInteger16 seq = ppi->sent_seq[msgtype];
+
+	ppi->sent_seq[msgtype] = c->seq[t];
+	pp_tx_unicast(ppi, c->addr, NULL, c->log[t]);
+	if (t == PP_UC_SYNC)
+		e = msg_issue_sync_followup(ppi);
+	else
+		e = msg_issue_announce(ppi);
+	pp_tx_multicast(ppi);
+	c->seq[t] = ppi->sent_seq[msgtype];
+	ppi->sent_seq[msgtype] = seq;
+	return e;
+}
+
+static int uc_type(int msgtype)
+{
+	int t;
+
+	for (t = 0; t < PP_UC_N; t++)
+		if (uc_msgtype[t] == msgtype)
+			return t;
+	return -1;
+}
+
+/* Returns the duration granted, 0 to deny */
+static uint32_t uc_grant(struct pp_instance *ppi, struct pp_ucast *u,
+			 int t, int log, uint32_t duration, uint64_t now)
+{
+	MsgHeader *hdr = &ppi->received_ptp_header;
+	struct pp_uc_client *c;
+	uint64_t period;
+	int i;
+
+	if (t < 0 || log < PP_UC_MIN_LOG || log > PP_UC_MAX_LOG || !duration)
+		return 0;
+	i = uc_find(u, ppi->peer_ip);
+	if (i < 0)
+		i = uc_new(u, ppi->peer_ip);
+	if (i < 0) {
+		pp_diag(ppi, frames, 1, "unicast: table full (%i)\n", u->max);
+		return 0;
+	}
+	c = u->c + i;
+	c->id = hdr->sourcePortIdentity;
+	if (duration > u->max_s)
+		duration = u->max_s;
+	c->when[t] = now + duration * 1000000000ULL;
+	if (t == PP_UC_DRESP) {
+		c->log[t] = log;
+		uc_schedule(u, i, t, c->when[t]);
+		return duration;
+	}
+	/* A renewal at the same rate keeps the phase of the stream */
+	if (c->hpos[t] >= 0 && c->log[t] == log)
+		return duration;
+	c->log[t] = log;
+	period = uc_period(log);
+	u->seed = u->seed * 1103515245 + 12345;
+	uc_schedule(u, i, t, now + (period >> 16) * (u->seed >> 16));
+	return duration;
+}
+
+static uint8_t *uc_put_tlv(uint8_t *r, int type, int len)
+{
+	*(UInteger16 *)(r + 0) = htons(type);
+	*(UInteger16 *)(r + 2) = htons(len);
+	return r + 4;
+}
+
+/* Signaling header and targetPortIdentity, for the TLVs already there */
+static int uc_issue_signaling(struct pp_instance *ppi, int tlvlen)
+{
+	MsgHeader *hdr = &ppi->received_ptp_header;
+	void *buf = ppi->tx_ptp;
+	int len = PP_SIGNALING_LENGTH + tlvlen, e;
+
+	*(char *)(buf + 0) = PPM_SIGNALING;
+	*(UInteger16 *)(buf + 2) = htons(len);
+	memset(buf + 6, 0, 10); /* flags, correctionField */
+	*(UInteger16 *)(buf + 30) = htons(++ppi->sent_seq[PPM_SIGNALING]);
+	*(UInteger8 *)(buf + 32) = pp_msgtype_info[PPM_SIGNALING].controlField;
+	memcpy(buf + 34, &hdr->sourcePortIdentity.clockIdentity,
+	       PP_CLOCK_IDENTITY_LENGTH);
+	*(UInteger16 *)(buf + 42) = htons(hdr->sourcePortIdentity.portNumber);
+
+	pp_tx_unicast(ppi, ppi->peer_ip, NULL, 0x7f);
+	e = __send_and_log(ppi, len, PP_NP_GEN);
+	pp_tx_multicast(ppi);
+	return e;
+}
+
+static int uc_signaling(struct pp_instance *ppi, struct pp_ucast *u,
+			uint8_t *pkt, int plen, uint64_t now)
+{
+	uint8_t *r = ppi->tx_ptp + PP_SIGNALING_LENGTH, *tlv;
+	int off, type, len, n = 0, t, i, log;
+	uint32_t duration;
+
+	if (plen > ppi->received_ptp_header.messageLength)
+		plen = ppi->received_ptp_header.messageLength;
+	for (off = PP_SIGNALING_LENGTH; off + 4 <= plen && n < PP_UC_MAX_TLVS;
+	     off += 4 + len) {
+		type = ntohs(*(UInteger16 *)(pkt + off));
+		len = ntohs(*(UInteger16 *)(pkt + off + 2));
+		tlv = pkt + off + 4;
+		if (off + 4 + len > plen)
+			break;
+		switch (type) {
+		case PP_TLV_REQUEST_UNICAST:
+			if (len < PP_UC_REQ_LEN)
+				break;
+			t = uc_type(tlv[0] >> 4);
+			log = (Integer8)tlv[1];
+			duration = ntohl(*(UInteger32 *)(tlv + 2));
+			duration = uc_grant(ppi, u, t, log, duration, now);
+			pp_diag(ppi, frames, 1, "unicast %s: %s %i s, log %i\n",
+				pp_msgtype_info[tlv[0] >> 4].name,
+				duration ? "granted" : "denied", duration, log);
+			r = uc_put_tlv(r, PP_TLV_GRANT_UNICAST,
+				       PP_UC_REQ_LEN + 2);
+			r[0] = tlv[0] & 0xf0;
+			r[1] = tlv[1];
+			*(UInteger32 *)(r + 2) = htonl(duration);
+			r[6] = 0;
+			r[7] = duration ? PP_UC_RENEWAL : 0;
+			r += PP_UC_REQ_LEN + 2;
+			n++;
+			break;
+		case PP_TLV_CANCEL_UNICAST:
+			if (len < 2)
+				break;
+			t = uc_type(tlv[0] >> 4);
+			i = uc_find(u, ppi->peer_ip);
+			if (t >= 0 && i >= 0 && u->c[i].when[t])
+				uc_revoke(u, i, t);
+			r = uc_put_tlv(r, PP_TLV_ACK_CANCEL_UNICAST, 2);
+			r[0] = tlv[0] & 0xf0;
+			r[1] = 0;
+			r += 2;
+			n++;
+			break;
+		default: /* ACKNOWLEDGE_CANCEL and others: nothing to do */
+			break;
+		}
+	}
+	if (!n)
+		return 0;
+	return uc_issue_signaling(ppi, r - (uint8_t *)ppi->tx_ptp
+				  - PP_SIGNALING_LENGTH);
+}
+
+/*
+ * Called by pp_master: handle Signaling and granted Delay_Req, that are
+ * then eaten (PPM_NO_MESSAGE), and send what is due. Other unicast
+ * Delay_Req (hybrid mode) are answered by master_handle_delay_request.
+ */
+int pp_ucast_master(struct pp_instance *ppi, uint8_t *pkt, int plen,
+		    int msgtype)
+{
+	struct pp_ucast *u = ppi->ucast;
+	struct pp_uc_event *e = u->ev;
+	struct pp_uc_client *c;
+	uint64_t now = ppi->t_ops->calc_timeout(ppi, 0);
+	int i, t;
+
+	if (msgtype == PPM_SIGNALING) {
+		uc_signaling(ppi, u, pkt, plen, now);
+		msgtype = PPM_NO_MESSAGE;
+	}
+	if (msgtype == PPM_DELAY_REQ &&
+	    (ppi->received_ptp_header.flagField[0] & PP_UNICAST_FLAG)) {
+		i = uc_find(u, ppi->peer_ip);
+		if (i >= 0 && u->c[i].when[PP_UC_DRESP]) {
+			pp_tx_unicast(ppi, ppi->peer_ip, NULL,
+				      u->c[i].log[PP_UC_DRESP]);
+			msg_issue_delay_resp(ppi, &ppi->last_rcv_time);
+			pp_tx_multicast(ppi);
+			msgtype = PPM_NO_MESSAGE;
+		}
+	}
+
+	/* Only the head of the heap can be due */
+	while (u->nev && (int64_t)(now - e->when) >= 0) {
+		i = e->what >> 2;
+		t = e->what & 3;
+		c = u->c + i;
+		if (t == PP_UC_DRESP || (int64_t)(now - c->when[t]) >= 0) {
+			pp_diag(ppi, frames, 1, "unicast %s: grant expired\n",
+				pp_msgtype_info[uc_msgtype[t]].name);
+			uc_revoke(u, i, t);
+			continue;
+		}
+		uc_send(ppi, c, t);
+		e->when += uc_period(c->log[t]);
+		if ((int64_t)(now - e->when) >= 0) /* we were not running */
+			e->when = now + uc_period(c->log[t]);
+		uc_sift(u, 0);
+	}
+	return msgtype;
+}
+
+/* Like pp_next_delay_*, but also consider the next unicast event */
+int pp_ucast_next_delay(struct pp_instance *ppi)
+{
+	struct pp_ucast *u = ppi->ucast;
+	uint64_t when = ppi->next_deadline;
+
+	if (u->nev && (int64_t)(u->ev[0].when - when) < 0)
+		when = u->ev[0].when;
+	return pp_next_delay(ppi, when);
+}
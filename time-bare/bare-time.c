@@ -19,7 +19,7 @@ static int bare_time_get(struct pp_instance *ppi, struct pp_time *t)
 	/* TAI = UTC + 35 */
 	t->secs = tv.tv_sec + DSPRO(ppi)->currentUtcOffset;
 	t->scaled_nsecs = (tv.tv_usec * 1000LL) << 16;
-	if (!(pp_global_d_flags & PP_FLAG_NOTIMELOG))
+	if (!(GLBS(ppi)->d_flags & PP_FLAG_NOTIMELOG))
 		pp_diag(ppi, time, 2, "%s: %9li.%06li\n", __func__,
 			tv.tv_sec, tv.tv_usec);
 	return 0;
@@ -88,15 +88,12 @@ static int bare_time_adjust_freq(struct pp_instance *ppi, long freq_ppb)
 	return bare_time_adjust(ppi, 0, freq_ppb);
 }
 
-static unsigned long bare_calc_timeout(struct pp_instance *ppi, int millisec)
+static uint64_t bare_calc_timeout(struct pp_instance *ppi, int64_t nsec)
 {
 	struct bare_timespec now;
-	uint64_t now_ms;
 
 	sys_clock_gettime(CLOCK_MONOTONIC, &now);
-	now_ms = 1000LL * now.tv_sec + now.tv_nsec / 1000 / 1000;
-
-	return now_ms + millisec;
+	return 1000LL * 1000 * 1000 * now.tv_sec + now.tv_nsec + nsec;
 }
 
 struct pp_time_operations bare_time_ops = {
@@ -5,200 +5,193 @@
  * Released according to the GNU LGPL, version 2.1 or any later version.
  */
 
-/* Socket interface for GNU/Linux (and most likely other posix systems) */
+/*
+ * Network interface for the simulator. Frames never leave the process:
+ * sending copies the frame in a buffer attached to the pending event of
+ * the peer port, and receiving returns it. So the simulation doesn't
+ * depend on the host network, and it only costs a memcpy per frame.
+ */
 
 #include <stdlib.h>
-#include <unistd.h>
-#include <errno.h>
-#include <sys/socket.h>
 
 #include <ppsi/ppsi.h>
 #include "ptpdump.h"
 #include "../arch-sim/ppsi-sim.h"
 
-#define PP_MASTER_GEN_PORT	(10000 + PP_GEN_PORT)
-#define PP_MASTER_EVT_PORT	(10000 + PP_EVT_PORT)
-#define PP_SLAVE_GEN_PORT	(20000 + PP_GEN_PORT)
-#define PP_SLAVE_EVT_PORT	(20000 + PP_EVT_PORT)
+/* Frame buffers are allocated when needed, and then recycled */
+static struct sim_frame *sim_get_frame(struct sim_world *w)
+{
+	struct sim_frame *f = w->free_frames;
+
+	if (!f) {
+		f = malloc(sizeof(*f));
+		if (!f) {
+			pp_error("%s: out of memory\n", __func__);
+			exit(1);
+		}
+		return f;
+	}
+	w->free_frames = f->next;
+	return f;
+}
+
+static void sim_put_frame(struct sim_world *w, struct sim_frame *f)
+{
+	f->next = w->free_frames;
+	w->free_frames = f;
+}
 
 /* Returns 1 if p1 has higher priority  than p2 */
 static int compare_pending(struct sim_pending_pkt *p1,
 				struct sim_pending_pkt *p2)
 {
 	/* expires earlier ---> higher priority */
-	if (p1->delay_ns < p2->delay_ns)
-		return 1;
+	if (p1->at_ns != p2->at_ns)
+		return p1->at_ns < p2->at_ns;
+	/* same expire time ---> first sent, first received */
+	return p1->seq < p2->seq;
+}
 
-	/* same expire time ---> higher priority to the slave because it has to
-	 * handle Sync and Follow_Up in a row. If both are for the slave handle
-	 * PP_NP_EVT first */
-	if (p1->delay_ns == p2->delay_ns) {
-		if (p1->which_ppi > p2->which_ppi)
-			return 1;
-		if (p1->which_ppi == p2->which_ppi)
-			return (p1->chtype > p2->chtype);
-	}
-	return 0;
+static void swap_pending(struct sim_pending_pkt *p1,
+			 struct sim_pending_pkt *p2)
+{
+	struct sim_pending_pkt tmp = *p1;
+
+	*p1 = *p2;
+	*p2 = tmp;
 }
 
-static int insert_pending(struct sim_ppg_arch_data *data,
+static int insert_pending(struct sim_world *data,
 				struct sim_pending_pkt *new)
 {
-	struct sim_pending_pkt *pkt, tmp;
-	int i = data->n_pending;
-
-	data->pending[i] = *new;
-	pkt = &data->pending[i - 1];
-	while (compare_pending(new, pkt) && (i > 0)) {
-		tmp = *pkt;
-		*pkt = *new;
-		*(pkt + 1) = tmp;
-		pkt--;
-		i--;
+	struct sim_pending_pkt *q = data->pending;
+	int i, parent, size;
+
+	if (data->n_pending == data->max_pending) {
+		size = data->max_pending ? 2 * data->max_pending
+			: SIM_PENDING_MIN;
+		q = realloc(data->pending, size * sizeof(*q));
+		if (!q) {
+			pp_error("%s: out of memory\n", __func__);
+			exit(1);
+		}
+		data->pending = q;
+		data->max_pending = size;
+	}
+	new->seq = data->pending_seq++;
+
+	/* Add as the last leaf, and move it up */
+	i = data->n_pending++;
+	q[i] = *new;
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!compare_pending(&q[i], &q[parent]))
+			break;
+		swap_pending(&q[i], &q[parent]);
+		i = parent;
 	}
-	data->n_pending++;
 	return 0;
 }
 
-static int pending_received(struct sim_ppg_arch_data *data)
+static int pending_received(struct sim_world *data)
 {
-	int i;
+	struct sim_pending_pkt *q = data->pending;
+	int i, child, n;
 
 	if (data->n_pending == 0)
 		return 0;
-	for (i = 0; i < data->n_pending; i++)
-		data->pending[i] = data->pending[i+1];
-	data->n_pending--;
+	/* Move the last leaf to the root, and then down */
+	n = --data->n_pending;
+	q[0] = q[n];
+	for (i = 0; (child = 2 * i + 1) < n; i = child) {
+		if (child + 1 < n && compare_pending(&q[child + 1], &q[child]))
+			child++;
+		if (!compare_pending(&q[child], &q[i]))
+			break;
+		swap_pending(&q[i], &q[child]);
+	}
 	return 0;
 }
 
-static int sim_recv_msg(struct pp_instance *ppi, int fd, void *pkt, int len,
-			  struct pp_time *t)
+static int sim_net_recv(struct pp_instance *ppi, void *pkt, int len,
+		   struct pp_time *t)
 {
-	ssize_t ret;
-	struct msghdr msg;
-	struct iovec vec[1];
-	int64_t master_ns, slave_ns;
-	struct pp_globals *ppg = GLBS(ppi);
-	struct sim_ppg_arch_data *data = SIM_PPG_ARCH(ppg);
-
-	union {
-		struct cmsghdr cm;
-		char control[512];
-	} cmsg_un;
+	struct sim_world *data = SIM_WORLD(ppi->glbs);
+	struct sim_pending_pkt *pending = sim_first_pending(data);
+	struct sim_frame *f;
+	int64_t ref_ns, our_ns;
+	int ret, msgtype;
 
-	vec[0].iov_base = pkt;
-	vec[0].iov_len = PP_MAX_FRAME_LENGTH;
-
-	memset(&msg, 0, sizeof(msg));
-	memset(&cmsg_un, 0, sizeof(cmsg_un));
-
-	/* msg_name, msg_namelen == 0: not used */
-	msg.msg_iov = vec;
-	msg.msg_iovlen = 1;
-	msg.msg_control = cmsg_un.control;
-	msg.msg_controllen = sizeof(cmsg_un.control);
-
-	ret = recvmsg(fd, &msg, 0);
-	if (ret <= 0) {
-		if (errno == EAGAIN || errno == EINTR)
-			return 0;
-
-		return ret;
-	}
-	if (msg.msg_flags & MSG_TRUNC) {
-		pp_error("%s: truncated message\n", __func__);
-		return 0;
-	}
-	/* get time stamp of packet */
-	if (msg.msg_flags & MSG_CTRUNC) {
-		pp_error("%s: truncated ancillary data\n", __func__);
+	/*
+	 * We can return one frame only: the main loop calls us for the
+	 * destination of the first pending one.
+	 */
+	if (!pending || pending->which_ppi != pp_sim_port_idx(ppi))
 		return 0;
-	}
+	f = pending->frame;
+	ret = f->len < len ? f->len : len;
+	memcpy(pkt, f->data, ret);
+	sim_put_frame(data, f);
+	/* remove received packet from pending */
+	pending_received(data);
 
 	ppi->t_ops->get(ppi, t);
 	/* This is not really hw... */
 	pp_diag(ppi, time, 2, "recv stamp: %i.%09i (%s)\n",
 		(int)t->secs, (int)(t->scaled_nsecs >> 16), "user");
-	/* If we got a DelayResponse print out the offset from master */
-	if (((*(Enumeration4 *) (pkt + 0)) & 0x0F) == PPM_DELAY_RESP) {
-		master_ns = SIM_PPI_ARCH(INST(ppg, SIM_MASTER))->time.current_ns;
-		slave_ns = SIM_PPI_ARCH(INST(ppg, SIM_SLAVE))->time.current_ns;
-		pp_diag(ppi, ext, 1, "Real ofm %lli\n",
-					(long long)slave_ns - master_ns);
-		data->sim_iter_n++;
-	}
-	return ret;
-}
+	if (pp_diag_allow(ppi, frames, 2))
+		dump_payloadpkt("recv: ", pkt, ret, t);
 
-static int sim_net_recv(struct pp_instance *ppi, void *pkt, int len,
-		   struct pp_time *t)
-{
-	struct sim_ppg_arch_data *data = SIM_PPG_ARCH(ppi->glbs);
-	struct pp_channel *ch;
-	int ret;
 	/*
-	 * only UDP
-	 * We can return one frame only. Look in the global structure to know if
-	 * the pending packet is on PP_NP_GEN or PP_NP_EVT
+	 * If we got a DelayResponse print out the offset from the first node
+	 * (the master, in the default setup). Iterations are counted on the
+	 * last node, the farthest one in a chain. A sync-only slave never
+	 * gets a DelayResponse, so it counts its Sync frames instead.
 	 */
-	if (data->n_pending <= 0)
-		return 0;
-
-	ch = &(ppi->ch[data->pending->chtype]);
-
-	ret = -1;
-	if (ch->pkt_present > 0) {
-		ret = sim_recv_msg(ppi, ch->fd, pkt, len, t);
-		if (ret > 0)
-			ch->pkt_present--;
+	msgtype = (*(Enumeration4 *) (pkt + 0)) & 0x0F;
+	if (msgtype == (ppi->cfg.servo == PPSI_SERVO_SYNC_ONLY
+			? PPM_SYNC : PPM_DELAY_RESP)) {
+		ref_ns = SIM_PPG_ARCH(data->nodes[0])->time.current_ns;
+		our_ns = SIM_TIME(ppi)->current_ns;
+		pp_diag(ppi, ext, 1, "Real ofm %lli\n",
+					(long long)our_ns - ref_ns);
+		if (GLBS(ppi) == data->nodes[data->n_nodes - 1]) {
+			data->sim_iter_n++;
+			sim_stats_sample(data, our_ns - ref_ns);
+		}
 	}
-
-	if (ret > 0 && pp_diag_allow(ppi, frames, 2))
-		dump_payloadpkt("recv: ", pkt, ret, t);
-	/* remove received packet from pending */
-	pending_received(SIM_PPG_ARCH(ppi->glbs));
 	return ret;
 }
 
 static int sim_net_send(struct pp_instance *ppi, void *pkt, int len,
 			int msgtype)
 {
-	int chtype = pp_msgtype_info[msgtype].chtype;
 	struct pp_time *t = &ppi->last_snt_time;
 	struct sim_ppi_arch_data *data = SIM_PPI_ARCH(ppi);
-	struct sockaddr_in addr;
+	struct sim_world *w = SIM_WORLD(ppi->glbs);
 	struct sim_pending_pkt pending;
 	int64_t jit_ns = 0;
-	int ret;
 
-	/* only UDP */
-	addr.sin_family = AF_INET;
-	if (pp_sim_is_slave(ppi))
-		addr.sin_port = htons(chtype == PP_NP_GEN ?
-					PP_MASTER_GEN_PORT :
-					PP_MASTER_EVT_PORT);
-	else
-		addr.sin_port = htons(chtype == PP_NP_GEN ?
-					PP_SLAVE_GEN_PORT :
-					PP_SLAVE_EVT_PORT);
-
-	addr.sin_addr.s_addr = ppi->mcast_addr[0];
-
-	if (t)
+	if (len > PP_MAX_FRAME_LENGTH)
+		return -1;
+	if (t) {
 		ppi->t_ops->get(ppi, t);
+		msg_set_one_step_stamp(pkt, msgtype, t);
+	}
 
-	ret = sendto(ppi->ch[chtype].fd, pkt, len, 0,
-		(struct sockaddr *)&addr, sizeof(struct sockaddr_in));
 	if (pp_diag_allow(ppi, frames, 2))
 		dump_payloadpkt("send: ", pkt, len, t);
 
+	if (sim_link_lost(w, &data->n_delay)) {
+		pp_diag(ppi, frames, 1, "send: lost on the link\n");
+		return len;
+	}
+
 	/* store pending packets in global structure */
-	pending.chtype = chtype;
-	if (pp_sim_is_master(ppi))
-		pending.which_ppi = SIM_SLAVE;
-	else
-		pending.which_ppi = SIM_MASTER;
+	pending.which_ppi = pp_sim_port_idx(data->peer);
+	pending.frame = sim_get_frame(w);
+	pending.frame->len = len;
+	memcpy(pending.frame->data, pkt, len);
 
 	/* check if we are sending a FollowUp. In this case we have to add the
 	 * previous jitter, that was added to the previous Sync.
@@ -215,104 +208,40 @@ static int sim_net_send(struct pp_instance *ppi, void *pkt, int len,
 	if (((*(Enumeration4 *) (pkt + 0)) & 0x0F) == PPM_FOLLOW_UP) {
 		jit_ns += data->n_delay.last_outgoing_jit_ns;
 	}
-	jit_ns += (rand() * data->n_delay.jit_ns) / RAND_MAX;
+	jit_ns += sim_link_jitter(w, &data->n_delay);
 	/* store the jitter, used from the next send if it is a FollowUp */
 	data->n_delay.last_outgoing_jit_ns = jit_ns;
 
-	pending.delay_ns = data->n_delay.t_prop_ns + jit_ns;
-	insert_pending(SIM_PPG_ARCH(ppi->glbs), &pending);
-	data->other_ppi->ch[chtype].pkt_present++;
-	return ret;
+	pending.at_ns = w->now_ns + data->n_delay.t_prop_ns + jit_ns;
+	insert_pending(w, &pending);
+	return len;
 }
 
 static int sim_net_exit(struct pp_instance *ppi)
 {
-	int fd;
-	int i;
-
-	/* only UDP */
-	for (i = PP_NP_GEN; i <= PP_NP_EVT; i++) {
-		fd = ppi->ch[i].fd;
-		if (fd < 0)
-			continue;
-		close(fd);
-		ppi->ch[i].fd = -1;
-	}
-	return 0;
-}
-
-static int sim_open_ch(struct pp_instance *ppi, char *ifname, int chtype)
-{
-
-	int sock = -1;
-	int temp;
-	struct sockaddr_in addr;
-	char *context;
-
-	/* only UDP */
-	context = "socket()";
-	sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	if (sock < 0)
-		goto err_out;
-
-	ppi->ch[chtype].fd = sock;
-
-	temp = 1; /* allow address reuse */
-	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &temp, sizeof(int)) < 0)
-		pp_printf("%s: ioctl(SO_REUSEADDR): %s\n", __func__,
-			  strerror(errno));
-
-	/* bind sockets */
-	/* need INADDR_ANY to allow receipt of multi-cast and uni-cast
-	 * messages */
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = htonl(INADDR_ANY);
-	if (pp_sim_is_master(ppi))
-		addr.sin_port = htons(chtype == PP_NP_GEN ?
-					PP_MASTER_GEN_PORT :
-					PP_MASTER_EVT_PORT);
-	else
-		addr.sin_port = htons(chtype == PP_NP_GEN ?
-					PP_SLAVE_GEN_PORT :
-					PP_SLAVE_EVT_PORT);
-	context = "bind()";
-	if (bind(sock, (struct sockaddr *)&addr,
-		 sizeof(struct sockaddr_in)) < 0)
-		goto err_out;
-
-	ppi->ch[chtype].fd = sock;
-	/*
-	 * Standard ppsi state machine is designed to drop packets coming from
-	 * itself, based on the clockIdentity. This hack avoids this behaviour,
-	 * changing the clockIdentity of the master.
-	 */
-	if (pp_sim_is_master(ppi))
-		memset(ppi->ch[chtype].addr, 111, 1);
 	return 0;
-
-err_out:
-	pp_printf("%s: %s: %s\n", __func__, context, strerror(errno));
-	if (sock >= 0)
-		close(sock);
-	ppi->ch[chtype].fd = -1;
-	return -1;
 }
 
 static int sim_net_init(struct pp_instance *ppi)
 {
-	int i;
-
-	if (ppi->ch[0].fd > 0)
-		sim_net_exit(ppi);
+	int i, node;
 
 	/* The buffer is inside ppi, but we need to set pointers and align */
 	pp_prepare_pointers(ppi);
 
 	/* only UDP, RAW is not supported */
 	pp_diag(ppi, frames, 1, "sim_net_init UDP\n");
+	/*
+	 * Standard ppsi state machine is designed to drop packets coming from
+	 * itself, based on the clockIdentity. So each node gets its own
+	 * (locally administered) MAC address, from which the identity is built.
+	 */
+	node = pp_sim_node_idx(GLBS(ppi)) + 1;
 	for (i = PP_NP_GEN; i <= PP_NP_EVT; i++) {
-		if (sim_open_ch(ppi, ppi->port_name, i))
-			return -1;
+		memset(ppi->ch[i].addr, 0, sizeof(ppi->ch[i].addr));
+		ppi->ch[i].addr[0] = 0x02;
+		ppi->ch[i].addr[4] = node >> 8;
+		ppi->ch[i].addr[5] = node;
 	}
 	return 0;
 }
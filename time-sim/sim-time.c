@@ -6,8 +6,8 @@
  */
 
 /*
- * Time operations for the simulator, design to be used both for
- * master and the slave instance.
+ * Time operations for the simulator: each node has its own clock, shared
+ * by its ports.
  */
 
 #include <time.h>
@@ -15,32 +15,28 @@
 #include <ppsi/ppsi.h>
 #include "../arch-sim/ppsi-sim.h"
 
-int sim_fast_forward_ns(struct pp_globals *ppg, int64_t ff_ns)
+int sim_fast_forward_ns(struct sim_world *w, int64_t ff_ns)
 {
 	struct pp_sim_time_instance *t_inst;
+	struct sim_pending_pkt *pkt;
 	int i;
 	int64_t tmp;
 
-	for (i = 0; i < ppg->nlinks; i++) {
-		t_inst = &SIM_PPI_ARCH(INST(ppg, i))->time;
+	for (i = 0; i < w->n_nodes; i++) {
+		t_inst = &SIM_PPG_ARCH(w->nodes[i])->time;
 		tmp = ff_ns + t_inst->freq_ppb_real * ff_ns / 1000 / 1000 / 1000;
 		t_inst->current_ns += tmp + (t_inst->freq_ppb_servo) *
 						tmp / 1000 / 1000 / 1000;
 	}
 	pp_diag(0, ext, 2, "%s: %lli ns\n", __func__, (long long)ff_ns);
 
-	struct sim_pending_pkt *pkt;
-	struct sim_ppg_arch_data *data = SIM_PPG_ARCH(ppg);
-	if (data->n_pending) {
-		for (i = 0; i < data->n_pending; i++) {
-			pkt = &data->pending[i];
-			pkt->delay_ns -= ff_ns;
-			if (pkt->delay_ns < 0) {
-				pp_error("pkt->delay_ns = %lli\n",
-						(long long)pkt->delay_ns);
-				exit(1);
-			}
-		}
+	/* Frames are never late: we only move to the first one's time */
+	w->now_ns += ff_ns;
+	pkt = sim_first_pending(w);
+	if (pkt && pkt->at_ns < w->now_ns) {
+		pp_error("pkt->at_ns = %lli, now %lli\n",
+			 (long long)pkt->at_ns, (long long)w->now_ns);
+		exit(1);
 	}
 
 	return 0;
@@ -48,12 +44,12 @@ int sim_fast_forward_ns(struct pp_globals *ppg, int64_t ff_ns)
 
 static int sim_time_get(struct pp_instance *ppi, struct pp_time *t)
 {
-	t->scaled_nsecs = (SIM_PPI_ARCH(ppi)->time.current_ns %
+	t->scaled_nsecs = (SIM_TIME(ppi)->current_ns %
 			   (long long)PP_NSEC_PER_SEC) << 16;
-	t->secs = SIM_PPI_ARCH(ppi)->time.current_ns /
+	t->secs = SIM_TIME(ppi)->current_ns /
 		(long long)PP_NSEC_PER_SEC;
 
-	if (!(pp_global_d_flags & PP_FLAG_NOTIMELOG))
+	if (!(GLBS(ppi)->d_flags & PP_FLAG_NOTIMELOG))
 		pp_diag(ppi, time, 2, "%s: %9li.%09li\n", __func__,
 			(long)t->secs, (long)(t->scaled_nsecs >> 16));
 	return 0;
@@ -66,7 +62,7 @@ static int sim_time_set(struct pp_instance *ppi, const struct pp_time *t)
 		return 0;
 	}
 
-	SIM_PPI_ARCH(ppi)->time.current_ns = (t->scaled_nsecs >> 16)
+	SIM_TIME(ppi)->current_ns = (t->scaled_nsecs >> 16)
 				+ t->secs * (long long)PP_NSEC_PER_SEC;
 
 	pp_diag(ppi, time, 1, "%s: %9i.%09i\n", __func__,
@@ -82,11 +78,11 @@ static int sim_time_adjust(struct pp_instance *ppi, long offset_ns,
 			freq_ppb = PP_ADJ_FREQ_MAX;
 		if (freq_ppb < -PP_ADJ_FREQ_MAX)
 			freq_ppb = -PP_ADJ_FREQ_MAX;
-		SIM_PPI_ARCH(ppi)->time.freq_ppb_servo = freq_ppb;
+		SIM_TIME(ppi)->freq_ppb_servo = freq_ppb;
 	}
 
 	if (offset_ns)
-		SIM_PPI_ARCH(ppi)->time.current_ns += offset_ns;
+		SIM_TIME(ppi)->current_ns += offset_ns;
 
 	pp_diag(ppi, time, 1, "%s: %li %li\n", __func__, offset_ns, freq_ppb);
 	return 0;
@@ -104,12 +100,18 @@ static int sim_adjust_offset(struct pp_instance *ppi, long offset_ns)
 
 static inline int sim_init_servo(struct pp_instance *ppi)
 {
-	return SIM_PPI_ARCH(ppi)->time.freq_ppb_real;
+	/*
+	 * Like adjtimex in time-unix: what the servo set, not the drift.
+	 * PI keeps starting from the drift, as it always did here.
+	 */
+	if (ppi->cfg.servo == PPSI_SERVO_PI)
+		return SIM_TIME(ppi)->freq_ppb_real;
+	return SIM_TIME(ppi)->freq_ppb_servo;
 }
 
-static unsigned long sim_calc_timeout(struct pp_instance *ppi, int millisec)
+static uint64_t sim_calc_timeout(struct pp_instance *ppi, int64_t nsec)
 {
-	return millisec + SIM_PPI_ARCH(ppi)->time.current_ns / 1000LL / 1000LL;
+	return nsec + SIM_TIME(ppi)->current_ns;
 }
 
 struct pp_time_operations sim_time_ops = {
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+
+/*
+ * In-kernel filtering of PTP sockets. We build a classic BPF program for
+ * each port, so the kernel drops what pp_packet_prefilter() and
+ * fsm_unpack_verify_frame() would discard anyways: frames for another
+ * domain, PTP version or VLAN, alternate-master frames, short frames and
+ * frames we sent ourselves. They then never wake us up.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <ppsi/ppsi.h>
+#include "../arch-unix/ppsi-unix.h"
+
+#define UNIX_BPF_MAX	(32 + CONFIG_VLAN_ARRAY_SIZE)
+
+/* The program, and which of its jumps must go to the final "drop" */
+struct unix_bpf {
+	int n;
+	struct sock_filter f[UNIX_BPF_MAX];
+	uint8_t to_drop[UNIX_BPF_MAX]; /* 1: jt, 2: jf, 3: k (ja) */
+};
+
+static void bpf_add(struct unix_bpf *p, int code, uint32_t k, int jt, int jf,
+		    int to_drop)
+{
+	struct sock_filter f = BPF_JUMP(code, k, jt, jf);
+
+	p->to_drop[p->n] = to_drop;
+	p->f[p->n++] = f;
+}
+
+static void bpf_load(struct unix_bpf *p, int size, uint32_t offset)
+{
+	bpf_add(p, BPF_LD | size | BPF_ABS, offset, 0, 0, 0);
+}
+
+/* Go on if the accumulator is k, or drop the frame */
+static void bpf_require(struct unix_bpf *p, uint32_t k)
+{
+	bpf_add(p, BPF_JMP | BPF_JEQ | BPF_K, k, 0, 0, 2);
+}
+
+/* Fix the jumps to "drop", that is after the final "accept" */
+static void bpf_finish(struct unix_bpf *p)
+{
+	int i, drop;
+
+	bpf_add(p, BPF_RET | BPF_K, 0xffffffff, 0, 0, 0);
+	bpf_add(p, BPF_RET | BPF_K, 0, 0, 0, 0);
+	drop = p->n - 1;
+	for (i = 0; i < p->n; i++) {
+		if (p->to_drop[i] == 1)
+			p->f[i].jt = drop - i - 1;
+		if (p->to_drop[i] == 2)
+			p->f[i].jf = drop - i - 1;
+		if (p->to_drop[i] == 3)
+			p->f[i].k = drop - i - 1;
+	}
+}
+
+static void unix_bpf_build(struct pp_instance *ppi, int chtype,
+			   struct unix_bpf *p)
+{
+	int i, ptp, nvlans;
+
+	if (ppi->proto == PPSI_PROTO_UDP) {
+		/* The filter of an UDP socket sees the UDP header first */
+		ptp = 8;
+		bpf_load(p, BPF_H, 2);
+		bpf_require(p, chtype == PP_NP_GEN ? PP_GEN_PORT : PP_EVT_PORT);
+	} else {
+		/* Raw sockets see our outgoing frames, if bound to ETH_P_ALL */
+		ptp = ETH_HLEN;
+		bpf_load(p, BPF_B, SKF_AD_OFF + SKF_AD_PKTTYPE);
+		bpf_add(p, BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING,
+			0, 0, 1);
+		/* The VLAN tag has been stripped, like recv expects */
+		bpf_load(p, BPF_H, offsetof(struct ethhdr, h_proto));
+		bpf_require(p, ETH_P_1588);
+	}
+
+	if (ppi->proto == PPSI_PROTO_VLAN) {
+		/* Accept any of our VLANs: jump over the final "ja drop" */
+		nvlans = ppi->nvlans;
+		bpf_load(p, BPF_W, SKF_AD_OFF + SKF_AD_VLAN_TAG);
+		bpf_add(p, BPF_ALU | BPF_AND | BPF_K, 0xfff, 0, 0, 0);
+		for (i = 0; i < nvlans; i++)
+			bpf_add(p, BPF_JMP | BPF_JEQ | BPF_K, ppi->vlans[i],
+				nvlans - i, 0, 0);
+		bpf_add(p, BPF_JMP | BPF_JA, 0, 0, 0, 3);
+	}
+
+	/* Now the PTP header: length, version, domain, alternate master */
+	bpf_add(p, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0, 0);
+	bpf_add(p, BPF_JMP | BPF_JGE | BPF_K, ptp + PP_HEADER_LENGTH,
+		0, 0, 2);
+	bpf_load(p, BPF_B, ptp + 1);
+	bpf_add(p, BPF_ALU | BPF_AND | BPF_K, 0xf, 0, 0, 0);
+	bpf_require(p, 2);
+	bpf_load(p, BPF_B, ptp + 4);
+	bpf_require(p, GDSDEF(GLBS(ppi))->domainNumber);
+	bpf_load(p, BPF_B, ptp + 6);
+	bpf_add(p, BPF_JMP | BPF_JSET | BPF_K, PP_ALTERNATE_MASTER_FLAG,
+		0, 0, 1);
+	bpf_finish(p);
+}
+
+/* Failing is not fatal: frames are checked again in user space anyways */
+int unix_attach_filter(struct pp_instance *ppi, int chtype)
+{
+	struct unix_bpf p;
+	struct sock_fprog prog;
+
+	p.n = 0;
+	unix_bpf_build(ppi, chtype, &p);
+	prog.len = p.n;
+	prog.filter = p.f;
+	if (setsockopt(ppi->ch[chtype].fd, SOL_SOCKET, SO_ATTACH_FILTER,
+		       &prog, sizeof(prog)) < 0) {
+		pp_diag(ppi, frames, 1, "SO_ATTACH_FILTER: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	pp_diag(ppi, frames, 2, "attached a %i-instruction filter\n", p.n);
+	return 0;
+}
@@ -7,87 +7,498 @@
  */
 
 /* Socket interface for GNU/Linux (and most likely other posix systems) */
+#define _GNU_SOURCE /* recvmmsg */
 
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <net/ethernet.h>
 #include <arpa/inet.h>
 #include <linux/if_packet.h>
 #include <linux/if_vlan.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <poll.h>
 
 #include <ppsi/ppsi.h>
 #include "ptpdump.h"
 #include "../arch-unix/ppsi-unix.h"
 
-/* unix_recv_msg uses recvmsg for timestamp query */
-static int unix_recv_msg(struct pp_instance *ppi, int fd, void *pkt, int len,
-			 struct pp_time *t)
+/*
+ * Frames are read with recvmmsg, up to CONFIG_RECV_BATCH at a time, and
+ * handed out in arrival order by the following recv calls. Each frame
+ * keeps its own ancillary data, so its timestamp is not lost.
+ */
+struct unix_rx_batch {
+	int next, count;
+	int no_mmsg;		/* kernel lacks recvmmsg: use recvmsg */
+	struct mmsghdr mmsg[CONFIG_RECV_BATCH];
+	struct iovec vec[CONFIG_RECV_BATCH];
+	unsigned char frame[CONFIG_RECV_BATCH][PP_MAX_FRAME_LENGTH];
+	struct sockaddr_in from[CONFIG_RECV_BATCH]; /* UDP: for unicast */
+	union {
+		struct cmsghdr cm;
+		char control[512];
+	} cmsg_un[CONFIG_RECV_BATCH];
+
+	/* Raw Ethernet may use a TPACKET_V3 ring instead (ring != NULL) */
+	void *ring;
+	int ring_cur;			/* block being read */
+	int ring_left;			/* frames left in ring_cur */
+	struct tpacket3_hdr *ring_frame; /* next frame, if we own ring_cur */
+
+	/* SO_TIMESTAMPING: kernel software stamps, TX ones by OPT_ID */
+	int kstamps;
+	uint32_t tx_id;			/* id of the next frame we send */
+	int64_t tx_late_ns;		/* kernel stamp - user stamp, averaged */
+};
+
+#define UNIX_RING_BLKSIZE	(1 << 16)
+#define UNIX_RING_FRAMESIZE	(1 << 11)
+
+static struct unix_rx_batch **unix_rx_batch_of(struct pp_instance *ppi,
+					       int chtype)
 {
-	struct ethhdr *hdr = pkt;
-	ssize_t ret;
+	struct pp_globals *ppg = GLBS(ppi);
+
+	return &POSIX_ARCH(ppg)->batch[ppi - ppg->pp_instances][chtype];
+}
+
+static int unix_rx_fill(struct unix_rx_batch *b, int fd)
+{
+	struct msghdr *msg;
+	int i, n;
+
+	for (i = 0; i < CONFIG_RECV_BATCH; i++) {
+		msg = &b->mmsg[i].msg_hdr;
+		b->vec[i].iov_base = b->frame[i];
+		b->vec[i].iov_len = PP_MAX_FRAME_LENGTH;
+
+		memset(msg, 0, sizeof(*msg));
+		msg->msg_name = b->from + i;
+		msg->msg_namelen = sizeof(b->from[i]);
+		msg->msg_iov = b->vec + i;
+		msg->msg_iovlen = 1;
+		msg->msg_control = b->cmsg_un[i].control;
+		msg->msg_controllen = sizeof(b->cmsg_un[i].control);
+	}
+	if (!b->no_mmsg) {
+		n = recvmmsg(fd, b->mmsg, CONFIG_RECV_BATCH, MSG_DONTWAIT,
+			     NULL);
+		if (n >= 0 || errno != ENOSYS)
+			return n;
+		b->no_mmsg = 1;
+	}
+	n = recvmsg(fd, &b->mmsg[0].msg_hdr, MSG_DONTWAIT);
+	if (n < 0)
+		return n;
+	b->mmsg[0].msg_len = n;
+	return 1;
+}
+
+/*
+ * Copy the next frame of the channel to pkt, reading a new batch when
+ * the previous one is over, and return its length (0 if none). The
+ * message header, with the ancillary data, is valid until the next call.
+ * pkt_present tells whether more frames are already queued.
+ */
+int unix_recv_batch(struct pp_instance *ppi, int chtype, void *pkt, int len,
+		    struct msghdr **msgp)
+{
+	struct pp_channel *ch = ppi->ch + chtype;
+	struct unix_rx_batch *b = *unix_rx_batch_of(ppi, chtype);
+	struct mmsghdr *mm;
+	int n;
+
+	if (!b) {
+		ch->pkt_present = 0;
+		return -1;
+	}
+	if (b->next == b->count) {
+		b->next = b->count = 0;
+		n = unix_rx_fill(b, ch->fd);
+		if (n <= 0) {
+			ch->pkt_present = 0;
+			if (n < 0 && (errno == EAGAIN || errno == EINTR))
+				return 0;
+			return n;
+		}
+		b->count = n;
+	}
+	mm = b->mmsg + b->next++;
+	ch->pkt_present = b->count - b->next;
+
+	if (len > mm->msg_len)
+		len = mm->msg_len;
+	memcpy(pkt, mm->msg_hdr.msg_iov->iov_base, len);
+	*msgp = &mm->msg_hdr;
+	return len;
+}
+
+/*
+ * Map a TPACKET_V3 ring on a raw socket. Failure is not an error: the
+ * channel then uses recvmmsg() like before.
+ */
+static void unix_rx_ring_open(struct pp_instance *ppi, int chtype)
+{
+	struct unix_rx_batch *b = *unix_rx_batch_of(ppi, chtype);
+	int fd = ppi->ch[chtype].fd;
+	int v = TPACKET_V3;
+	struct tpacket_req3 req;
+	void *ring;
+
+	if (!CONFIG_RX_RING_BLOCKS || !b)
+		return;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = UNIX_RING_BLKSIZE;
+	req.tp_block_nr = CONFIG_RX_RING_BLOCKS;
+	req.tp_frame_size = UNIX_RING_FRAMESIZE;
+	req.tp_frame_nr = req.tp_block_size * req.tp_block_nr
+		/ req.tp_frame_size;
+	req.tp_retire_blk_tov = 1; /* ms: don't hold a partial block longer */
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) < 0
+	    || setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req,
+			  sizeof(req)) < 0) {
+		pp_diag(ppi, frames, 1, "no TPACKET_V3 ring: %s\n",
+			strerror(errno));
+		return;
+	}
+	ring = mmap(NULL, UNIX_RING_BLKSIZE * CONFIG_RX_RING_BLOCKS,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+	if (ring == MAP_FAILED) /* MAP_LOCKED may exceed RLIMIT_MEMLOCK */
+		ring = mmap(NULL, UNIX_RING_BLKSIZE * CONFIG_RX_RING_BLOCKS,
+			    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		pp_diag(ppi, frames, 1, "mmap(rx ring): %s\n",
+			strerror(errno));
+		memset(&req, 0, sizeof(req));
+		setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		return;
+	}
+	b->ring = ring;
+	b->ring_cur = b->ring_left = 0;
+	b->ring_frame = NULL;
+	pp_diag(ppi, frames, 1, "TPACKET_V3 ring: %i blocks of %i bytes\n",
+		CONFIG_RX_RING_BLOCKS, UNIX_RING_BLKSIZE);
+}
+
+static void unix_rx_ring_close(struct unix_rx_batch *b)
+{
+	if (b && b->ring)
+		munmap(b->ring, UNIX_RING_BLKSIZE * CONFIG_RX_RING_BLOCKS);
+}
+
+static inline struct tpacket_block_desc *unix_ring_block(
+	struct unix_rx_batch *b, int i)
+{
+	return b->ring + i * UNIX_RING_BLKSIZE;
+}
+
+/*
+ * We own block ring_cur while ring_frame is set: it goes back to the kernel
+ * whole, as soon as its last frame is checked (and copied out, if ours).
+ */
+static void unix_ring_release(struct unix_rx_batch *b)
+{
+	struct tpacket_block_desc *bd = unix_ring_block(b, b->ring_cur);
+
+	if (b->ring_left || !b->ring_frame)
+		return;
+	__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+			 __ATOMIC_RELEASE);
+	if (++b->ring_cur == CONFIG_RX_RING_BLOCKS)
+		b->ring_cur = 0;
+	b->ring_frame = NULL;
+}
+
+/* Return the next frame in the ring, NULL if the kernel has no more */
+static struct tpacket3_hdr *unix_ring_next(struct unix_rx_batch *b)
+{
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *h;
+
+	while (!b->ring_left) {
+		unix_ring_release(b); /* the last frame was not ours */
+		bd = unix_ring_block(b, b->ring_cur);
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status,
+				      __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			return NULL;
+		b->ring_left = bd->hdr.bh1.num_pkts;
+		b->ring_frame = (void *)bd + bd->hdr.bh1.offset_to_first_pkt;
+	}
+	h = b->ring_frame;
+	b->ring_frame = (void *)h + h->tp_next_offset;
+	b->ring_left--;
+	return h;
+}
+
+/* Is another frame ready? For pkt_present, so the main loop drains us */
+static int unix_ring_pending(struct unix_rx_batch *b)
+{
+	struct tpacket_block_desc *bd;
+	int cur = b->ring_cur;
+
+	if (b->ring_left)
+		return 1;
+	if (b->ring_frame && ++cur == CONFIG_RX_RING_BLOCKS)
+		cur = 0;
+	bd = unix_ring_block(b, cur);
+	return !!(__atomic_load_n(&bd->hdr.bh1.block_status,
+				  __ATOMIC_ACQUIRE) & TP_STATUS_USER);
+}
+
+/*
+ * Receive from the ring: frames are checked in place, and only PTP
+ * frames for one of our VLANs are copied out. The kernel timestamp
+ * and the VLAN tag are in the frame header, no cmsg is involved.
+ */
+static int unix_recv_ring(struct pp_instance *ppi, int chtype, void *pkt,
+			  int len, struct pp_time *t)
+{
+	struct pp_channel *ch = ppi->ch + chtype;
+	struct unix_rx_batch *b = *unix_rx_batch_of(ppi, chtype);
+	struct tpacket3_hdr *h;
+	struct ethhdr *hdr;
+	int i, vid;
+
+	while (1) {
+		h = unix_ring_next(b);
+		if (!h) {
+			ch->pkt_present = 0;
+			return 0;
+		}
+		hdr = (void *)h + h->tp_mac;
+		/* With PROTO_VLAN, we bound to ETH_P_ALL: we get all frames */
+		if (hdr->h_proto != htons(ETH_P_1588))
+			continue;
+		if (ppi->proto != PPSI_PROTO_VLAN) {
+			ppi->peer_vid = 0;
+			break;
+		}
+		vid = (h->tp_status & TP_STATUS_VLAN_VALID)
+			? h->hv1.tp_vlan_tci & 0xfff : 0;
+		for (i = 0; i < ppi->nvlans; i++)
+			if (ppi->vlans[i] == vid)
+				break;
+		if (i == ppi->nvlans)
+			continue; /* not ours */
+		ppi->peer_vid = vid;
+		break;
+	}
+	if (h->tp_snaplen < h->tp_len) {
+		pp_error("%s: truncated message\n", __func__);
+		len = -2; /* like "dropped" */
+	} else {
+		if (len > h->tp_snaplen)
+			len = h->tp_snaplen;
+		memcpy(pkt, hdr, len);
+		t->secs = h->tp_sec + DSPRO(ppi)->currentUtcOffset;
+		t->scaled_nsecs = (uint64_t)h->tp_nsec << 16;
+	}
+	unix_ring_release(b);
+	ch->pkt_present = unix_ring_pending(b);
+	if (len < 0)
+		return len;
+
+	if (ppsi_drop_rx(GLBS(ppi))) {
+		pp_diag(ppi, frames, 1, "Drop received frame\n");
+		return -2;
+	}
+	pp_diag(ppi, time, 1, "recv stamp: %lli.%09i (%s)\n",
+		(long long)t->secs, (int)(t->scaled_nsecs >> 16), "ring");
+	return len;
+}
+
+/*
+ * Kernel software stamps have ns resolution, and don't include our
+ * scheduling latency. Without them, we keep SO_TIMESTAMP for RX and
+ * t_ops->get() before sending, like we always did.
+ */
+static void unix_kstamps_open(struct pp_instance *ppi, int chtype)
+{
+	struct unix_rx_batch *b = *unix_rx_batch_of(ppi, chtype);
+	int fd = ppi->ch[chtype].fd;
+	int zero = 0, flags = SOF_TIMESTAMPING_TX_SOFTWARE
+		| SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+		| SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+	if (!b)
+		return;
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+		       sizeof(flags)) < 0) {
+		pp_diag(ppi, frames, 1, "no SO_TIMESTAMPING: %s\n",
+			strerror(errno));
+		return;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &zero, sizeof(zero));
+	b->kstamps = 1;
+	b->tx_id = 0; /* the kernel counts frames from 0 for each socket */
+}
+
+/* Discard what is in the error queue: late TX stamps wake up epoll */
+static void unix_errqueue_drain(int fd)
+{
+	char control[256];
 	struct msghdr msg;
-	struct iovec vec[1];
 	int i;
 
-	union {
-		struct cmsghdr cm;
-		char control[512];
-	} cmsg_un;
+	for (i = 0; i < 16; i++) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			return;
+	}
+}
 
+/* Read the stamp of frame "id" from the error queue, 0 on success */
+static int unix_tx_kstamp(struct pp_instance *ppi, int chtype, uint32_t id,
+			  struct pp_time *t)
+{
+	int fd = ppi->ch[chtype].fd;
+	struct pollfd pfd = {.fd = fd}; /* POLLERR is always reported */
+	struct scm_timestamping *sts;
+	struct sock_extended_err *ee;
 	struct cmsghdr *cmsg;
-	struct timeval *tv;
-	struct tpacket_auxdata *aux = NULL;
+	struct msghdr msg;
+	char control[256];
+	int waited = 0;
+
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			/* Usually the stamp is there when send returns */
+			if (errno != EAGAIN || waited++)
+				return -1;
+			poll(&pfd, 1, 1 /* ms */);
+			continue;
+		}
+		sts = NULL;
+		ee = NULL;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SO_TIMESTAMPING)
+				sts = (void *)CMSG_DATA(cmsg);
+			if ((cmsg->cmsg_level == SOL_IP &&
+			     cmsg->cmsg_type == IP_RECVERR) ||
+			    (cmsg->cmsg_level == SOL_PACKET &&
+			     cmsg->cmsg_type == PACKET_TX_TIMESTAMP))
+				ee = (void *)CMSG_DATA(cmsg);
+		}
+		if (!sts || !ee || ee->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+			continue;
+		if ((int32_t)(ee->ee_data - id) < 0)
+			continue; /* a stamp that came after we gave up */
+		if (ee->ee_data != id)
+			return -1;
+		t->secs = sts->ts[0].tv_sec + DSPRO(ppi)->currentUtcOffset;
+		t->scaled_nsecs = (uint64_t)sts->ts[0].tv_nsec << 16;
+		return 0;
+	}
+}
 
-	vec[0].iov_base = pkt;
-	vec[0].iov_len = PP_MAX_FRAME_LENGTH;
+/*
+ * After sending a frame, replace the user-space stamp in t with the
+ * kernel one, if we have it. Returns the origin, for diagnostics.
+ */
+static char *unix_tx_stamp(struct pp_instance *ppi, int chtype,
+			   struct pp_time *t)
+{
+	struct unix_rx_batch *b = *unix_rx_batch_of(ppi, chtype);
+	int64_t late = -pp_time_to_ns(t);
+
+	if (!b || !b->kstamps)
+		return "user";
+	if (unix_tx_kstamp(ppi, chtype, b->tx_id++, t))
+		return "user";
+	late += pp_time_to_ns(t);
+	if (!b->tx_late_ns) /* first one */
+		b->tx_late_ns = late;
+	b->tx_late_ns += (late - b->tx_late_ns) / 16;
+	return "kernel";
+}
 
-	memset(&msg, 0, sizeof(msg));
-	memset(&cmsg_un, 0, sizeof(cmsg_un));
+/*
+ * One-step Sync: the frame is gone before the kernel stamps it, so it
+ * carries the user stamp, moved by how late kernel stamps were so far.
+ */
+static void unix_one_step_stamp(struct pp_instance *ppi, int chtype,
+				void *ptp, int msgtype, struct pp_time *t)
+{
+	struct unix_rx_batch *b = *unix_rx_batch_of(ppi, chtype);
+	struct pp_time s = *t, late = {0, };
 
-	/* msg_name, msg_namelen == 0: not used */
-	msg.msg_iov = vec;
-	msg.msg_iovlen = 1;
-	msg.msg_control = cmsg_un.control;
-	msg.msg_controllen = sizeof(cmsg_un.control);
+	if (b && b->kstamps) {
+		late.scaled_nsecs = b->tx_late_ns << 16;
+		pp_time_add(&s, &late);
+	}
+	msg_set_one_step_stamp(ptp, msgtype, &s);
+}
 
-	ret = recvmsg(fd, &msg, MSG_DONTWAIT);
-	if (ret <= 0) {
-		if (errno == EAGAIN || errno == EINTR)
-			return 0;
+/* unix_recv_msg uses the batch above, for timestamp query */
+static int unix_recv_msg(struct pp_instance *ppi, int chtype, void *pkt,
+			 int len, struct pp_time *t)
+{
+	struct ethhdr *hdr = pkt;
+	int ret;
+	struct msghdr *msg;
+	int i;
 
+	struct cmsghdr *cmsg;
+	struct timeval *tv;
+	struct scm_timestamping *sts = NULL;
+	struct tpacket_auxdata *aux = NULL;
+	struct unix_rx_batch *b = *unix_rx_batch_of(ppi, chtype);
+
+	if (b && b->ring)
+		return unix_recv_ring(ppi, chtype, pkt, len, t);
+	ret = unix_recv_batch(ppi, chtype, pkt, len, &msg);
+	if (ret <= 0)
 		return ret;
-	}
-	if (msg.msg_flags & MSG_TRUNC) {
+	if (msg->msg_flags & MSG_TRUNC) {
 		/* If we are in VLAN mode, we get everything. This is ok */
 		if (ppi->proto != PPSI_PROTO_VLAN)
 			pp_error("%s: truncated message\n", __func__);
 		return -2; /* like "dropped" */
 	}
 	/* get time stamp of packet */
-	if (msg.msg_flags & MSG_CTRUNC) {
+	if (msg->msg_flags & MSG_CTRUNC) {
 		pp_error("%s: truncated ancillary data\n", __func__);
 		return 0;
 	}
 
 	tv = NULL;
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
 
 		if (cmsg->cmsg_level == SOL_SOCKET &&
 		    cmsg->cmsg_type == SCM_TIMESTAMP)
 			tv = (struct timeval *)CMSG_DATA(cmsg);
 
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_TIMESTAMPING)
+			sts = (struct scm_timestamping *)CMSG_DATA(cmsg);
+
 		if (cmsg->cmsg_level == SOL_PACKET &&
 		    cmsg->cmsg_type == PACKET_AUXDATA)
 			aux = (struct tpacket_auxdata *)CMSG_DATA(cmsg);
 	}
 
-	if (tv) {
+	if (sts) {
+		t->secs = sts->ts[0].tv_sec + DSPRO(ppi)->currentUtcOffset;
+		t->scaled_nsecs = (uint64_t)sts->ts[0].tv_nsec << 16;
+	} else if (tv) {
 		t->secs = tv->tv_sec + DSPRO(ppi)->currentUtcOffset;
 		t->scaled_nsecs = (uint64_t)(tv->tv_usec * 1000) << 16;
 	} else {
@@ -113,8 +524,11 @@ static int unix_recv_msg(struct pp_instance *ppi, int fd, void *pkt, int len,
 	} else {
 		ppi->peer_vid = 0;
 	}
+	if (ppi->proto == PPSI_PROTO_UDP)
+		ppi->peer_ip = ((struct sockaddr_in *)msg->msg_name)
+			->sin_addr.s_addr;
 
-	if (ppsi_drop_rx()) {
+	if (ppsi_drop_rx(GLBS(ppi))) {
 		pp_diag(ppi, frames, 1, "Drop received frame\n");
 		return -2;
 	}
@@ -122,7 +536,7 @@ static int unix_recv_msg(struct pp_instance *ppi, int fd, void *pkt, int len,
 	/* This is not really hw... */
 	pp_diag(ppi, time, 1, "recv stamp: %lli.%09i (%s)\n",
 		(long long)t->secs, (int)(t->scaled_nsecs >> 16),
-				    tv ? "kernel" : "user");
+				    sts || tv ? "kernel" : "user");
 	return ret;
 }
 
@@ -137,9 +551,7 @@ static int unix_net_recv(struct pp_instance *ppi, void *pkt, int len,
 	switch(ppi->proto) {
 	case PPSI_PROTO_RAW:
 	case PPSI_PROTO_VLAN:
-		ch2 = ppi->ch + PP_NP_GEN;
-
-		ret = unix_recv_msg(ppi, ch2->fd, pkt, len, t);
+		ret = unix_recv_msg(ppi, PP_NP_GEN, pkt, len, t);
 		if (ret <= 0)
 			return ret;
 		if (hdr->h_proto != htons(ETH_P_1588))
@@ -161,9 +573,9 @@ static int unix_net_recv(struct pp_instance *ppi, void *pkt, int len,
 
 		ret = -1;
 		if (ch1->pkt_present)
-			ret = unix_recv_msg(ppi, ch1->fd, pkt, len, t);
+			ret = unix_recv_msg(ppi, PP_NP_EVT, pkt, len, t);
 		else if (ch2->pkt_present)
-			ret = unix_recv_msg(ppi, ch2->fd, pkt, len, t);
+			ret = unix_recv_msg(ppi, PP_NP_GEN, pkt, len, t);
 		if (ret <= 0)
 			return ret;
 		/* We can't save the peer's mac address in UDP mode */
@@ -176,6 +588,11 @@ static int unix_net_recv(struct pp_instance *ppi, void *pkt, int len,
 	}
 }
 
+static const uint8_t macaddr[2][ETH_ALEN] = {
+	[PP_E2E_MECH] = PP_MCAST_MACADDRESS,
+	[PP_P2P_MECH] = PP_PDELAY_MACADDRESS,
+};
+
 static int unix_net_send(struct pp_instance *ppi, void *pkt, int len,
 			 int msgtype)
 {
@@ -190,14 +607,11 @@ static int unix_net_send(struct pp_instance *ppi, void *pkt, int len,
 		[PP_NP_GEN] = PP_GEN_PORT,
 		[PP_NP_EVT] = PP_EVT_PORT,
 	};
-	static const uint8_t macaddr[2][ETH_ALEN] = {
-		[PP_E2E_MECH] = PP_MCAST_MACADDRESS,
-		[PP_P2P_MECH] = PP_PDELAY_MACADDRESS,
-	};
+	char *origin;
 	int ret;
 
 	/* To fake a network frame loss, set the timestamp and do not send */
-	if (ppsi_drop_tx()) {
+	if (ppsi_drop_tx(GLBS(ppi))) {
 		ppi->t_ops->get(ppi, t);
 		pp_diag(ppi, frames, 1, "Drop sent frame\n");
 		return len;
@@ -209,10 +623,12 @@ static int unix_net_send(struct pp_instance *ppi, void *pkt, int len,
 		ch = ppi->ch + PP_NP_GEN;
 		hdr->h_proto = htons(ETH_P_1588);
 
-		memcpy(hdr->h_dest, macaddr[is_pdelay], ETH_ALEN);
+		memcpy(hdr->h_dest, ppi->tx_mac ?: macaddr[is_pdelay], ETH_ALEN);
 		memcpy(hdr->h_source, ch->addr, ETH_ALEN);
 
 		ppi->t_ops->get(ppi, t);
+		unix_one_step_stamp(ppi, PP_NP_GEN, pkt + ppi->tx_offset,
+				    msgtype, t);
 
 		ret = send(ch->fd, hdr, len, 0);
 		if (ret < 0) {
@@ -220,9 +636,10 @@ static int unix_net_send(struct pp_instance *ppi, void *pkt, int len,
 				strerror(errno));
 			return ret;
 		}
+		origin = unix_tx_stamp(ppi, PP_NP_GEN, t);
 		pp_diag(ppi, time, 1, "send stamp: %lli.%09i (%s)\n",
 			(long long)t->secs, (int)(t->scaled_nsecs >> 16),
-			"user");
+			origin);
 		if (pp_diag_allow(ppi, frames, 2))
 			dump_1588pkt("send: ", pkt, len, t, -1);
 		return ret;
@@ -234,10 +651,12 @@ static int unix_net_send(struct pp_instance *ppi, void *pkt, int len,
 		vhdr->h_tci = htons(ppi->peer_vid); /* prio is 0 */
 		vhdr->h_tpid = htons(0x8100);
 
-		memcpy(hdr->h_dest, macaddr[is_pdelay], ETH_ALEN);
+		memcpy(hdr->h_dest, ppi->tx_mac ?: macaddr[is_pdelay], ETH_ALEN);
 		memcpy(vhdr->h_source, ch->addr, ETH_ALEN);
 
 		ppi->t_ops->get(ppi, t);
+		unix_one_step_stamp(ppi, PP_NP_GEN, pkt + ppi->tx_offset,
+				    msgtype, t);
 
 		ret = send(ch->fd, vhdr, len, 0);
 		if (ret < 0) {
@@ -245,18 +664,21 @@ static int unix_net_send(struct pp_instance *ppi, void *pkt, int len,
 				strerror(errno));
 			return ret;
 		}
+		origin = unix_tx_stamp(ppi, PP_NP_GEN, t);
 		pp_diag(ppi, time, 1, "send stamp: %lli.%09i (%s)\n",
 			(long long)t->secs, (int)(t->scaled_nsecs >> 16),
-			"user");
+			origin);
 		if (pp_diag_allow(ppi, frames, 2))
 			dump_1588pkt("send: ", vhdr, len, t, ppi->peer_vid);
+		return ret;
 
 	case PPSI_PROTO_UDP:
 		addr.sin_family = AF_INET;
 		addr.sin_port = htons(udpport[chtype]);
-		addr.sin_addr.s_addr = ppi->mcast_addr[is_pdelay];
+		addr.sin_addr.s_addr = ppi->tx_ucast ?: ppi->mcast_addr[is_pdelay];
 
 		ppi->t_ops->get(ppi, t);
+		unix_one_step_stamp(ppi, chtype, pkt, msgtype, t);
 
 		ret = sendto(ppi->ch[chtype].fd, pkt, len, 0,
 			     (struct sockaddr *)&addr,
@@ -266,9 +688,10 @@ static int unix_net_send(struct pp_instance *ppi, void *pkt, int len,
 				strerror(errno));
 			return ret;
 		}
+		origin = unix_tx_stamp(ppi, chtype, t);
 		pp_diag(ppi, time, 1, "send stamp: %lli.%09i (%s)\n",
 			(long long)t->secs, (int)(t->scaled_nsecs >> 16),
-			"user");
+			origin);
 		if (pp_diag_allow(ppi, frames, 2))
 			dump_payloadpkt("send: ", pkt, len, t);
 		return ret;
@@ -488,7 +911,91 @@ err_out:
 	return -1;
 }
 
+/*
+ * Send the copies of a message, each on its own vlan, with a single
+ * sendmmsg. The header of each copy is built here, before its payload.
+ */
+static int unix_net_send_batch(struct pp_instance *ppi, struct pp_tx_copy *c,
+			       int n, int msgtype)
+{
+	struct pp_channel *ch = ppi->ch + PP_NP_GEN;
+	int is_pdelay = pp_msgtype_info[msgtype].is_pdelay;
+	struct pp_vlanhdr vhdr[CONFIG_VLAN_ARRAY_SIZE];
+	struct iovec vec[CONFIG_VLAN_ARRAY_SIZE][2];
+	struct mmsghdr mmsg[CONFIG_VLAN_ARRAY_SIZE];
+	int copy[CONFIG_VLAN_ARRAY_SIZE]; /* copy sent by each mmsg */
+	unsigned char frame[PP_MAX_FRAME_LENGTH];
+	struct pp_time t;
+	char *origin;
+	int i, j, nmsg, ret;
+
+	if (ppi->proto != PPSI_PROTO_VLAN || n > CONFIG_VLAN_ARRAY_SIZE)
+		return -1;
+
+	memset(mmsg, 0, sizeof(mmsg));
+	for (i = nmsg = 0; i < n; i++) {
+		/* A faked frame loss still counts as sent, as in send */
+		if (ppsi_drop_tx(GLBS(ppi))) {
+			pp_diag(ppi, frames, 1, "Drop sent frame (vlan %i)\n",
+				c[i].vid);
+			continue;
+		}
+		memcpy(vhdr[nmsg].h_dest, macaddr[is_pdelay], ETH_ALEN);
+		memcpy(vhdr[nmsg].h_source, ch->addr, ETH_ALEN);
+		vhdr[nmsg].h_tpid = htons(0x8100);
+		vhdr[nmsg].h_tci = htons(c[i].vid); /* prio is 0 */
+		vhdr[nmsg].h_proto = htons(ETH_P_1588);
+		vec[nmsg][0].iov_base = vhdr + nmsg;
+		vec[nmsg][0].iov_len = sizeof(vhdr[0]);
+		vec[nmsg][1].iov_base = c[i].ptp;
+		vec[nmsg][1].iov_len = c[i].len;
+		mmsg[nmsg].msg_hdr.msg_iov = vec[nmsg];
+		mmsg[nmsg].msg_hdr.msg_iovlen = 2;
+		copy[nmsg++] = i;
+	}
+
+	/* All copies leave together, so they share the user stamp */
+	ppi->t_ops->get(ppi, &t);
+	for (i = 0; i < n; i++) {
+		c[i].t = t;
+		unix_one_step_stamp(ppi, PP_NP_GEN, c[i].ptp, msgtype, &t);
+	}
+
+	ret = nmsg ? sendmmsg(ch->fd, mmsg, nmsg, 0) : 0;
+	if (ret < 0 && errno == ENOSYS) {
+		for (ret = 0; ret < nmsg; ret++)
+			if (sendmsg(ch->fd, &mmsg[ret].msg_hdr, 0) < 0)
+				break;
+	}
+	if (ret < 0) {
+		pp_diag(ppi, frames, 0, "send failed: %s\n", strerror(errno));
+		return ret;
+	}
+	/* But the kernel stamps each of them, in order */
+	origin = "user";
+	for (j = 0; j < ret; j++)
+		origin = unix_tx_stamp(ppi, PP_NP_GEN, &c[copy[j]].t);
+	pp_diag(ppi, time, 1, "send stamp: %lli.%09i (%s, %i vlans)\n",
+		(long long)c[n - 1].t.secs,
+		(int)(c[n - 1].t.scaled_nsecs >> 16), origin, ret);
+
+	for (j = 0; j < ret && pp_diag_allow(ppi, frames, 2); j++) {
+		i = copy[j];
+		memcpy(frame, vhdr + j, sizeof(vhdr[0]));
+		memcpy(frame + sizeof(vhdr[0]), c[i].ptp, c[i].len);
+		dump_1588pkt("send: ", frame, sizeof(vhdr[0]) + c[i].len,
+			     &c[i].t, c[i].vid);
+	}
+	/*
+	 * Dropped copies count as sent, but those after a failure don't:
+	 * so return the first copy that didn't leave, not how many did.
+	 */
+	return ret < nmsg ? copy[ret] : n;
+}
+
 static int unix_net_exit(struct pp_instance *ppi);
+static int unix_ep_add(struct pp_instance *ppi, int chtype);
+static void unix_ep_del(struct pp_instance *ppi, int chtype);
 
 /*
  * Inits all the network stuff
@@ -510,14 +1017,28 @@ static int unix_net_init(struct pp_instance *ppi)
 		pp_diag(ppi, frames, 1, "unix_net_init raw Ethernet\n");
 
 		/* raw sockets implementation always use gen socket */
-		return unix_open_ch_raw(ppi, ppi->iface_name, PP_NP_GEN);
+		if (unix_open_ch_raw(ppi, ppi->iface_name, PP_NP_GEN))
+			return -1;
+		unix_attach_filter(ppi, PP_NP_GEN);
+		if (unix_ep_add(ppi, PP_NP_GEN))
+			return -1;
+		unix_rx_ring_open(ppi, PP_NP_GEN);
+		unix_kstamps_open(ppi, PP_NP_GEN);
+		return 0;
 
 	case PPSI_PROTO_VLAN:
 		pp_diag(ppi, frames, 1, "unix_net_init raw Ethernet "
 			"with VLAN\n");
 
 		/* same as PROTO_RAW above, the differences are minimal */
-		return unix_open_ch_raw(ppi, ppi->iface_name, PP_NP_GEN);
+		if (unix_open_ch_raw(ppi, ppi->iface_name, PP_NP_GEN))
+			return -1;
+		unix_attach_filter(ppi, PP_NP_GEN);
+		if (unix_ep_add(ppi, PP_NP_GEN))
+			return -1;
+		unix_rx_ring_open(ppi, PP_NP_GEN);
+		unix_kstamps_open(ppi, PP_NP_GEN);
+		return 0;
 
 	case PPSI_PROTO_UDP:
 		if (ppi->nvlans) {
@@ -529,6 +1050,10 @@ static int unix_net_init(struct pp_instance *ppi)
 		for (i = PP_NP_GEN; i <= PP_NP_EVT; i++) {
 			if (unix_open_ch_udp(ppi, ppi->iface_name, i))
 				return -1;
+			unix_attach_filter(ppi, i);
+			if (unix_ep_add(ppi, i))
+				return -1;
+			unix_kstamps_open(ppi, i);
 		}
 		return 0;
 
@@ -551,6 +1076,7 @@ static int unix_net_exit(struct pp_instance *ppi)
 	case PPSI_PROTO_VLAN:
 		fd = ppi->ch[PP_NP_GEN].fd;
 		if (fd > 0) {
+			unix_ep_del(ppi, PP_NP_GEN);
 			close(fd);
 			ppi->ch[PP_NP_GEN].fd = -1;
 		}
@@ -561,6 +1087,7 @@ static int unix_net_exit(struct pp_instance *ppi)
 			fd = ppi->ch[i].fd;
 			if (fd < 0)
 				continue;
+			unix_ep_del(ppi, i);
 
 			/* Close General Multicast */
 			imr.imr_interface.s_addr = htonl(INADDR_ANY);
@@ -582,47 +1109,168 @@ static int unix_net_exit(struct pp_instance *ppi)
 	}
 }
 
-static int unix_net_check_packet(struct pp_globals *ppg, int delay_ms)
+static uint64_t unix_now_ns(void)
 {
-	fd_set set;
-	int i, j, k;
-	int ret = 0;
-	int maxfd = -1;
-	struct unix_arch_data *arch_data = POSIX_ARCH(ppg);
-	int old_delay_ms;
+	struct timespec now;
 
-	old_delay_ms = arch_data->tv.tv_sec * 1000 +
-		arch_data->tv.tv_usec / 1000;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return 1000LL * 1000 * 1000 * now.tv_sec + now.tv_nsec;
+}
+
+/*
+ * Each channel is registered once in the epoll set, and the cookie
+ * tells back the instance and the channel, so we never scan all links.
+ * The timerfd has its own cookie, that is no valid instance.
+ */
+#define UNIX_EP_TIMER (~0ULL)
 
-	if ((delay_ms != -1) &&
-		((old_delay_ms == 0) || (delay_ms < old_delay_ms))) {
-		/* Wait for a packet or for the timeout */
-		arch_data->tv.tv_sec = delay_ms / 1000;
-		arch_data->tv.tv_usec = (delay_ms % 1000) * 1000;
+static inline uint64_t unix_ep_cookie(struct pp_instance *ppi, int chtype)
+{
+	return ((uint64_t)(ppi - GLBS(ppi)->pp_instances) << 1) | chtype;
+}
+
+/*
+ * The epoll set is created at first use, the arch only sets it to -1.
+ * The deadline is a timerfd in the same set: epoll_wait() alone only
+ * has millisecond resolution, while intervals may be a few ms long.
+ */
+static int unix_ep_fd(struct unix_arch_data *arch_data)
+{
+	struct epoll_event ev;
+	int fd;
+
+	if (arch_data->epfd >= 0)
+		return arch_data->epfd;
+	fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fd < 0) {
+		pp_printf("%s: epoll_create1(): %s\n", __func__,
+			  strerror(errno));
+		return -1;
+	}
+	arch_data->tfd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_NONBLOCK | TFD_CLOEXEC);
+	if (arch_data->tfd < 0) {
+		pp_printf("%s: timerfd_create(): %s\n", __func__,
+			  strerror(errno));
+		close(fd);
+		return -1;
 	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = UNIX_EP_TIMER;
+	if (epoll_ctl(fd, EPOLL_CTL_ADD, arch_data->tfd, &ev) < 0) {
+		pp_printf("%s: epoll_ctl(timerfd): %s\n", __func__,
+			  strerror(errno));
+		close(arch_data->tfd);
+		close(fd);
+		return -1;
+	}
+	arch_data->armed = 0;
+	arch_data->epfd = fd;
+	return fd;
+}
 
-	/* Detect general timeout with no needs for select stuff */
-	if ((arch_data->tv.tv_sec == 0) && (arch_data->tv.tv_usec == 0))
-		return 0;
+/* Arm the timerfd at an absolute CLOCK_MONOTONIC time, 0 disarms it */
+static void unix_tfd_arm(struct unix_arch_data *arch_data, uint64_t deadline)
+{
+	struct itimerspec its;
+	uint64_t ns = deadline;
+
+	if (deadline == arch_data->armed)
+		return;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_nsec = __div64_32(&ns, 1000 * 1000 * 1000);
+	its.it_value.tv_sec = ns;
+	if (timerfd_settime(arch_data->tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		pp_printf("%s: timerfd_settime(): %s\n", __func__,
+			  strerror(errno));
+	arch_data->armed = deadline;
+}
 
-	FD_ZERO(&set);
+static int unix_ep_add(struct pp_instance *ppi, int chtype)
+{
+	struct unix_arch_data *arch_data = POSIX_ARCH(GLBS(ppi));
+	struct unix_rx_batch **b = unix_rx_batch_of(ppi, chtype);
+	struct epoll_event ev;
 
-	for (j = 0; j < ppg->nlinks; j++) {
-		struct pp_instance *ppi = INST(ppg, j);
-		int fd_to_set;
+	if (unix_ep_fd(arch_data) < 0)
+		return -1;
+	if (!*b)
+		*b = calloc(1, sizeof(**b));
+	if (!*b)
+		return -1;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = unix_ep_cookie(ppi, chtype);
+	if (epoll_ctl(arch_data->epfd, EPOLL_CTL_ADD, ppi->ch[chtype].fd,
+		      &ev) < 0) {
+		pp_printf("%s: epoll_ctl(ADD): %s\n", __func__,
+			  strerror(errno));
+		return -1;
+	}
+	return 0;
+}
 
-		/* Use either fd that is valid, irrespective of ether/udp */
-		for (k = 0; k < 2; k++) {
-			ppi->ch[k].pkt_present = 0;
-			fd_to_set = ppi->ch[k].fd;
-			if (fd_to_set < 0)
-				continue;
+static void unix_ep_del(struct pp_instance *ppi, int chtype)
+{
+	struct unix_arch_data *arch_data = POSIX_ARCH(GLBS(ppi));
+	struct unix_rx_batch **b = unix_rx_batch_of(ppi, chtype);
+	struct epoll_event ev; /* ignored, but old kernels want it */
+
+	/* Frames still queued belong to the old socket: drop them */
+	unix_rx_ring_close(*b);
+	free(*b);
+	*b = NULL;
+	ppi->ch[chtype].pkt_present = 0;
+	if (arch_data->epfd < 0 || ppi->ch[chtype].fd < 0)
+		return;
+	epoll_ctl(arch_data->epfd, EPOLL_CTL_DEL, ppi->ch[chtype].fd, &ev);
+}
 
-			FD_SET(fd_to_set, &set);
-			maxfd = fd_to_set > maxfd ? fd_to_set : maxfd;
-		}
+/* For libppsi: the epoll set becomes readable at the deadline too */
+void unix_set_deadline(struct pp_globals *ppg, uint64_t deadline)
+{
+	struct unix_arch_data *arch_data = POSIX_ARCH(ppg);
+
+	if (unix_ep_fd(arch_data) < 0)
+		return;
+	unix_tfd_arm(arch_data, deadline == PP_SCHED_NEVER ? 0 : deadline);
+}
+
+/*
+ * Wait for frames or until the deadline (CLOCK_MONOTONIC ns, as returned
+ * by calc_timeout). Instances with pending frames are returned in "ready"
+ * (at most once each), and their count is the return value.
+ * A deadline of 0 doesn't wait, and leaves the timer alone (libppsi).
+ */
+static int unix_net_check_packet(struct pp_globals *ppg, uint64_t deadline,
+				 struct pp_instance **ready)
+{
+	struct unix_arch_data *arch_data = POSIX_ARCH(ppg);
+	struct pp_instance *ppi;
+	uint64_t cookie, expirations;
+	int i, ret = 0;
+
+	/* Flags of the previous round have been consumed by the caller */
+	for (i = 0; i < arch_data->nevents; i++) {
+		cookie = arch_data->events[i].data.u64;
+		if (cookie == UNIX_EP_TIMER)
+			continue;
+		INST(ppg, cookie >> 1)->ch[cookie & 1].pkt_present = 0;
 	}
-	i = select(maxfd + 1, &set, NULL, NULL, &arch_data->tv);
+	arch_data->nevents = 0;
+
+	/* Detect general timeout with no needs for epoll stuff */
+	if (deadline && deadline != PP_SCHED_NEVER && deadline <= unix_now_ns())
+		return 0;
+
+	if (unix_ep_fd(arch_data) < 0)
+		exit(__LINE__);
+	if (deadline)
+		unix_tfd_arm(arch_data,
+			     deadline == PP_SCHED_NEVER ? 0 : deadline);
+	i = epoll_wait(arch_data->epfd, arch_data->events,
+		       ARRAY_SIZE(arch_data->events), deadline ? -1 : 0);
 
 	if (i < 0 && errno != EINTR)
 		exit(__LINE__);
@@ -630,24 +1278,30 @@ static int unix_net_check_packet(struct pp_globals *ppg, int delay_ms)
 	if (i < 0)
 		return -1;
 
-	if (i == 0)
-		return 0;
-
-	for (j = 0; j < ppg->nlinks; j++) {
-		struct pp_instance *ppi = INST(ppg, j);
-		int fd = ppi->ch[PP_NP_GEN].fd;
-
-		if (fd >= 0 && FD_ISSET(fd, &set)) {
-			ret++;
-			ppi->ch[PP_NP_GEN].pkt_present = 1;
+	arch_data->nevents = i;
+	for (i = 0; i < arch_data->nevents; i++) {
+		cookie = arch_data->events[i].data.u64;
+		if (cookie == UNIX_EP_TIMER) {
+			/* Just clear it: our caller checks the deadlines */
+			if (read(arch_data->tfd, &expirations,
+				 sizeof(expirations)) < 0 && errno != EAGAIN)
+				pp_printf("%s: read(timerfd): %s\n", __func__,
+					  strerror(errno));
+			arch_data->armed = 0;
+			continue;
 		}
+		ppi = INST(ppg, cookie >> 1);
 
-		fd = ppi->ch[PP_NP_EVT].fd;
-
-		if (fd >= 0 && FD_ISSET(fd, &set)) {
-			ret++;
-			ppi->ch[PP_NP_EVT].pkt_present = 1;
+		/* A TX stamp we stopped waiting for: don't spin on it */
+		if (arch_data->events[i].events & EPOLLERR) {
+			unix_errqueue_drain(ppi->ch[cookie & 1].fd);
+			if (!(arch_data->events[i].events & EPOLLIN))
+				continue;
 		}
+		if (!ppi->ch[PP_NP_GEN].pkt_present &&
+		    !ppi->ch[PP_NP_EVT].pkt_present)
+			ready[ret++] = ppi;
+		ppi->ch[cookie & 1].pkt_present = 1;
 	}
 	return ret;
 }
@@ -658,5 +1312,6 @@ struct pp_network_operations unix_net_ops = {
 	.recv = unix_net_recv,
 	.send = unix_net_send,
 	.check_packet = unix_net_check_packet,
+	.send_batch = unix_net_send_batch,
 };
 
@@ -31,7 +31,7 @@ static int unix_time_get(struct pp_instance *ppi, struct pp_time *t)
 	/* TAI = UTC + 35 */
 	t->secs = tp.tv_sec + DSPRO(ppi)->currentUtcOffset;
 	t->scaled_nsecs = ((int64_t)tp.tv_nsec) << 16;
-	if (!(pp_global_d_flags & PP_FLAG_NOTIMELOG))
+	if (!(GLBS(ppi)->d_flags & PP_FLAG_NOTIMELOG))
 		pp_diag(ppi, time, 2, "%s: %9li.%09li\n", __func__,
 			tp.tv_sec, tp.tv_nsec);
 	return 0;
@@ -112,15 +112,12 @@ static int unix_time_adjust_freq(struct pp_instance *ppi, long freq_ppb)
 	return unix_time_adjust(ppi, 0, freq_ppb);
 }
 
-static unsigned long unix_calc_timeout(struct pp_instance *ppi, int millisec)
+static uint64_t unix_calc_timeout(struct pp_instance *ppi, int64_t nsec)
 {
 	struct timespec now;
-	uint64_t now_ms;
 
 	clock_gettime(CLOCK_MONOTONIC, &now);
-	now_ms = 1000LL * now.tv_sec + now.tv_nsec / 1000 / 1000;
-
-	return now_ms + millisec;
+	return 1000LL * 1000 * 1000 * now.tv_sec + now.tv_nsec + nsec;
 }
 
 struct pp_time_operations unix_time_ops = {
@@ -78,7 +78,7 @@ static int wrpc_net_recv(struct pp_instance *ppi, void *pkt, int len,
 		dump_payloadpkt("recv: ", pkt, got, t);
 #endif
 
-	if (CONFIG_HAS_WRPC_FAULTS && ppsi_drop_rx()) {
+	if (CONFIG_HAS_WRPC_FAULTS && ppsi_drop_rx(GLBS(ppi))) {
 		pp_diag(ppi, frames, 1, "Drop received frame\n");
 		return -2;
 	}
@@ -108,7 +108,7 @@ static int wrpc_net_send(struct pp_instance *ppi, void *pkt, int len,
 	 * hardware stamp. Thus, remember if we drop, and use this info.
 	 */
 	if (CONFIG_HAS_WRPC_FAULTS)
-		drop = ppsi_drop_tx();
+		drop = ppsi_drop_tx(GLBS(ppi));
 
 	sock = ppi->ch[PP_NP_EVT].custom;
 
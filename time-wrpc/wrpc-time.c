@@ -8,6 +8,7 @@
 #include <ppsi/ppsi.h>
 #include "pps_gen.h" /* in wrpc-sw */
 #include "syscon.h" /* in wrpc-sw */
+#include "../arch-wrpc/wrpc.h"
 
 static int wrpc_time_get(struct pp_instance *ppi, struct pp_time *t)
 {
@@ -18,7 +19,7 @@ static int wrpc_time_get(struct pp_instance *ppi, struct pp_time *t)
 
 	t->secs = sec;
 	t->scaled_nsecs = (int64_t)nsec << 16;
-	if (!(pp_global_d_flags & PP_FLAG_NOTIMELOG))
+	if (!(GLBS(ppi)->d_flags & PP_FLAG_NOTIMELOG))
 		pp_diag(ppi, time, 2, "%s: %9lu.%09li\n", __func__,
 			(long)sec, (long)nsec);
 	return 0;
@@ -59,9 +60,16 @@ static int wrpc_time_adjust(struct pp_instance *ppi, long offset_ns,
 	return wrpc_time_adjust_offset(ppi, offset_ns);
 }
 
-static unsigned long wrpc_calc_timeout(struct pp_instance *ppi, int millisec)
+static uint64_t wrpc_calc_timeout(struct pp_instance *ppi, int64_t nsec)
 {
-	return timer_get_tics() + millisec;
+	/* The tick counter is 32 bits of ms: extend it, so it never wraps */
+	struct wrpc_arch_data *a = WRPC_ARCH(GLBS(ppi));
+	uint32_t tics = timer_get_tics();
+
+	if (tics < a->last_tics)
+		a->tics_high += 1ULL << 32;
+	a->last_tics = tics;
+	return (a->tics_high + tics) * 1000 * 1000 + nsec;
 }
 
 struct pp_time_operations wrpc_time_ops = {
@@ -130,16 +130,16 @@ static void update_dmtd(struct wrs_socket *s, struct pp_instance *ppi)
  * Also, all calculations are ps here, but the timestamp is scaled_ns
  *       -- ARub 2016-10
  */
-static void wrs_linearize_rx_timestamp(struct pp_time *ts,
-	int32_t dmtd_phase, int cntr_ahead, int transition_point,
-	int clock_period)
+static void wrs_linearize_rx_timestamp(struct pp_instance *ppi,
+	struct pp_time *ts, int32_t dmtd_phase, int cntr_ahead,
+	int transition_point, int clock_period)
 {
 	int trip_lo, trip_hi;
 	int phase;
 
-	pp_diag(NULL, ext, 3, "linearize  ts %s and phase %i\n",
+	pp_diag(ppi, ext, 3, "linearize  ts %s and phase %i\n",
 		fmt_time(ts), dmtd_phase);
-	pp_diag(NULL, ext, 3, "    (ahead %i tpoint %i, period %i\n",
+	pp_diag(ppi, ext, 3, "    (ahead %i tpoint %i, period %i\n",
 		cntr_ahead, transition_point, clock_period);
 
 	phase = clock_period - 1 - dmtd_phase;
@@ -151,7 +151,7 @@ static void wrs_linearize_rx_timestamp(struct pp_time *ts,
 
 	trip_hi = transition_point + clock_period / 4;
 	if(trip_hi >= clock_period) trip_hi -= clock_period;
-	pp_diag(NULL, ext, 3, "    phase now %i (tripl %i, triph %i)\n",
+	pp_diag(ppi, ext, 3, "    phase now %i (tripl %i, triph %i)\n",
 		phase, trip_lo, trip_hi);
 
 	if(inside_range(trip_lo, trip_hi, phase))
@@ -163,7 +163,7 @@ static void wrs_linearize_rx_timestamp(struct pp_time *ts,
 
 		if (cntr_ahead)
 			ts->scaled_nsecs -= (clock_period / 1000LL) << 16;
-		pp_diag(NULL, ext, 3, "    ts became %s\n", fmt_time(ts));
+		pp_diag(ppi, ext, 3, "    ts became %s\n", fmt_time(ts));
 
 		/* check if the phase is before the counter transition value
 		 * and eventually increase the counter by 1 to simulate a
@@ -171,7 +171,7 @@ static void wrs_linearize_rx_timestamp(struct pp_time *ts,
 		 * DMTD phase value */
 		if(inside_range(trip_lo, transition_point, phase))
 			ts->scaled_nsecs += (clock_period / 1000LL) << 16;
-		pp_diag(NULL, ext, 3, "    ts became %s\n", fmt_time(ts));
+		pp_diag(ppi, ext, 3, "    ts became %s\n", fmt_time(ts));
 
 	}
 
@@ -180,54 +180,34 @@ static void wrs_linearize_rx_timestamp(struct pp_time *ts,
 		phase += clock_period;
 	phase = clock_period - 1 - phase;
 	ts->scaled_nsecs += (phase << 16) / 1000;
-	pp_diag(NULL, ext, 3, "    ts final  %s\n", fmt_time(ts));
+	pp_diag(ppi, ext, 3, "    ts final  %s\n", fmt_time(ts));
 }
 
 
-static int wrs_recv_msg(struct pp_instance *ppi, int fd, void *pkt, int len,
-			struct pp_time *t)
+static int wrs_recv_msg(struct pp_instance *ppi, int chtype, void *pkt,
+			int len, struct pp_time *t)
 {
 	struct ethhdr *hdr = pkt;
 	struct wrs_socket *s;
-	struct msghdr msg;
-	struct iovec entry;
-	struct sockaddr_ll from_addr;
+	struct msghdr *msg;
 	int i;
-	union {
-		struct cmsghdr cm;
-		char aux_buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
-		char time_buf[1024];
-	} control;
 	struct cmsghdr *cmsg;
 	struct scm_timestamping *sts = NULL;
 	struct tpacket_auxdata *aux = NULL;
 
 	s = (struct wrs_socket*)ppi->ch[PP_NP_GEN].arch_data;
 
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = &entry;
-	msg.msg_iovlen = 1;
-	entry.iov_base = pkt;
-	entry.iov_len = len;
-	msg.msg_name = (caddr_t)&from_addr;
-	msg.msg_namelen = sizeof(from_addr);
-	msg.msg_control = &control;
-	msg.msg_controllen = sizeof(control);
-
-	int ret = recvmsg(fd, &msg, MSG_DONTWAIT);
-
-	if (ret < 0 && errno == EAGAIN) return 0; // would be blocking
-
-	if (ret == -EAGAIN) return 0;
+	/* Frames come from the unix batch, with their own ancillary data */
+	int ret = unix_recv_batch(ppi, chtype, pkt, len, &msg);
 
 	if (ret <= 0) return ret;
 
 	/* FIXME Check ptp-noposix, commit d34f56f: if sender mac check
 	 * is required. Should be added here */
 
-	for (cmsg = CMSG_FIRSTHDR(&msg);
+	for (cmsg = CMSG_FIRSTHDR(msg);
 	     cmsg;
-	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
 
 		void *dp = CMSG_DATA(cmsg);
 
@@ -251,7 +231,7 @@ static int wrs_recv_msg(struct pp_instance *ppi, int fd, void *pkt, int len,
 			goto drop;
 		}
 		if (s->dmtd_phase_valid) {
-			wrs_linearize_rx_timestamp(t, s->dmtd_phase,
+			wrs_linearize_rx_timestamp(ppi, t, s->dmtd_phase,
 				cntr_ahead, s->phase_transition, s->clock_period);
 		} else {
 			mark_incorrect(t);
@@ -262,8 +242,11 @@ static int wrs_recv_msg(struct pp_instance *ppi, int fd, void *pkt, int len,
 
 drop:
 	/* For UDP, avoid all of the following, as we don't have vlans */
-	if (ppi->proto == PPSI_PROTO_UDP)
+	if (ppi->proto == PPSI_PROTO_UDP) {
+		ppi->peer_ip = ((struct sockaddr_in *)msg->msg_name)
+			->sin_addr.s_addr;
 		goto out;
+	}
 
 	/*
 	 * Ethernet driver returns internal frame. Our simple WR driver used to
@@ -290,7 +273,7 @@ drop:
 	}
 
 out:
-	if (ppsi_drop_rx()) {
+	if (ppsi_drop_rx(GLBS(ppi))) {
 		pp_diag(ppi, frames, 1, "Drop received frame\n");
 		return -2;
 	}
@@ -308,9 +291,7 @@ static int wrs_net_recv(struct pp_instance *ppi, void *pkt, int len,
 	switch(ppi->proto) {
 	case PPSI_PROTO_RAW:
 	case PPSI_PROTO_VLAN:
-		ch2 = ppi->ch + PP_NP_GEN;
-
-		ret = wrs_recv_msg(ppi, ch2->fd, pkt, len, t);
+		ret = wrs_recv_msg(ppi, PP_NP_GEN, pkt, len, t);
 		if (ret <= 0)
 			return ret;
 		memcpy(ppi->peer, hdr->h_source, ETH_ALEN);
@@ -327,9 +308,9 @@ static int wrs_net_recv(struct pp_instance *ppi, void *pkt, int len,
 		ch2 = &(ppi->ch[PP_NP_GEN]);
 
 		if (ch1->pkt_present)
-			ret = wrs_recv_msg(ppi, ch1->fd, pkt, len, t);
+			ret = wrs_recv_msg(ppi, PP_NP_EVT, pkt, len, t);
 		else if (ch2->pkt_present)
-			ret = wrs_recv_msg(ppi, ch2->fd, pkt, len, t);
+			ret = wrs_recv_msg(ppi, PP_NP_GEN, pkt, len, t);
 		if (ret < 0)
 			break;
 		if (pp_diag_allow(ppi, frames, 2))
@@ -480,7 +461,7 @@ static int wrs_net_send(struct pp_instance *ppi, void *pkt, int len,
 	 * to transmit it for real, if we want to get back our
 	 * hardware stamp. Thus, remember if we drop, and use this info.
 	 */
-	drop = ppsi_drop_tx();
+	drop = ppsi_drop_tx(GLBS(ppi));
 
 	switch (ppi->proto) {
 	case PPSI_PROTO_RAW:
@@ -490,11 +471,13 @@ static int wrs_net_send(struct pp_instance *ppi, void *pkt, int len,
 		if (drop)
 			hdr->h_proto++;
 
-		memcpy(hdr->h_dest, macaddr[is_pdelay], ETH_ALEN);
+		memcpy(hdr->h_dest, ppi->tx_mac ?: macaddr[is_pdelay], ETH_ALEN);
 		memcpy(hdr->h_source, ch->addr, ETH_ALEN);
 
-		if (t)
+		if (t) {
 			ppi->t_ops->get(ppi, t);
+			msg_set_one_step_stamp(pkt + ppi->tx_offset, msgtype, t);
+		}
 
 		ret = send(ch->fd, hdr, len, 0);
 		if (ret < 0) {
@@ -521,11 +504,13 @@ static int wrs_net_send(struct pp_instance *ppi, void *pkt, int len,
 		if (drop)
 			hdr->h_proto++;
 
-		memcpy(hdr->h_dest, macaddr[is_pdelay], ETH_ALEN);
+		memcpy(hdr->h_dest, ppi->tx_mac ?: macaddr[is_pdelay], ETH_ALEN);
 		memcpy(vhdr->h_source, ch->addr, ETH_ALEN);
 
-		if (t)
+		if (t) {
 			ppi->t_ops->get(ppi, t);
+			msg_set_one_step_stamp(pkt + ppi->tx_offset, msgtype, t);
+		}
 
 		if (len < 64)
 			len = 64;
@@ -549,9 +534,13 @@ static int wrs_net_send(struct pp_instance *ppi, void *pkt, int len,
 		fd = ppi->ch[chtype].fd;
 		addr.sin_family = AF_INET;
 		addr.sin_port = htons(udpport[chtype]);
-		addr.sin_addr.s_addr = ppi->mcast_addr[is_pdelay];
+		addr.sin_addr.s_addr = ppi->tx_ucast ?: ppi->mcast_addr[is_pdelay];
 		if (drop)
 			addr.sin_port = 3200;
+		if (t) { /* the hardware stamp replaces it, but for one-step */
+			ppi->t_ops->get(ppi, t);
+			msg_set_one_step_stamp(pkt, msgtype, t);
+		}
 		ret = sendto(fd, pkt, len, 0, (struct sockaddr *)&addr,
 			     sizeof(struct sockaddr_in));
 		if (ret < 0) {
@@ -684,9 +673,10 @@ static int wrs_net_exit(struct pp_instance *ppi)
 	return 0;
 }
 
-static int wrs_net_check_packet(struct pp_globals *ppg, int delay_ms)
+static int wrs_net_check_packet(struct pp_globals *ppg, uint64_t deadline,
+				struct pp_instance **ready)
 {
-	return unix_net_ops.check_packet(ppg, delay_ms);
+	return unix_net_ops.check_packet(ppg, deadline, ready);
 }
 
 struct pp_network_operations wrs_net_ops = {
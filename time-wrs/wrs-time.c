@@ -44,8 +44,6 @@ int wrs_adjust_counters(int64_t adjust_sec, int32_t adjust_nsec)
 	       ? HEXP_PPSG_CMD_ADJUST_SEC : HEXP_PPSG_CMD_ADJUST_NSEC);
 	ret = minipc_call(hal_ch, DEFAULT_TO, &__rpcdef_pps_cmd,
 			  &rval, cmd, &p);
-	pp_diag(NULL, time, 1, "Adjust: %lli : %09i = %i\n", adjust_sec,
-		adjust_nsec, ret);
 	if (ret < 0 || rval < 0) {
 		pp_printf("%s: error (local %i remote %i)\n",
 			  __func__, ret, rval);
@@ -211,7 +209,7 @@ static int wrs_time_get(struct pp_instance *ppi, struct pp_time *t)
 	t->secs = p.current_sec;
 	t->scaled_nsecs = (long long)p.current_nsec << 16;
 
-	if (!(pp_global_d_flags & PP_FLAG_NOTIMELOG))
+	if (!(GLBS(ppi)->d_flags & PP_FLAG_NOTIMELOG))
 		pp_diag(ppi, time, 2, "%s: (valid %x) %9li.%09li\n", __func__,
 			p.pps_valid,
 			(long)p.current_sec, (long)p.current_nsec);
@@ -363,11 +361,10 @@ static int wrs_time_adjust(struct pp_instance *ppi, long offset_ns,
 	return wrs_time_adjust_offset(ppi, offset_ns);
 }
 
-static unsigned long wrs_calc_timeout(struct pp_instance *ppi,
-				      int millisec)
+static uint64_t wrs_calc_timeout(struct pp_instance *ppi, int64_t nsec)
 {
 	/* We can rely on unix's CLOCK_MONOTONIC timing for timeouts */
-	return unix_time_ops.calc_timeout(ppi, millisec);
+	return unix_time_ops.calc_timeout(ppi, nsec);
 }
 
 struct pp_time_operations wrs_time_ops = {
@@ -18,8 +18,11 @@ struct timeout_config {
 	int value;
 };
 
-/* most timeouts have a static configuration. Save it here */
-static struct timeout_config to_configs[__PP_TO_ARRAY_SIZE] = {
+/*
+ * Most timeouts have a static configuration; the values depend on the
+ * port data set, so pp_timeout_init() saves them in the port.
+ */
+static const struct timeout_config to_configs[__PP_TO_ARRAY_SIZE] = {
 	[PP_TO_REQUEST] =	{"REQUEST",	RAND_0_200,},
 	[PP_TO_SYNC_SEND] =	{"SYNC_SEND",	RAND_70_130,},
 	[PP_TO_ANN_RECEIPT] =	{"ANN_RECEIPT",	RAND_NONE,},
@@ -29,36 +32,54 @@ static struct timeout_config to_configs[__PP_TO_ARRAY_SIZE] = {
 	/* extension timeouts are explicitly set to a value */
 };
 
+/* Scale by a log2 interval, that may be negative (e.g. -7: 128 per second) */
+static inline int64_t pp_log_scale(int64_t val, int logval)
+{
+	return logval >= 0 ? val << logval : val >> -logval;
+}
+
 /* Init fills the timeout values */
 void pp_timeout_init(struct pp_instance *ppi)
 {
 	struct DSPort *port = ppi->portDS;
+	int *v = ppi->to_values;
+	int i;
+
+	for (i = 0; i < __PP_TO_ARRAY_SIZE; i++)
+		v[i] = to_configs[i].value;
+	v[PP_TO_REQUEST] = port->logMinDelayReqInterval + ppi->dreq_backoff;
+	v[PP_TO_SYNC_SEND] = port->logSyncInterval;
+	v[PP_TO_ANN_RECEIPT] = pp_log_scale(
+		1000 * port->announceReceiptTimeout, port->logAnnounceInterval);
+	v[PP_TO_ANN_SEND] = port->logAnnounceInterval;
+	v[PP_TO_QUALIFICATION] =
+	    pp_log_scale(1000, port->logAnnounceInterval)
+		* (DSCUR(ppi)->stepsRemoved + 1);
+}
+
+static void __pp_timeout_set_ns(struct pp_instance *ppi, int index,
+				int64_t nsec)
+{
+	uint64_t usec = nsec;
 
-	to_configs[PP_TO_REQUEST].value =
-		port->logMinDelayReqInterval;
-	to_configs[PP_TO_SYNC_SEND].value =
-		port->logSyncInterval;
-	to_configs[PP_TO_ANN_RECEIPT].value = 1000 * (
-		port->announceReceiptTimeout << port->logAnnounceInterval);
-	to_configs[PP_TO_ANN_SEND].value = port->logAnnounceInterval;
-	to_configs[PP_TO_QUALIFICATION].value =
-	    (1000 << port->logAnnounceInterval)*(DSCUR(ppi)->stepsRemoved + 1);
+	ppi->timeouts[index] = ppi->t_ops->calc_timeout(ppi, nsec);
+	__div64_32(&usec, 1000);
+	pp_diag(ppi, time, 3, "new timeout for %s: %i us\n",
+		to_configs[index].name, (int)usec);
 }
 
 void __pp_timeout_set(struct pp_instance *ppi, int index, int millisec)
 {
-	ppi->timeouts[index] = ppi->t_ops->calc_timeout(ppi, millisec);
-	pp_diag(ppi, time, 3, "new timeout for %s: %i\n",
-		to_configs[index].name, millisec);
+	__pp_timeout_set_ns(ppi, index, millisec * 1000LL * 1000LL);
 }
 
 
 void pp_timeout_set(struct pp_instance *ppi, int index)
 {
-	static uint32_t seed;
+	uint32_t seed = ppi->to_seed;
 	uint32_t rval;
-	int millisec;
-	int logval = to_configs[index].value;
+	int64_t nsec;
+	int logval = ppi->to_values[index];
 
 	if (!seed) {
 		uint32_t *p;
@@ -76,12 +97,14 @@ void pp_timeout_set(struct pp_instance *ppi, int index)
 	seed += 12345;
 	rval <<= 10;
 	rval ^= (unsigned int) (seed / 65536) % 1024;
+	ppi->to_seed = seed;
 
 	/*
-	 * logval is signed. Let's imagine it's no less than -4.
-	 * Here below, 0 gets to 16 * 25 = 400ms, 40% of the nominal value
+	 * logval is signed, down to -7 at least (128 frames per second).
+	 * Here below, 0 gets to 400ms, 40% of the nominal value.
+	 * rval has 21 bits, so "(x * rval) >> 21" is a fraction of x.
 	 */
-	millisec = (1 << (logval + 4)) * 25;
+	nsec = pp_log_scale(400LL * 1000 * 1000, logval);
 
 	switch(to_configs[index].which_rand) {
 	case RAND_70_130:
@@ -91,15 +114,16 @@ void pp_timeout_set(struct pp_instance *ppi, int index)
 		 * So randomize between 80% and 120%: constant
 		 * part is 80% and variable is 40%.
 		 */
-		millisec = (millisec * 2) + rval % millisec;
+		nsec = (nsec * 2) + ((nsec * rval) >> 21);
 		break;
 	case RAND_0_200:
-		millisec = rval % (millisec * 5);
+		nsec = (nsec * 5 * rval) >> 21;
 		break;
 	case RAND_NONE:
-		millisec = logval; /* not a log, just a constant */
+		/* not a log, just a constant in ms */
+		nsec = logval * 1000LL * 1000LL;
 	}
-	__pp_timeout_set(ppi, index, millisec);
+	__pp_timeout_set_ns(ppi, index, nsec);
 }
 
 /*
@@ -115,10 +139,15 @@ void pp_timeout_setall(struct pp_instance *ppi)
 	__pp_timeout_set(ppi, PP_TO_ANN_SEND, 20);
 }
 
+/* Deadlines are 64-bit nanoseconds: they never wrap */
+static inline int64_t pp_timeout_left(struct pp_instance *ppi, uint64_t when)
+{
+	return when - ppi->t_ops->calc_timeout(ppi, 0);
+}
+
 int pp_timeout(struct pp_instance *ppi, int index)
 {
-	int ret = time_after_eq(ppi->t_ops->calc_timeout(ppi, 0),
-				ppi->timeouts[index]);
+	int ret = pp_timeout_left(ppi, ppi->timeouts[index]) <= 0;
 
 	if (ret)
 		pp_diag(ppi, time, 1, "timeout expired: %s\n",
@@ -128,40 +157,41 @@ int pp_timeout(struct pp_instance *ppi, int index)
 
 /*
  * How many ms to wait for the timeout to happen, for ppi->next_delay.
- * It is not allowed for a timeout to not be pending
+ * It is not allowed for a timeout to not be pending. The delay is
+ * rounded up, and the exact deadline is saved in ppi->next_deadline
+ * for the main loops that can wake up with sub-ms resolution.
  */
-int pp_next_delay_1(struct pp_instance *ppi, int i1)
+int pp_next_delay(struct pp_instance *ppi, uint64_t when)
+{
+	int64_t left = pp_timeout_left(ppi, when);
+	uint64_t ms;
+
+	ppi->next_deadline = when;
+	if (left <= 0)
+		return 0;
+	ms = left + 999999;
+	__div64_32(&ms, 1000 * 1000);
+	return ms;
+}
+
+static inline uint64_t pp_min_deadline(uint64_t a, uint64_t b)
 {
-	unsigned long now = ppi->t_ops->calc_timeout(ppi, 0);
-	signed long r1;
+	return (int64_t)(a - b) < 0 ? a : b;
+}
 
-	r1 = ppi->timeouts[i1] - now;
-	return r1 < 0 ? 0 : r1;
+int pp_next_delay_1(struct pp_instance *ppi, int i1)
+{
+	return pp_next_delay(ppi, ppi->timeouts[i1]);
 }
 
 int pp_next_delay_2(struct pp_instance *ppi, int i1, int i2)
 {
-	unsigned long now = ppi->t_ops->calc_timeout(ppi, 0);
-	signed long r1, r2;
-
-	r1 = ppi->timeouts[i1] - now;
-	r2 = ppi->timeouts[i2] - now;
-	if (r2 < r1)
-		r1 = r2;
-	return r1 < 0 ? 0 : r1;
+	return pp_next_delay(ppi, pp_min_deadline(ppi->timeouts[i1],
+						  ppi->timeouts[i2]));
 }
 
 int pp_next_delay_3(struct pp_instance *ppi, int i1, int i2, int i3)
 {
-	unsigned long now = ppi->t_ops->calc_timeout(ppi, 0);
-	signed long r1, r2, r3;
-
-	r1 = ppi->timeouts[i1] - now;
-	r2 = ppi->timeouts[i2] - now;
-	r3 = ppi->timeouts[i3] - now;
-	if (r2 < r1)
-		r1 = r2;
-	if (r3 < r1)
-		r1 = r3;
-	return r1 < 0 ? 0 : r1;
+	return pp_next_delay(ppi, pp_min_deadline(ppi->timeouts[i1],
+			pp_min_deadline(ppi->timeouts[i2], ppi->timeouts[i3])));
 }
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2026 CERN (www.cern.ch)
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ppsi/trace.h>
+
+/*
+ * Read the binary trace ring of ppsi ("trace-file" in ppsi.conf), and
+ * print the records as the diagnostic lines ppsi would have printed.
+ * With -f, keep reading as new records are written.
+ */
+static struct {
+	char *name;
+	int level;
+	char *fmt;
+} events[] = {
+#define PP_TRACE_DECODE(id, th, l, f) [PP_TR_ ## id] = {"diag-" #th, l, f},
+	PP_TRACE_EVENTS(PP_TRACE_DECODE)
+#undef PP_TRACE_DECODE
+};
+
+static int opt_t;
+
+static void print_ns(long long ns)
+{
+	long long ans = ns < 0 ? -ns : ns;
+
+	printf("%s%lli.%09lli", ns < 0 ? "-" : " ",
+	       ans / 1000000000, ans % 1000000000);
+}
+
+static void print_rec(struct pp_trace_ring *ring, struct pp_trace_rec *r)
+{
+	char spec[16], *f;
+	int a, n;
+
+	if (r->id >= __PP_TR_NR) {
+		printf("unknown trace event %i\n", r->id);
+		return;
+	}
+	f = events[r->id].fmt;
+	printf("%s-%i-%.*s: ", events[r->id].name, events[r->id].level,
+	       PP_TRACE_NAMELEN, ring->port_name[r->port]);
+	/* Like pp_fsm_printf(), but it's monotonic time */
+	if (opt_t || r->id <= PP_TR_FSM_LEAVE)
+		printf("%09lli.%03lli: ", (long long)r->ns / 1000000000,
+		       (long long)r->ns % 1000000000 / 1000000);
+
+	/* The name, if any, is in the first args */
+	a = strstr(f, "%s") ? PP_TRACE_NAMELEN / sizeof(r->arg[0]) : 0;
+	for (; *f; f++) {
+		if (*f != '%') {
+			putchar(*f);
+			continue;
+		}
+		/* Keep flags and width, and use "ll" for all integers */
+		n = 0;
+		spec[n++] = *f++;
+		while (*f && strchr("-+ #.0123456789", *f) && n < 10)
+			spec[n++] = *f++;
+		while (*f == 'l')
+			f++;
+		if (!*f)
+			break;
+		switch (*f) {
+		case 's':
+			printf("%.*s", PP_TRACE_NAMELEN, (char *)r->arg);
+			break;
+		case 'T':
+			print_ns(a < r->nargs ? r->arg[a] : 0);
+			a++;
+			break;
+		case '%':
+			putchar('%');
+			break;
+		default:
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+			spec[n++] = *f;
+			spec[n] = '\0';
+			printf(spec, (long long)(a < r->nargs ? r->arg[a] : 0));
+			a++;
+		}
+	}
+}
+
+/* Copy record "i", returning 0 if it was overwritten or is being written */
+static int copy_rec(struct pp_trace_ring *ring, uint64_t i,
+		    struct pp_trace_rec *r)
+{
+	struct pp_trace_rec *src = ring->rec + (i & (ring->nrec - 1));
+	uint32_t seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+
+	if (seq != (uint32_t)(i + 1))
+		return 0;
+	memcpy(r, src, sizeof(*r));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&src->seq, __ATOMIC_RELAXED) == seq;
+}
+
+int main(int argc, char **argv)
+{
+	struct pp_trace_ring *ring;
+	struct pp_trace_rec r;
+	struct stat st;
+	uint64_t i, head, lost = 0;
+	int c, fd, opt_f = 0;
+
+	while ((c = getopt(argc, argv, "ft")) != -1) {
+		switch (c) {
+		case 'f':
+			opt_f = 1;
+			break;
+		case 't':
+			opt_t = 1;
+			break;
+		default:
+			optind = argc;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "%s: use \"%s [-f] [-t] <trace-file>\"\n"
+			"  -f: follow, -t: print the time in all lines\n",
+			argv[0], argv[0]);
+		exit(1);
+	}
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind],
+			strerror(errno));
+		exit(1);
+	}
+	ring = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap(%s): %s\n", argv[0], argv[optind],
+			strerror(errno));
+		exit(1);
+	}
+	if (st.st_size < sizeof(*ring)
+	    || __atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != PP_TRACE_MAGIC
+	    || ring->version != PP_TRACE_VERSION
+	    || ring->recsize != sizeof(r)
+	    || st.st_size < sizeof(*ring) + ring->nrec * sizeof(r)) {
+		fprintf(stderr, "%s: %s: not a ppsi trace file (version %i)\n",
+			argv[0], argv[optind], PP_TRACE_VERSION);
+		exit(1);
+	}
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	i = head > ring->nrec ? head - ring->nrec : 0;
+	while (1) {
+		for (; i < head; i++) {
+			if (head - i > ring->nrec) {
+				/* We are too slow: the writer passed us */
+				lost += head - ring->nrec - i;
+				i = head - ring->nrec;
+			}
+			if (copy_rec(ring, i, &r))
+				print_rec(ring, &r);
+			else
+				lost++;
+		}
+		if (lost) {
+			fflush(stdout);
+			fprintf(stderr, "%s: lost %lli records\n", argv[0],
+				(long long)lost);
+			lost = 0;
+		}
+		if (!opt_f)
+			break;
+		fflush(stdout);
+		usleep(100 * 1000);
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	}
+	return 0;
+}